@@ -1,14 +1,19 @@
 #include "Context.h"
 
+#include "ShaderLibrary.h"
 #include "Util.h"
 
 #include <glfw/glfw3.h>
 
+#include <algorithm>
+#include <array>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <sstream>
+#include <vector>
 
 #ifdef DEBUG
-  #include <array>
   #include <iostream>
 #endif
 
@@ -19,6 +24,22 @@ constexpr XrEnvironmentBlendMode environmentBlendMode = XR_ENVIRONMENT_BLEND_MOD
 
 const std::string applicationName = "OpenXR Vulkan Example";
 const std::string engineName = "OpenXR Vulkan Example";
+
+// The texture array of the renderer never holds more textures than this, even if the device allows more
+constexpr uint32_t maxTextureCountLimit = 1024u;
+// Samplers that the pipelines use besides the texture array, e.g. the depth pyramid of occlusion culling
+constexpr uint32_t reservedSamplerCount = 4u;
+
+const std::string pipelineCacheFilename = "pipeline_cache.bin";
+// Written first and then renamed over the cache file, so that a crash while writing never leaves a broken cache behind
+const std::string pipelineCacheTempFilename = "pipeline_cache.bin.tmp";
+
+// Reads a little-endian 32-bit value, which the pipeline cache header uses regardless of the host byte order
+uint32_t readLittleEndian(const uint8_t* data)
+{
+  return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8u) |
+         (static_cast<uint32_t>(data[2]) << 16u) | (static_cast<uint32_t>(data[3]) << 24u);
+}
 } // namespace
 
 // [tdbe] XrInxtance and VkInstance.
@@ -507,6 +528,14 @@ Context::~Context()
   // Clean up Vulkan
   if (device)
   {
+    delete shaderLibrary;
+
+    if (pipelineCache)
+    {
+      savePipelineCache();
+      vkDestroyPipelineCache(device, pipelineCache, nullptr);
+    }
+
     vkDestroyDevice(device, nullptr);
   }
 
@@ -558,8 +587,9 @@ bool Context::createDevice(VkSurfaceKHR mirrorSurface)
         continue;
       }
 
-      // Check the queue family for drawing support
-      if (queueFamilyCandidate.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+      // Check the queue family for drawing support, occlusion culling also dispatches compute work on the same queue
+      if ((queueFamilyCandidate.queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+          (queueFamilyCandidate.queueFlags & VK_QUEUE_COMPUTE_BIT))
       {
         drawQueueFamilyIndex = static_cast<uint32_t>(queueFamilyIndexCandidate);
         drawQueueFamilyIndexFound = true;
@@ -694,6 +724,24 @@ bool Context::createDevice(VkSurfaceKHR mirrorSurface)
     VkPhysicalDeviceProperties physicalDeviceProperties;
     vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
     uniformBufferOffsetAlignment = physicalDeviceProperties.limits.minUniformBufferOffsetAlignment;
+    vendorId = physicalDeviceProperties.vendorID;
+    deviceId = physicalDeviceProperties.deviceID;
+    memcpy(pipelineCacheUuid.data(), physicalDeviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+
+    // The texture array is a single binding of combined image samplers, so it counts against the sampler and the
+    // sampled image limits, per stage and per pipeline layout
+    const VkPhysicalDeviceLimits& limits = physicalDeviceProperties.limits;
+    const uint32_t samplerLimit =
+      std::min({ limits.maxPerStageDescriptorSamplers, limits.maxPerStageDescriptorSampledImages,
+                 limits.maxDescriptorSetSamplers, limits.maxDescriptorSetSampledImages });
+    maxTextureCount =
+      std::min(maxTextureCountLimit, samplerLimit > reservedSamplerCount ? samplerLimit - reservedSamplerCount : 1u);
+
+    // Timestamps are optional, they are only used to measure how long the GPU takes per frame
+    if (physicalDeviceProperties.limits.timestampComputeAndGraphics)
+    {
+      timestampPeriod = physicalDeviceProperties.limits.timestampPeriod;
+    }
 
     // Determine the best supported multisample count, up to 4x MSAA
     const VkSampleCountFlags sampleCountFlags = physicalDeviceProperties.limits.framebufferColorSampleCounts &
@@ -716,11 +764,77 @@ bool Context::createDevice(VkSurfaceKHR mirrorSurface)
       return false;
     }
 
+    if (!physicalDeviceFeatures.drawIndirectFirstInstance)
+    {
+      util::error(Error::FeatureNotSupported, "Vulkan physical device feature \"drawIndirectFirstInstance\"");
+      return false;
+    }
+
+    // Multi-draw indirect is optional, without it the renderer records every indirect draw on its own
+    maxDrawIndirectCount = physicalDeviceFeatures.multiDrawIndirect ? limits.maxDrawIndirectCount : 1u;
+
+    const auto isDeviceExtensionSupported = [&supportedVulkanDeviceExtensions](const char* extension)
+    {
+      for (const VkExtensionProperties& supportedExtension : supportedVulkanDeviceExtensions)
+      {
+        if (strcmp(extension, supportedExtension.extensionName) == 0)
+        {
+          return true;
+        }
+      }
+      return false;
+    };
+
+    // Extended dynamic state and graphics pipeline libraries are optional, their feature structures are only chained in
+    // when the extensions exist
+    const bool extendedDynamicStateSupported =
+      isDeviceExtensionSupported(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+    const bool extendedDynamicState3Supported =
+      extendedDynamicStateSupported && isDeviceExtensionSupported(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+    const bool graphicsPipelineLibrarySupported =
+      isDeviceExtensionSupported(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+      isDeviceExtensionSupported(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+
     VkPhysicalDeviceFeatures2 physicalDeviceFeatures2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
     VkPhysicalDeviceMultiviewFeatures physicalDeviceMultiviewFeatures{
       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES
     };
+    VkPhysicalDeviceDescriptorIndexingFeatures descriptorIndexingFeatures{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES
+    };
+    VkPhysicalDeviceExtendedDynamicStateFeaturesEXT extendedDynamicStateFeatures{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT
+    };
+    VkPhysicalDeviceExtendedDynamicState3FeaturesEXT extendedDynamicState3Features{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT
+    };
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT graphicsPipelineLibraryFeatures{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT
+    };
+
+    // Appends a feature structure to the chain that 'next' points to the end of
+    const auto chainFeatures = [](void**& next, auto& features)
+    {
+      features.pNext = nullptr;
+      *next = &features;
+      next = &features.pNext;
+    };
+
     physicalDeviceFeatures2.pNext = &physicalDeviceMultiviewFeatures;
+    void** nextFeatures = &physicalDeviceMultiviewFeatures.pNext;
+    chainFeatures(nextFeatures, descriptorIndexingFeatures);
+    if (extendedDynamicStateSupported)
+    {
+      chainFeatures(nextFeatures, extendedDynamicStateFeatures);
+    }
+    if (extendedDynamicState3Supported)
+    {
+      chainFeatures(nextFeatures, extendedDynamicState3Features);
+    }
+    if (graphicsPipelineLibrarySupported)
+    {
+      chainFeatures(nextFeatures, graphicsPipelineLibraryFeatures);
+    }
     vkGetPhysicalDeviceFeatures2(physicalDevice, &physicalDeviceFeatures2);
     if (!physicalDeviceMultiviewFeatures.multiview)
     {
@@ -728,8 +842,52 @@ bool Context::createDevice(VkSurfaceKHR mirrorSurface)
       return false;
     }
 
+    // [tdbe] textures are bindless: all of them sit in one array of the descriptor set, which materials index into
+    if (!descriptorIndexingFeatures.runtimeDescriptorArray ||
+        !descriptorIndexingFeatures.descriptorBindingPartiallyBound ||
+        !descriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing)
+    {
+      util::error(Error::FeatureNotSupported, "Vulkan physical device feature \"descriptorIndexing\"");
+      return false;
+    }
+
+    // Only enable what the renderer uses, the device gets a new chain with the feature structures of what is enabled
+    extendedDynamicState.enabled = extendedDynamicStateSupported && extendedDynamicStateFeatures.extendedDynamicState;
+    extendedDynamicState.blendEquationEnabled = extendedDynamicState.enabled && extendedDynamicState3Supported &&
+                                                extendedDynamicState3Features.extendedDynamicState3ColorBlendEquation;
+    graphicsPipelineLibraryEnabled =
+      graphicsPipelineLibrarySupported && graphicsPipelineLibraryFeatures.graphicsPipelineLibrary;
+
+    nextFeatures = &physicalDeviceMultiviewFeatures.pNext;
+    *nextFeatures = nullptr;
+    descriptorIndexingFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES };
+    descriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+    descriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+    descriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    chainFeatures(nextFeatures, descriptorIndexingFeatures);
+    if (extendedDynamicState.enabled)
+    {
+      chainFeatures(nextFeatures, extendedDynamicStateFeatures);
+      vulkanDeviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+    }
+    if (extendedDynamicState.blendEquationEnabled)
+    {
+      extendedDynamicState3Features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT };
+      extendedDynamicState3Features.extendedDynamicState3ColorBlendEquation = VK_TRUE;
+      chainFeatures(nextFeatures, extendedDynamicState3Features);
+      vulkanDeviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+    }
+    if (graphicsPipelineLibraryEnabled)
+    {
+      chainFeatures(nextFeatures, graphicsPipelineLibraryFeatures);
+      vulkanDeviceExtensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+      vulkanDeviceExtensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+    }
+
     physicalDeviceFeatures.shaderStorageImageMultisample = VK_TRUE; // Needed for some OpenXR implementations
     physicalDeviceMultiviewFeatures.multiview = VK_TRUE;            // Needed for stereo rendering
+    physicalDeviceFeatures.drawIndirectFirstInstance = VK_TRUE;     // Needed for occlusion culled indirect draws
+    physicalDeviceFeatures.multiDrawIndirect = maxDrawIndirectCount > 1u ? VK_TRUE : VK_FALSE; // Merged draws
 
     constexpr float queuePriority = 1.0f;
 
@@ -785,9 +943,135 @@ bool Context::createDevice(VkSurfaceKHR mirrorSurface)
     return false;
   }
 
+  // Load the extended dynamic state functions
+  if (extendedDynamicState.enabled)
+  {
+    extendedDynamicState.vkCmdSetCullModeEXT = reinterpret_cast<PFN_vkCmdSetCullModeEXT>(
+      util::loadVkExtensionFunction(vkInstance, "vkCmdSetCullModeEXT"));
+    extendedDynamicState.vkCmdSetDepthTestEnableEXT = reinterpret_cast<PFN_vkCmdSetDepthTestEnableEXT>(
+      util::loadVkExtensionFunction(vkInstance, "vkCmdSetDepthTestEnableEXT"));
+    extendedDynamicState.vkCmdSetDepthWriteEnableEXT = reinterpret_cast<PFN_vkCmdSetDepthWriteEnableEXT>(
+      util::loadVkExtensionFunction(vkInstance, "vkCmdSetDepthWriteEnableEXT"));
+    extendedDynamicState.vkCmdSetDepthCompareOpEXT = reinterpret_cast<PFN_vkCmdSetDepthCompareOpEXT>(
+      util::loadVkExtensionFunction(vkInstance, "vkCmdSetDepthCompareOpEXT"));
+    if (!extendedDynamicState.vkCmdSetCullModeEXT || !extendedDynamicState.vkCmdSetDepthTestEnableEXT ||
+        !extendedDynamicState.vkCmdSetDepthWriteEnableEXT || !extendedDynamicState.vkCmdSetDepthCompareOpEXT)
+    {
+      util::error(Error::GenericVulkan);
+      return false;
+    }
+  }
+
+  if (extendedDynamicState.blendEquationEnabled)
+  {
+    extendedDynamicState.vkCmdSetColorBlendEquationEXT = reinterpret_cast<PFN_vkCmdSetColorBlendEquationEXT>(
+      util::loadVkExtensionFunction(vkInstance, "vkCmdSetColorBlendEquationEXT"));
+    if (!extendedDynamicState.vkCmdSetColorBlendEquationEXT)
+    {
+      util::error(Error::GenericVulkan);
+      return false;
+    }
+  }
+
+  if (!createPipelineCache())
+  {
+    return false;
+  }
+
+  shaderLibrary = new ShaderLibrary(device);
+
+  return true;
+}
+
+bool Context::createPipelineCache()
+{
+  // Load the cache of a previous run, if there is one
+  std::vector<uint8_t> cacheData;
+  std::ifstream file(pipelineCacheFilename, std::ios::ate | std::ios::binary);
+  if (file.is_open())
+  {
+    cacheData.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(cacheData.data()), cacheData.size());
+    if (!file)
+    {
+      cacheData.clear();
+    }
+    file.close();
+  }
+
+  // Only hand it to the driver if it was created by the same driver and device, an outdated cache (after a driver
+  // update for example) is dropped and rebuilt. The header is the same for all versions of Vulkan 1.x:
+  // header size, header version, vendor ID, device ID and the pipeline cache UUID.
+  constexpr size_t headerSize = 16u + VK_UUID_SIZE;
+  if (!cacheData.empty())
+  {
+    const bool headerValid = cacheData.size() >= headerSize && readLittleEndian(&cacheData[0]) >= headerSize &&
+                             readLittleEndian(&cacheData[4]) == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+                             readLittleEndian(&cacheData[8]) == vendorId &&
+                             readLittleEndian(&cacheData[12]) == deviceId &&
+                             memcmp(&cacheData[16], pipelineCacheUuid.data(), VK_UUID_SIZE) == 0;
+    if (!headerValid)
+    {
+      cacheData.clear();
+    }
+  }
+
+  VkPipelineCacheCreateInfo pipelineCacheCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+  pipelineCacheCreateInfo.initialDataSize = cacheData.size();
+  pipelineCacheCreateInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
+  if (vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache) != VK_SUCCESS)
+  {
+    // The driver can still reject the data, start over with an empty cache then
+    pipelineCacheCreateInfo.initialDataSize = 0u;
+    pipelineCacheCreateInfo.pInitialData = nullptr;
+    if (vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache) != VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      return false;
+    }
+  }
+
   return true;
 }
 
+void Context::savePipelineCache() const
+{
+  size_t cacheSize = 0u;
+  if (vkGetPipelineCacheData(device, pipelineCache, &cacheSize, nullptr) != VK_SUCCESS || cacheSize == 0u)
+  {
+    return;
+  }
+
+  std::vector<uint8_t> cacheData(cacheSize);
+  if (vkGetPipelineCacheData(device, pipelineCache, &cacheSize, cacheData.data()) != VK_SUCCESS)
+  {
+    return;
+  }
+
+  // Failing to save the cache only costs the next start some time, so it is not reported
+  {
+    std::ofstream file(pipelineCacheTempFilename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+      return;
+    }
+
+    file.write(reinterpret_cast<const char*>(cacheData.data()), cacheSize);
+    if (!file)
+    {
+      return;
+    }
+  }
+
+  std::error_code errorCode;
+  std::filesystem::rename(pipelineCacheTempFilename, pipelineCacheFilename, errorCode);
+  if (errorCode)
+  {
+    std::filesystem::remove(pipelineCacheTempFilename, errorCode);
+  }
+}
+
 void Context::sync() const
 {
   vkDeviceWaitIdle(device);
@@ -848,7 +1132,42 @@ VkDeviceSize Context::getUniformBufferOffsetAlignment() const
   return uniformBufferOffsetAlignment;
 }
 
+uint32_t Context::getMaxTextureCount() const
+{
+  return maxTextureCount;
+}
+
 VkSampleCountFlagBits Context::getMultisampleCount() const
 {
   return multisampleCount;
 }
+
+float Context::getTimestampPeriod() const
+{
+  return timestampPeriod;
+}
+
+VkPipelineCache Context::getVkPipelineCache() const
+{
+  return pipelineCache;
+}
+
+ShaderLibrary* Context::getShaderLibrary() const
+{
+  return shaderLibrary;
+}
+
+const Context::ExtendedDynamicState& Context::getExtendedDynamicState() const
+{
+  return extendedDynamicState;
+}
+
+bool Context::isGraphicsPipelineLibraryEnabled() const
+{
+  return graphicsPipelineLibraryEnabled;
+}
+
+uint32_t Context::getMaxDrawIndirectCount() const
+{
+  return maxDrawIndirectCount;
+}
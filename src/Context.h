@@ -5,6 +5,10 @@
 #define XR_USE_GRAPHICS_API_VULKAN
 #include <openxr/openxr_platform.h>
 
+#include <array>
+
+class ShaderLibrary;
+
 /*
  * The context class handles the initial loading of both OpenXR and Vulkan base functionality such as instances, OpenXR
  * sessions, Vulkan devices and queues, and so on. It also loads debug utility messengers for both OpenXR and Vulkan if
@@ -14,6 +18,20 @@
 class Context final
 {
 public:
+  // [tdbe] extended dynamic state is optional. When enabled, pipelines leave their cull mode and depth state to the
+  // command buffer, and with blendEquationEnabled (VK_EXT_extended_dynamic_state3) their blend equation as well, so
+  // materials that only differ in those share a pipeline. The functions are null when not enabled.
+  struct ExtendedDynamicState
+  {
+    bool enabled = false;
+    bool blendEquationEnabled = false;
+    PFN_vkCmdSetCullModeEXT vkCmdSetCullModeEXT = nullptr;
+    PFN_vkCmdSetDepthTestEnableEXT vkCmdSetDepthTestEnableEXT = nullptr;
+    PFN_vkCmdSetDepthWriteEnableEXT vkCmdSetDepthWriteEnableEXT = nullptr;
+    PFN_vkCmdSetDepthCompareOpEXT vkCmdSetDepthCompareOpEXT = nullptr;
+    PFN_vkCmdSetColorBlendEquationEXT vkCmdSetColorBlendEquationEXT = nullptr;
+  };
+
   Context();
   ~Context();
 
@@ -34,7 +52,22 @@ public:
   VkQueue getVkPresentQueue() const;
 
   VkDeviceSize getUniformBufferOffsetAlignment() const;
+  // The size of the bindless texture array, within the descriptor limits of the device
+  uint32_t getMaxTextureCount() const;
   VkSampleCountFlagBits getMultisampleCount() const;
+  // Nanoseconds per timestamp query tick, 0 if the draw queue doesn't support timestamps
+  float getTimestampPeriod() const;
+  // [tdbe] all pipelines are created through this cache. It is loaded from disk when the device is created and written
+  // back when the context is destroyed, so warm starts skip most of the shader compilation.
+  VkPipelineCache getVkPipelineCache() const;
+  // [tdbe] shader modules are loaded once and shared by all pipelines that use them, see ShaderLibrary.h
+  ShaderLibrary* getShaderLibrary() const;
+  const ExtendedDynamicState& getExtendedDynamicState() const;
+  // [tdbe] with VK_EXT_graphics_pipeline_library, pipelines for materials added at runtime get linked from precompiled
+  // parts instead of being compiled from scratch (see PipelineLibraryCache in Pipeline.h)
+  bool isGraphicsPipelineLibraryEnabled() const;
+  // The most draws a single indirect draw call may record, 1 without the multiDrawIndirect feature
+  uint32_t getMaxDrawIndirectCount() const;
 
 private:
   bool valid = true;
@@ -54,7 +87,21 @@ private:
   VkDevice device = nullptr;
   VkQueue drawQueue = nullptr, presentQueue = nullptr;
   VkDeviceSize uniformBufferOffsetAlignment = 0u;
+  uint32_t maxTextureCount = 0u;
   VkSampleCountFlagBits multisampleCount = VK_SAMPLE_COUNT_1_BIT;
+  float timestampPeriod = 0.0f;
+  ExtendedDynamicState extendedDynamicState;
+  bool graphicsPipelineLibraryEnabled = false;
+  uint32_t maxDrawIndirectCount = 1u;
+
+  // Identify the device that a pipeline cache on disk was created with
+  uint32_t vendorId = 0u, deviceId = 0u;
+  std::array<uint8_t, VK_UUID_SIZE> pipelineCacheUuid = {};
+  VkPipelineCache pipelineCache = nullptr;
+  ShaderLibrary* shaderLibrary = nullptr;
+
+  bool createPipelineCache();
+  void savePipelineCache() const;
 
 #ifdef DEBUG
   PFN_xrCreateDebugUtilsMessengerEXT xrCreateDebugUtilsMessengerEXT = nullptr;
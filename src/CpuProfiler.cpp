@@ -0,0 +1,234 @@
+#include "CpuProfiler.h"
+
+#include "Util.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+constexpr size_t eventsPerThread = 65536u; // Ring buffer size of each thread
+
+enum class EventType
+{
+  Zone,
+  Counter
+};
+
+struct Event
+{
+  const char* name = nullptr;
+  long long time = 0;     // Start time in nanoseconds since the profiler epoch
+  long long duration = 0; // Only for zones, in nanoseconds
+  double value = 0.0;     // Only for counters
+  EventType type = EventType::Zone;
+};
+
+struct ThreadBuffer
+{
+  std::mutex mutex; // Only ever contended while the trace is written or cleared
+  size_t threadIndex = 0u;
+  const char* threadName = nullptr;
+  std::vector<Event> events;
+  size_t next = 0u;  // Ring buffer position of the next event
+  size_t count = 0u; // Up to the events per thread
+};
+
+std::atomic<bool> profilerEnabled = false;
+
+std::mutex threadBuffersMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> threadBuffers; // Kept alive after their thread exits to write them out
+
+const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+long long now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+ThreadBuffer& getThreadBuffer()
+{
+  thread_local ThreadBuffer* threadBuffer = nullptr;
+  if (!threadBuffer)
+  {
+    std::unique_ptr<ThreadBuffer> newThreadBuffer = std::make_unique<ThreadBuffer>();
+    newThreadBuffer->events.resize(eventsPerThread);
+
+    const std::lock_guard<std::mutex> lock(threadBuffersMutex);
+    newThreadBuffer->threadIndex = threadBuffers.size();
+    threadBuffer = newThreadBuffer.get();
+    threadBuffers.push_back(std::move(newThreadBuffer));
+  }
+
+  return *threadBuffer;
+}
+
+void record(const Event& event)
+{
+  ThreadBuffer& threadBuffer = getThreadBuffer();
+  const std::lock_guard<std::mutex> lock(threadBuffer.mutex);
+
+  threadBuffer.events.at(threadBuffer.next) = event;
+  threadBuffer.next = (threadBuffer.next + 1u) % eventsPerThread;
+  if (threadBuffer.count < eventsPerThread)
+  {
+    ++threadBuffer.count;
+  }
+}
+
+// Writes a string as a JSON string literal
+void writeJsonString(std::ofstream& file, const char* string)
+{
+  file << '"';
+  for (const char* character = string; *character != '\0'; ++character)
+  {
+    if (*character == '"' || *character == '\\')
+    {
+      file << '\\';
+    }
+    file << *character;
+  }
+  file << '"';
+}
+} // namespace
+
+namespace profiler
+{
+
+void setEnabled(bool enabled)
+{
+  profilerEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool isEnabled()
+{
+  return profilerEnabled.load(std::memory_order_relaxed);
+}
+
+void setThreadName(const char* name)
+{
+  ThreadBuffer& threadBuffer = getThreadBuffer();
+  const std::lock_guard<std::mutex> lock(threadBuffer.mutex);
+  threadBuffer.threadName = name;
+}
+
+void counter(const char* name, double value)
+{
+  if (!isEnabled())
+  {
+    return;
+  }
+
+  Event event;
+  event.name = name;
+  event.time = now();
+  event.value = value;
+  event.type = EventType::Counter;
+  record(event);
+}
+
+bool writeChromeTrace(const std::string& filename)
+{
+  std::ofstream file(filename, std::ios::trunc);
+  if (!file.is_open())
+  {
+    util::error(Error::FileMissing, filename);
+    return false;
+  }
+
+  // The trace format wants microseconds
+  file.setf(std::ios::fixed);
+  file.precision(3);
+
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool firstEvent = true;
+
+  const std::lock_guard<std::mutex> buffersLock(threadBuffersMutex);
+  for (const std::unique_ptr<ThreadBuffer>& threadBuffer : threadBuffers)
+  {
+    const std::lock_guard<std::mutex> lock(threadBuffer->mutex);
+
+    if (threadBuffer->threadName)
+    {
+      file << (firstEvent ? "" : ",") << "\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,\"tid\":"
+           << threadBuffer->threadIndex << ",\"args\":{\"name\":";
+      writeJsonString(file, threadBuffer->threadName);
+      file << "}}";
+      firstEvent = false;
+    }
+
+    // Oldest event first
+    const size_t firstIndex = (threadBuffer->next + eventsPerThread - threadBuffer->count) % eventsPerThread;
+    for (size_t eventIndex = 0u; eventIndex < threadBuffer->count; ++eventIndex)
+    {
+      const Event& event = threadBuffer->events.at((firstIndex + eventIndex) % eventsPerThread);
+
+      file << (firstEvent ? "" : ",") << "\n{\"name\":";
+      writeJsonString(file, event.name);
+      file << ",\"pid\":0,\"tid\":" << threadBuffer->threadIndex
+           << ",\"ts\":" << static_cast<double>(event.time) / 1000.0;
+      if (event.type == EventType::Zone)
+      {
+        file << ",\"ph\":\"X\",\"dur\":" << static_cast<double>(event.duration) / 1000.0 << "}";
+      }
+      else
+      {
+        file << ",\"ph\":\"C\",\"args\":{\"value\":" << event.value << "}}";
+      }
+      firstEvent = false;
+    }
+  }
+
+  file << "\n]}\n";
+  if (!file.good())
+  {
+    util::error(Error::FileMissing, filename);
+    return false;
+  }
+
+  return true;
+}
+
+void clear()
+{
+  const std::lock_guard<std::mutex> buffersLock(threadBuffersMutex);
+  for (const std::unique_ptr<ThreadBuffer>& threadBuffer : threadBuffers)
+  {
+    const std::lock_guard<std::mutex> lock(threadBuffer->mutex);
+    threadBuffer->next = 0u;
+    threadBuffer->count = 0u;
+  }
+}
+
+Zone::Zone(const char* name) : name(name)
+{
+  startTime = isEnabled() ? now() : -1;
+}
+
+Zone::~Zone()
+{
+  end();
+}
+
+void Zone::end()
+{
+  if (startTime < 0)
+  {
+    return;
+  }
+
+  Event event;
+  event.name = name;
+  event.time = startTime;
+  event.duration = now() - startTime;
+  event.type = EventType::Zone;
+  record(event);
+
+  startTime = -1;
+}
+
+} // namespace profiler
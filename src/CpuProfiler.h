@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+
+/*
+ * The profiler namespace records what the CPU spends its time on. Scoped zones and counters are collected into a buffer
+ * per thread, so threads don't contend with each other while recording, and can be written out as a Chrome trace
+ * (JSON) that opens in chrome://tracing or ui.perfetto.dev. Each thread buffer keeps the most recent events only, older
+ * ones get overwritten. While the profiler is disabled a zone costs a single flag check.
+ *
+ * Zone and counter names are not copied, they have to outlive the profiler (string literals for example).
+ */
+namespace profiler
+{
+
+void setEnabled(bool enabled);
+bool isEnabled();
+
+// Names the calling thread in the trace
+void setThreadName(const char* name);
+
+// Records the value of a counter at the current time, the trace shows it as a graph
+void counter(const char* name, double value);
+
+// Writes all recorded events of all threads into 'filename', returns false on error
+bool writeChromeTrace(const std::string& filename);
+
+// Drops all recorded events
+void clear();
+
+// Records the time from its construction until end() is called or it is destroyed, whichever comes first
+class Zone final
+{
+public:
+  explicit Zone(const char* name);
+  ~Zone();
+
+  Zone(const Zone&) = delete;
+  Zone& operator=(const Zone&) = delete;
+
+  void end();
+
+private:
+  const char* name = nullptr;
+  long long startTime = 0; // In nanoseconds since the profiler epoch, negative when not recording
+};
+
+} // namespace profiler
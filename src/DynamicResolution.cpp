@@ -0,0 +1,66 @@
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+// Aim a bit below the frame budget, the compositor needs some GPU time as well
+constexpr float targetBudgetFraction = 0.9f;
+// Only change the scale when the GPU time is this far off the target
+constexpr float deadZone = 0.05f;
+// Largest change of the scale per measurement, downwards and upwards
+constexpr float maxScaleDecrease = 0.1f;
+constexpr float maxScaleIncrease = 0.02f;
+// Weight of a new measurement in the smoothed GPU time
+constexpr float smoothingFactor = 0.2f;
+} // namespace
+
+DynamicResolution::DynamicResolution(float minScale, float maxScale)
+{
+  setScaleBounds(minScale, maxScale);
+  scale = this->maxScale;
+}
+
+void DynamicResolution::setScaleBounds(float minScale, float maxScale)
+{
+  this->minScale = std::clamp(minScale, 0.1f, 1.0f);
+  this->maxScale = std::clamp(maxScale, this->minScale, 1.0f);
+  scale = std::clamp(scale, this->minScale, this->maxScale);
+}
+
+float DynamicResolution::update(float gpuFrameTime, float frameBudget)
+{
+  if (gpuFrameTime <= 0.0f || frameBudget <= 0.0f)
+  {
+    return scale;
+  }
+
+  // A frame over budget is acted on right away, everything else is smoothed
+  if (smoothedGpuFrameTime <= 0.0f || gpuFrameTime > frameBudget)
+  {
+    smoothedGpuFrameTime = gpuFrameTime;
+  }
+  else
+  {
+    smoothedGpuFrameTime += (gpuFrameTime - smoothedGpuFrameTime) * smoothingFactor;
+  }
+
+  const float target = frameBudget * targetBudgetFraction;
+  const float error = smoothedGpuFrameTime / target;
+  if (std::abs(error - 1.0f) < deadZone)
+  {
+    return scale;
+  }
+
+  // GPU time is assumed to be proportional to the pixel count, so to the square of the scale
+  const float desiredScale = scale / std::sqrt(error);
+  scale = std::clamp(desiredScale, scale - maxScaleDecrease, scale + maxScaleIncrease);
+  scale = std::clamp(scale, minScale, maxScale);
+  return scale;
+}
+
+float DynamicResolution::getScale() const
+{
+  return scale;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+ * The dynamic resolution class picks the render scale of the headset (see Headset::setRenderScale()) from measured GPU
+ * frame times. The pixel count goes with the square of the scale, so the scale is corrected by the square root of how
+ * far the smoothed GPU time is off the target. It drops quickly when a frame goes over budget and climbs back slowly,
+ * so that it doesn't oscillate. The scale always stays within the configured bounds.
+ */
+class DynamicResolution final
+{
+public:
+  DynamicResolution(float minScale, float maxScale);
+
+  void setScaleBounds(float minScale, float maxScale);
+
+  // Feeds the GPU time of a finished frame and the time available per frame (both in milliseconds), returns the new
+  // render scale
+  float update(float gpuFrameTime, float frameBudget);
+
+  float getScale() const;
+
+private:
+  float minScale = 0.5f, maxScale = 1.0f;
+  float scale = 1.0f;
+  float smoothedGpuFrameTime = 0.0f;
+};
@@ -0,0 +1,45 @@
+# Writes the SPIR-V binaries of the shaders in SHADER_NAMES (separated by '|') from SHADER_DIR into OUTPUT, a C++ source
+# file that defines the embedded shaders of EmbeddedShaders.h. Run in script mode (cmake -P) after compiling the shaders.
+
+string(REPLACE "|" ";" SHADER_NAMES "${SHADER_NAMES}")
+
+# Eight words per line
+set(WORD_PATTERN "0x[0-9a-f]+u, ")
+set(LINE_PATTERN "")
+foreach(WORD_INDEX RANGE 1 8)
+  string(APPEND LINE_PATTERN "${WORD_PATTERN}")
+endforeach()
+
+set(ARRAYS "")
+set(ENTRIES "")
+foreach(SHADER ${SHADER_NAMES})
+  set(SHADER_FILE "${SHADER_DIR}/${SHADER}.spv")
+  file(READ "${SHADER_FILE}" CODE HEX)
+
+  string(LENGTH "${CODE}" CODE_LENGTH)
+  math(EXPR CODE_REMAINDER "${CODE_LENGTH} % 8")
+  if(CODE_LENGTH EQUAL 0 OR NOT CODE_REMAINDER EQUAL 0)
+    message(FATAL_ERROR "${SHADER_FILE} is not a SPIR-V binary")
+  endif()
+
+  # SPIR-V consists of 32-bit words, which glslc writes in little-endian byte order
+  string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1u, " WORDS "${CODE}")
+  string(REGEX REPLACE "(${LINE_PATTERN})" "\\1\n  " WORDS "${WORDS}")
+  string(REPLACE ", \n" ",\n" WORDS "${WORDS}")
+  string(STRIP "${WORDS}" WORDS)
+
+  string(MAKE_C_IDENTIFIER "${SHADER}" ARRAY_NAME)
+  math(EXPR CODE_SIZE "${CODE_LENGTH} / 2")
+  string(APPEND ARRAYS "constexpr uint32_t ${ARRAY_NAME}[] = {\n  ${WORDS}\n};\n\n")
+  string(APPEND ENTRIES "  { \"${SHADER}.spv\", ${ARRAY_NAME}, ${CODE_SIZE}u },\n")
+endforeach()
+
+list(LENGTH SHADER_NAMES SHADER_COUNT)
+
+set(SOURCE "// Generated by EmbedShaders.cmake from the compiled shaders, changes get overwritten\n\n")
+string(APPEND SOURCE "#include \"EmbeddedShaders.h\"\n\n")
+string(APPEND SOURCE "namespace\n{\n${ARRAYS}} // namespace\n\n")
+string(APPEND SOURCE "const embeddedShaders::Shader embeddedShaders::shaders[] = {\n${ENTRIES}};\n\n")
+string(APPEND SOURCE "const size_t embeddedShaders::shaderCount = ${SHADER_COUNT}u;\n")
+
+file(WRITE "${OUTPUT}" "${SOURCE}")
@@ -0,0 +1,15 @@
+#include "EmbeddedShaders.h"
+
+const embeddedShaders::Shader* embeddedShaders::find(std::string_view filename)
+{
+  // There are only a handful of shaders, and each is only looked up once (see ShaderLibrary)
+  for (size_t shaderIndex = 0u; shaderIndex < shaderCount; ++shaderIndex)
+  {
+    if (shaders[shaderIndex].filename == filename)
+    {
+      return &shaders[shaderIndex];
+    }
+  }
+
+  return nullptr;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/*
+ * The embedded shaders are the SPIR-V binaries of all shaders in the build, compiled into the executable (see
+ * EmbedShaders.cmake), so loading a shader doesn't touch the file system. They are looked up by the same file name they
+ * would have on disk, e.g. "shaders/Diffuse.vert.spv".
+ */
+namespace embeddedShaders
+{
+
+struct Shader
+{
+  std::string_view filename;
+  const uint32_t* code = nullptr; // 32-bit words, so suitably aligned for VkShaderModuleCreateInfo::pCode
+  size_t codeSize = 0u;           // In bytes
+};
+
+// Returns nullptr for a shader that isn't embedded
+const Shader* find(std::string_view filename);
+
+// Defined in the generated source file
+extern const Shader shaders[];
+extern const size_t shaderCount;
+
+} // namespace embeddedShaders
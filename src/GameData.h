@@ -1,26 +1,66 @@
 #pragma once
 #include <string>
 #include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
 #include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 
 //#include <vulkan/vulkan.h>
 #include "Pipeline.h"
 
+class Texture;
+
+// [tdbe] Every change to a game object's transform or to a material's values is stamped with a new version, unique
+// across all of them. The renderer keeps the versions it last uploaded for each frame in flight, so it only copies
+// what changed, and each frame in flight gets each change exactly once.
+inline uint64_t nextDataVersion()
+{
+	static std::atomic<uint64_t> lastVersion = 0u;
+	return ++lastVersion;
+}
+
+// [tdbe] Render queues are drawn in this order. Opaque objects get sorted front-to-back, to get the most out of early
+// depth testing, and transparent objects back-to-front, so they blend over whatever is behind them.
+enum class RenderQueue{
+	Opaque = 0,
+	Transparent = 1
+};
+
 // [tdbe] TODO: Default Material struct. Can treat as "uber material" data,
 // or can make multiple versions of this.
 struct Material 
 {
-	DynamicMaterialUniformData dynamicUniformData = {};
 	// [tdbe] if you change any of the shaders, the renderer creates a new pipeline with the shaders.
 	std::string vertShaderName = "shaders/Diffuse.vert.spv";
 	std::string fragShaderName = "shaders/Diffuse.frag.spv";
 	// [tdbe] if you change any pipeline data properties, the renderer creates a new pipeline for this shader.
 	PipelineMaterialPayload pipelineData = {};
-	// [tdbe] TODO: textures 🙃 set up per material descriptor sets, with descriptor layouts that support textures.
-	// VkDescriptorSet descriptorSet;
-	// and then use different pipelines for each pipeline layout here, as needed:
+	// [tdbe] set to Transparent for alpha blended materials.
+	RenderQueue renderQueue = RenderQueue::Opaque;
+	// [tdbe] textures are bindless, a material refers to them by index in its dynamic uniform data (see
+	// Renderer::addTexture()), so materials don't need descriptor sets of their own.
 	Pipeline* pipeline = nullptr; //vkPipeline; right now it points to just 2 or 3 pipelines, not really one per material.
+	// [tdbe] set by the renderer for opaque materials: the depth prepass pipeline, and the main pass variant with an
+	// equal depth test and no depth writes.
+	Pipeline* depthPrepassPipeline = nullptr;
+	Pipeline* depthEqualPipeline = nullptr;
+	// [tdbe] set by the renderer: the material's entry in the material table, where the shaders of all its objects
+	// read its dynamic uniform data from.
+	uint32_t materialIndex = 0u;
+
+	const DynamicMaterialUniformData& getDynamicUniformData() const { return dynamicUniformData; }
+	void setDynamicUniformData(const DynamicMaterialUniformData& dynamicUniformData_){
+		dynamicUniformData = dynamicUniformData_;
+		version = nextDataVersion();
+	}
+	uint64_t getVersion() const { return version; }
+
+private:
+	DynamicMaterialUniformData dynamicUniformData = {};
+	uint64_t version = nextDataVersion();
 };
 
 /*
@@ -32,14 +72,15 @@ struct Model final
 {
   size_t firstIndex = 0u;
   size_t indexCount = 0u;
+  // [tdbe] local space bounding box, used for occlusion culling
+  glm::vec3 boundsMin = glm::vec3(0.0f);
+  glm::vec3 boundsMax = glm::vec3(0.0f);
 };
 
 struct GameObject{
 	std::string name = "game object";
 	// [tdbe] isVisible means whether or not it will be rendered
 	bool isVisible = true;
-	// [tdbe] coordinate system: Y is up, Z is forward
-	glm::mat4 worldMatrix = glm::mat4(1.0f);
 	Model *model = nullptr;
 	Material *material = nullptr;
 	GameObject(Model *model_ = nullptr, Material *material_ = nullptr, bool isVisible_ = true, std::string name_ = "game object"){
@@ -48,6 +89,51 @@ struct GameObject{
 		material = material_;
 		isVisible = isVisible_;
 	}
+
+	const glm::mat4& getWorldMatrix() const { return worldMatrix; }
+	void setWorldMatrix(const glm::mat4& worldMatrix_){
+		worldMatrix = worldMatrix_;
+		version = nextDataVersion();
+	}
+	uint64_t getVersion() const { return version; }
+
+private:
+	// [tdbe] coordinate system: Y is up, Z is forward
+	glm::mat4 worldMatrix = glm::mat4(1.0f);
+	uint64_t version = nextDataVersion();
+};
+
+// [tdbe] Everything the renderer needs of a game object and its material to draw one frame. The simulation thread
+// copies it out of the game object, so that the render thread never reads game objects or materials while the game
+// mechanics change them. The game object and material pointers only identify them, they aren't dereferenced.
+struct GameObjectSnapshot{
+	const GameObject* gameObject = nullptr;
+	const Model* model = nullptr; // Models don't change after loading
+	glm::mat4 worldMatrix = glm::mat4(1.0f);
+	uint64_t version = 0u;
+	bool isVisible = true;
+	uint32_t materialIndex = 0u; // Into SceneSnapshot::materials
+	RenderQueue renderQueue = RenderQueue::Opaque;
+	PipelineMaterialPayload pipelineData = {}; // Set per draw for the parts that pipelines leave dynamic
+	const Pipeline* pipeline = nullptr;
+	const Pipeline* depthPrepassPipeline = nullptr;
+	const Pipeline* depthEqualPipeline = nullptr;
+};
+
+// [tdbe] A material's entry in the material table, copied out of the material like the game object snapshots.
+struct MaterialSnapshot{
+	const Material* material = nullptr; // Null for entries that no material uses
+	DynamicMaterialUniformData materialData = {};
+	uint64_t version = 0u;
+};
+
+// [tdbe] An immutable copy of the scene for one frame, handed from the simulation thread to the render thread.
+struct SceneSnapshot{
+	std::vector<GameObjectSnapshot> gameObjects; // In the renderer's game object order, the index is the object index
+	std::vector<MaterialSnapshot> materials;     // The material table, the index is the material index
+	std::vector<Texture*> textures;              // The texture array, the index is the texture index
+	glm::mat4 cameraMatrix = glm::mat4(1.0f);    // Transform from world to stage space
+	float time = 0.0f;
 };
 
 // [tdbe] Note: this is meant to be used in a list or a table of states.
@@ -0,0 +1,47 @@
+#include "GpuProfiler.h"
+
+void GpuProfiler::addSample(GpuTimer timer, float milliseconds)
+{
+  Samples& timerSamples = samples.at(static_cast<size_t>(timer));
+
+  // Replace the oldest sample once the window is full
+  if (timerSamples.count == windowSize)
+  {
+    timerSamples.sum -= timerSamples.values.at(timerSamples.next);
+  }
+  else
+  {
+    ++timerSamples.count;
+  }
+
+  timerSamples.values.at(timerSamples.next) = milliseconds;
+  timerSamples.sum += milliseconds;
+  timerSamples.next = (timerSamples.next + 1u) % windowSize;
+}
+
+float GpuProfiler::getLatest(GpuTimer timer) const
+{
+  const Samples& timerSamples = samples.at(static_cast<size_t>(timer));
+  if (timerSamples.count == 0u)
+  {
+    return 0.0f;
+  }
+
+  return timerSamples.values.at((timerSamples.next + windowSize - 1u) % windowSize);
+}
+
+float GpuProfiler::getAverage(GpuTimer timer) const
+{
+  const Samples& timerSamples = samples.at(static_cast<size_t>(timer));
+  if (timerSamples.count == 0u)
+  {
+    return 0.0f;
+  }
+
+  return timerSamples.sum / static_cast<float>(timerSamples.count);
+}
+
+size_t GpuProfiler::getSampleCount(GpuTimer timer) const
+{
+  return samples.at(static_cast<size_t>(timer)).count;
+}
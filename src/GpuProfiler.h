@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+// The parts of a frame that get timed on the GPU. Timers can't be written inside the (multiview) eye render passes, so
+// they are placed around them.
+enum class GpuTimer
+{
+  Frame = 0,                 // The whole command buffer, see RenderProcess::writeFrameBeginTimestamp()
+  OcclusionCulling,          // First culling phase
+  EyeRenderPass,             // Depth prepass and main pass
+  DepthPyramid,              // Depth pyramid build and second culling phase
+  EyeContinuationRenderPass, // Draws of the second culling phase
+  MirrorBlit,                // Copy into the mirror view window
+  Count
+};
+
+/*
+ * The GPU profiler class keeps the recent GPU timings of each timer, as read back from the timestamp queries of the
+ * render processes, and averages them over a rolling window of frames. All times are in milliseconds.
+ */
+class GpuProfiler final
+{
+public:
+  static constexpr size_t windowSize = 64u;
+
+  void addSample(GpuTimer timer, float milliseconds);
+
+  // Both return 0 for a timer that has no samples yet
+  float getLatest(GpuTimer timer) const;
+  float getAverage(GpuTimer timer) const;
+  size_t getSampleCount(GpuTimer timer) const;
+
+private:
+  struct Samples
+  {
+    std::array<float, windowSize> values = {};
+    size_t next = 0u;  // Ring buffer position of the next sample
+    size_t count = 0u; // Up to the window size
+    float sum = 0.0f;
+  };
+  std::array<Samples, static_cast<size_t>(GpuTimer::Count)> samples;
+};
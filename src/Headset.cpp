@@ -7,13 +7,155 @@
 
 #include <glm/mat4x4.hpp>
 
+#include <algorithm>
 #include <array>
+#include <cmath>
 
 namespace
 {
 constexpr XrReferenceSpaceType spaceType = XR_REFERENCE_SPACE_TYPE_STAGE;
 constexpr VkFormat colorFormat = VK_FORMAT_R8G8B8A8_SRGB;//_RGBA8UnormSrgb
 constexpr VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
+
+// Creates the render pass used to render to the eye buffers. A continuation render pass loads the color and depth left
+// behind by a previous pass instead of clearing them. Both are compatible, so they share the same framebuffers.
+bool createRenderPass(VkDevice device, VkSampleCountFlagBits multisampleCount, bool continuation, VkRenderPass& renderPass)
+{
+  // Both subpasses (depth prepass and main pass) render to both views
+  constexpr std::array<uint32_t, 2u> viewMasks = { 0b00000011, 0b00000011 };
+  constexpr uint32_t correlationMask = 0b00000011;
+
+  // [tdbe] Single pass / multiview explanation:
+  // [tdbe] We feed this multiview create info into the regular vk render pass creation.
+  // [tdbe] Vulklan will execute the render pipeline twice (or whatever number is in pViewMasks)
+  // [tdbe] To use multiview, in the shader you enable the GL_EXT_multiview extension, and then
+  // [tdbe] get a glViewIndex depending on what multiview view you are about to output to. So you
+  // [tdbe] can use e.g. an array of transformation matrixes indexed by this.
+  VkRenderPassMultiviewCreateInfo renderPassMultiviewCreateInfo{
+    VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO
+  };
+  renderPassMultiviewCreateInfo.subpassCount = static_cast<uint32_t>(viewMasks.size());
+  renderPassMultiviewCreateInfo.pViewMasks = viewMasks.data();
+  renderPassMultiviewCreateInfo.correlationMaskCount = 1u;
+  renderPassMultiviewCreateInfo.pCorrelationMasks = &correlationMask;
+
+  VkAttachmentDescription colorAttachmentDescription{};
+  colorAttachmentDescription.format = colorFormat;
+  colorAttachmentDescription.samples = multisampleCount;
+  colorAttachmentDescription.loadOp = continuation ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+  colorAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  colorAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  colorAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  colorAttachmentDescription.initialLayout =
+    continuation ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+  colorAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkAttachmentReference colorAttachmentReference;
+  colorAttachmentReference.attachment = 0u;
+  colorAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkAttachmentDescription depthAttachmentDescription{};
+  depthAttachmentDescription.format = depthFormat;
+  depthAttachmentDescription.samples = multisampleCount;
+  depthAttachmentDescription.loadOp = continuation ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+  // The depth of the first pass is kept for the depth pyramid used by occlusion culling
+  depthAttachmentDescription.storeOp = continuation ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+  depthAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  depthAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachmentDescription.initialLayout =
+    continuation ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+  depthAttachmentDescription.finalLayout =
+    continuation ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+  VkAttachmentReference depthAttachmentReference;
+  depthAttachmentReference.attachment = 1u;
+  depthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  VkAttachmentDescription resolveAttachmentDescription{};
+  resolveAttachmentDescription.format = colorFormat;
+  resolveAttachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
+  resolveAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  resolveAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  resolveAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  resolveAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  resolveAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  resolveAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkAttachmentReference resolveAttachmentReference;
+  resolveAttachmentReference.attachment = 2u;
+  resolveAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  // [tdbe] Subpass 0 is the optional depth prepass, it only writes depth. When it is disabled the renderer just steps
+  // [tdbe] through it without drawing anything.
+  VkSubpassDescription depthPrepassSubpassDescription{};
+  depthPrepassSubpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  depthPrepassSubpassDescription.pDepthStencilAttachment = &depthAttachmentReference;
+
+  // [tdbe] Subpass 1 is the main pass
+  VkSubpassDescription mainSubpassDescription{};
+  mainSubpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  mainSubpassDescription.colorAttachmentCount = 1u;
+  mainSubpassDescription.pColorAttachments = &colorAttachmentReference;
+  mainSubpassDescription.pDepthStencilAttachment = &depthAttachmentReference;
+  mainSubpassDescription.pResolveAttachments = &resolveAttachmentReference;
+
+  const std::array subpassDescriptions = { depthPrepassSubpassDescription, mainSubpassDescription };
+
+  constexpr VkPipelineStageFlags depthStages =
+    VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  constexpr VkAccessFlags depthAccess =
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  constexpr VkAccessFlags colorAccess = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  std::array<VkSubpassDependency, 3u> subpassDependencies{};
+
+  // The depth prepass waits for the depth pyramid build (compute) that read the depth in between passes, and for
+  // earlier passes that wrote to the same attachments
+  subpassDependencies.at(0u).srcSubpass = VK_SUBPASS_EXTERNAL;
+  subpassDependencies.at(0u).dstSubpass = 0u;
+  subpassDependencies.at(0u).srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | depthStages;
+  subpassDependencies.at(0u).dstStageMask = depthStages;
+  subpassDependencies.at(0u).srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  subpassDependencies.at(0u).dstAccessMask = depthAccess;
+
+  // The main pass depth tests against (and may write to) the depth written by the prepass
+  subpassDependencies.at(1u).srcSubpass = 0u;
+  subpassDependencies.at(1u).dstSubpass = 1u;
+  subpassDependencies.at(1u).srcStageMask = depthStages;
+  subpassDependencies.at(1u).dstStageMask = depthStages;
+  subpassDependencies.at(1u).srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  subpassDependencies.at(1u).dstAccessMask = depthAccess;
+  subpassDependencies.at(1u).dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+  // Whatever comes after, the depth pyramid build (compute), a continuation pass, or the mirror view blit, waits for
+  // the depth and color writes of the main pass
+  subpassDependencies.at(2u).srcSubpass = 1u;
+  subpassDependencies.at(2u).dstSubpass = VK_SUBPASS_EXTERNAL;
+  subpassDependencies.at(2u).srcStageMask = depthStages | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  subpassDependencies.at(2u).dstStageMask =
+    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | depthStages | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  subpassDependencies.at(2u).srcAccessMask =
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  subpassDependencies.at(2u).dstAccessMask = VK_ACCESS_SHADER_READ_BIT | depthAccess | colorAccess;
+
+  const std::array attachments = { colorAttachmentDescription, depthAttachmentDescription,
+                                   resolveAttachmentDescription };
+
+  VkRenderPassCreateInfo renderPassCreateInfo{ VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
+  renderPassCreateInfo.pNext = &renderPassMultiviewCreateInfo;
+  renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+  renderPassCreateInfo.pAttachments = attachments.data();
+  renderPassCreateInfo.subpassCount = static_cast<uint32_t>(subpassDescriptions.size());
+  renderPassCreateInfo.pSubpasses = subpassDescriptions.data();
+  renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(subpassDependencies.size());
+  renderPassCreateInfo.pDependencies = subpassDependencies.data();
+  if (vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, &renderPass) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    return false;
+  }
+
+  return true;
+}
 } // namespace
 
 Headset::Headset(const Context* context) : context(context)
@@ -21,89 +163,12 @@ Headset::Headset(const Context* context) : context(context)
   const VkDevice device = context->getVkDevice();
   const VkSampleCountFlagBits multisampleCount = context->getMultisampleCount();
 
-  // Create a render pass
-  {
-    constexpr uint32_t viewMask = 0b00000011;
-    constexpr uint32_t correlationMask = 0b00000011;
-
-    // [tdbe] Single pass / multiview explanation:
-    // [tdbe] We feed this multiview create info into the regular vk render pass creation.
-    // [tdbe] Vulklan will execute the render pipeline twice (or whatever number is in pViewMasks)
-    // [tdbe] To use multiview, in the shader you enable the GL_EXT_multiview extension, and then
-    // [tdbe] get a glViewIndex depending on what multiview view you are about to output to. So you
-    // [tdbe] can use e.g. an array of transformation matrixes indexed by this.
-    VkRenderPassMultiviewCreateInfo renderPassMultiviewCreateInfo{
-      VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO
-    };
-    renderPassMultiviewCreateInfo.subpassCount = 1u;
-    renderPassMultiviewCreateInfo.pViewMasks = &viewMask;
-    renderPassMultiviewCreateInfo.correlationMaskCount = 1u;
-    renderPassMultiviewCreateInfo.pCorrelationMasks = &correlationMask;
-
-    VkAttachmentDescription colorAttachmentDescription{};
-    colorAttachmentDescription.format = colorFormat;
-    colorAttachmentDescription.samples = multisampleCount;
-    colorAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    colorAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    colorAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentReference colorAttachmentReference;
-    colorAttachmentReference.attachment = 0u;
-    colorAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentDescription depthAttachmentDescription{};
-    depthAttachmentDescription.format = depthFormat;
-    depthAttachmentDescription.samples = multisampleCount;
-    depthAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    depthAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    depthAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentReference depthAttachmentReference;
-    depthAttachmentReference.attachment = 1u;
-    depthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentDescription resolveAttachmentDescription{};
-    resolveAttachmentDescription.format = colorFormat;
-    resolveAttachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
-    resolveAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    resolveAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    resolveAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    resolveAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    resolveAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    resolveAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentReference resolveAttachmentReference;
-    resolveAttachmentReference.attachment = 2u;
-    resolveAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkSubpassDescription subpassDescription{};
-    subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpassDescription.colorAttachmentCount = 1u;
-    subpassDescription.pColorAttachments = &colorAttachmentReference;
-    subpassDescription.pDepthStencilAttachment = &depthAttachmentReference;
-    subpassDescription.pResolveAttachments = &resolveAttachmentReference;
-
-    const std::array attachments = { colorAttachmentDescription, depthAttachmentDescription,
-                                     resolveAttachmentDescription };
-
-    VkRenderPassCreateInfo renderPassCreateInfo{ VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
-    renderPassCreateInfo.pNext = &renderPassMultiviewCreateInfo;
-    renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-    renderPassCreateInfo.pAttachments = attachments.data();
-    renderPassCreateInfo.subpassCount = 1u;
-    renderPassCreateInfo.pSubpasses = &subpassDescription;
-    if (vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, &renderPass) != VK_SUCCESS)
-    {
-      util::error(Error::GenericVulkan);
-      valid = false;
-      return;
-    }
+  // Create the render passes
+  if (!createRenderPass(device, multisampleCount, false, renderPass) ||
+      !createRenderPass(device, multisampleCount, true, continuationRenderPass))
+  {
+    valid = false;
+    return;
   }
 
   const XrInstance xrInstance = context->getXrInstance();
@@ -176,12 +241,13 @@ Headset::Headset(const Context* context) : context(context)
   }
 
   // Allocate the eye poses
-  eyePoses.resize(eyeCount);
-  for (XrView& eyePose : eyePoses)
+  currentFrame.eyePoses.resize(eyeCount);
+  for (XrView& eyePose : currentFrame.eyePoses)
   {
     eyePose.type = XR_TYPE_VIEW;
     eyePose.next = nullptr;
   }
+  lateEyePoses = currentFrame.eyePoses;
 
   // Verify that the desired color format is supported
   {
@@ -225,7 +291,7 @@ Headset::Headset(const Context* context) : context(context)
 
   // Create a color buffer
   colorBuffer = new ImageBuffer(context, eyeResolution, colorFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-                                context->getMultisampleCount(), VK_IMAGE_ASPECT_COLOR_BIT, 2u);
+                                context->getMultisampleCount(), VK_IMAGE_ASPECT_COLOR_BIT, 2u, 1u);
   if (!colorBuffer->isValid())
   {
     valid = false;
@@ -235,8 +301,10 @@ Headset::Headset(const Context* context) : context(context)
   // Create a depth buffer
   // [tdbe] Note: the depth buffer is not necessary. I guess it's used for passthrough or other xr depth effects,
   // [tdbe] but it's not required for rendering geometry to the headset color buffer. (It's not "the" depth buffer.)
-  depthBuffer = new ImageBuffer(context, eyeResolution, depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-                                context->getMultisampleCount(), VK_IMAGE_ASPECT_DEPTH_BIT, 2u);
+  // [tdbe] It is also sampled to build the depth pyramid for occlusion culling.
+  depthBuffer = new ImageBuffer(context, eyeResolution, depthFormat,
+                                VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                                context->getMultisampleCount(), VK_IMAGE_ASPECT_DEPTH_BIT, 2u, 1u);
   if (!depthBuffer->isValid())
   {
     valid = false;
@@ -380,13 +448,18 @@ Headset::~Headset()
   }
 
   const VkDevice vkDevice = context->getVkDevice();
+  if (vkDevice && continuationRenderPass)
+  {
+    vkDestroyRenderPass(vkDevice, continuationRenderPass, nullptr);
+  }
+
   if (vkDevice && renderPass)
   {
     vkDestroyRenderPass(vkDevice, renderPass, nullptr);
   }
 }
 
-Headset::BeginFrameResult Headset::beginFrame(uint32_t& swapchainImageIndex) 
+Headset::FrameResult Headset::waitFrame(Frame& frame)
 {
   const XrInstance instance = context->getXrInstance();
 
@@ -398,7 +471,7 @@ Headset::BeginFrameResult Headset::beginFrame(uint32_t& swapchainImageIndex)
     {
     case XR_TYPE_EVENT_DATA_INSTANCE_LOSS_PENDING:
       exitRequested = true;
-      return BeginFrameResult::SkipFully;
+      return FrameResult::SkipFully;
     case XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED:
     {
       XrEventDataSessionStateChanged* event = reinterpret_cast<XrEventDataSessionStateChanged*>(&buffer);
@@ -408,20 +481,18 @@ Headset::BeginFrameResult Headset::beginFrame(uint32_t& swapchainImageIndex)
       {
         if (!beginSession())
         {
-          return BeginFrameResult::Error;
+          return FrameResult::Error;
         }
       }
       else if (event->state == XR_SESSION_STATE_STOPPING)
       {
-        if (!endSession())
-        {
-          return BeginFrameResult::Error;
-        }
+        // The session may only end once the frame the render thread might still be working on has ended
+        return FrameResult::SessionStopping;
       }
       else if (event->state == XR_SESSION_STATE_LOSS_PENDING || event->state == XR_SESSION_STATE_EXITING)
       {
         exitRequested = true;
-        return BeginFrameResult::SkipFully;
+        return FrameResult::SkipFully;
       }
 
       break;
@@ -436,78 +507,69 @@ Headset::BeginFrameResult Headset::beginFrame(uint32_t& swapchainImageIndex)
   {
     // If we are not ready, synchronized, visible or focused, we skip all processing of this frame
     // This means no waiting, no beginning or ending of the frame at all
-    return BeginFrameResult::SkipFully;
+    return FrameResult::SkipFully;
   }
 
   // Wait for the new frame
-  frameState.type = XR_TYPE_FRAME_STATE;
+  frame.frameState.type = XR_TYPE_FRAME_STATE;
   XrFrameWaitInfo frameWaitInfo{ XR_TYPE_FRAME_WAIT_INFO };
-  XrResult result = xrWaitFrame(session, &frameWaitInfo, &frameState);
+  const XrResult result = xrWaitFrame(session, &frameWaitInfo, &frame.frameState);
   if (XR_FAILED(result))
   {
     util::error(Error::GenericOpenXR);
-    return BeginFrameResult::Error;
+    return FrameResult::Error;
   }
 
-  // Begin the new frame
-  XrFrameBeginInfo frameBeginInfo{ XR_TYPE_FRAME_BEGIN_INFO };
-  result = xrBeginFrame(session, &frameBeginInfo);
-  if (XR_FAILED(result))
+  if (!frame.frameState.shouldRender)
   {
-    util::error(Error::GenericOpenXR);
-    return BeginFrameResult::Error;
+    // Let the host know that we don't want to render this frame
+    // We do still need to begin and end the frame however
+    return FrameResult::SkipRender;
   }
 
-  if (!frameState.shouldRender)
+  // Locate the eyes for the simulation of the frame, the render thread picks the poses up in beginFrame()
+  if (frame.eyePoses.size() != eyeCount)
   {
-    // Let the host know that we don't want to render this frame
-    // We do still need to end the frame however
-    return BeginFrameResult::SkipRender;
+    frame.eyePoses.resize(eyeCount, XrView{ XR_TYPE_VIEW });
   }
 
-  // Update the eye poses
-  viewState.type = XR_TYPE_VIEW_STATE;
-  uint32_t viewCount;
-  XrViewLocateInfo viewLocateInfo{ XR_TYPE_VIEW_LOCATE_INFO };
-  viewLocateInfo.viewConfigurationType = context->getXrViewType();
-  viewLocateInfo.displayTime = frameState.predictedDisplayTime;
-  viewLocateInfo.space = space;
-  result = xrLocateViews(session, &viewLocateInfo, &viewState, static_cast<uint32_t>(eyePoses.size()), &viewCount,
-                         eyePoses.data());
-  if (XR_FAILED(result))
+  if (!locateEyes(frame.frameState.predictedDisplayTime, frame.viewState, frame.eyePoses))
   {
     util::error(Error::GenericOpenXR);
-    return BeginFrameResult::Error;
+    return FrameResult::Error;
   }
 
-  if (viewCount != eyeCount)
+  return FrameResult::RenderFully; // Request full rendering of the frame
+}
+
+bool Headset::beginFrame(const Frame& frame, uint32_t& swapchainImageIndex)
+{
+  currentFrame = frame;
+
+  // Begin the new frame
+  XrFrameBeginInfo frameBeginInfo{ XR_TYPE_FRAME_BEGIN_INFO };
+  XrResult result = xrBeginFrame(session, &frameBeginInfo);
+  if (XR_FAILED(result))
   {
     util::error(Error::GenericOpenXR);
-    return BeginFrameResult::Error;
+    return false;
   }
 
-  // Update the eye render infos, view and projection matrices
-  for (size_t eyeIndex = 0u; eyeIndex < eyeCount; ++eyeIndex)
+  if (!currentFrame.frameState.shouldRender)
   {
-    // Copy the eye poses into the eye render infos
-    XrCompositionLayerProjectionView& eyeRenderInfo = eyeRenderInfos.at(eyeIndex);
-    const XrView& eyePose = eyePoses.at(eyeIndex);
-    eyeRenderInfo.pose = eyePose.pose;
-    eyeRenderInfo.fov = eyePose.fov;
-
-    // Update the view and projection matrices
-    const XrPosef& pose = eyeRenderInfo.pose;
-    eyeViewMatrices.at(eyeIndex) = glm::inverse(util::poseToMatrix(pose));
-    eyeProjectionMatrices.at(eyeIndex) = util::createProjectionMatrix(eyeRenderInfo.fov, 0.01f, 250.0f);
+    return true;
   }
 
+  // Update the eye render infos and matrices from the poses the frame was simulated with
+  applyEyePoses();
+
   // Acquire the swapchain image
   XrSwapchainImageAcquireInfo swapchainImageAcquireInfo{ XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO };
   result = xrAcquireSwapchainImage(swapchain, &swapchainImageAcquireInfo, &swapchainImageIndex);
   if (XR_FAILED(result))
   {
     util::error(Error::GenericOpenXR);
-    return BeginFrameResult::Error;
+    return false;
   }
 
   // Wait for the swapchain image
@@ -517,20 +579,50 @@ Headset::BeginFrameResult Headset::beginFrame(uint32_t& swapchainImageIndex)
   if (XR_FAILED(result))
   {
     util::error(Error::GenericOpenXR);
-    return BeginFrameResult::Error;
+    return false;
   }
 
-  return BeginFrameResult::RenderFully; // Request full rendering of the frame
+  return true;
+}
+
+bool Headset::lateLatchEyePoses()
+{
+  // Locate the eyes again for the same display time, closer to it the prediction is more accurate. The poses from
+  // beginFrame() stay in use if the new ones can't be located or aren't fully tracked.
+  XrViewState lateViewState{ XR_TYPE_VIEW_STATE };
+  if (!locateEyes(currentFrame.frameState.predictedDisplayTime, lateViewState, lateEyePoses))
+  {
+    return false;
+  }
+
+  const bool positionValid = lateViewState.viewStateFlags & XR_VIEW_STATE_POSITION_VALID_BIT;
+  const bool orientationValid = lateViewState.viewStateFlags & XR_VIEW_STATE_ORIENTATION_VALID_BIT;
+  if (!positionValid || !orientationValid)
+  {
+    return false;
+  }
+
+  currentFrame.viewState = lateViewState;
+  currentFrame.eyePoses.swap(lateEyePoses);
+  applyEyePoses();
+  return true;
 }
 
 void Headset::endFrame() const
 {
-  // Release the swapchain image
-  XrSwapchainImageReleaseInfo swapchainImageReleaseInfo{ XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO };
-  XrResult result = xrReleaseSwapchainImage(swapchain, &swapchainImageReleaseInfo);
-  if (XR_FAILED(result))
+  const XrFrameState& frameState = currentFrame.frameState;
+  const XrViewState& viewState = currentFrame.viewState;
+  XrResult result;
+
+  // Release the swapchain image, only acquired for frames that got rendered
+  if (frameState.shouldRender)
   {
-    return;
+    XrSwapchainImageReleaseInfo swapchainImageReleaseInfo{ XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO };
+    result = xrReleaseSwapchainImage(swapchain, &swapchainImageReleaseInfo);
+    if (XR_FAILED(result))
+    {
+      return;
+    }
   }
 
   // End the frame
@@ -560,6 +652,42 @@ void Headset::endFrame() const
   }
 }
 
+bool Headset::locateEyes(XrTime displayTime, XrViewState& eyeViewState, std::vector<XrView>& poses) const
+{
+  eyeViewState.type = XR_TYPE_VIEW_STATE;
+  uint32_t viewCount;
+  XrViewLocateInfo viewLocateInfo{ XR_TYPE_VIEW_LOCATE_INFO };
+  viewLocateInfo.viewConfigurationType = context->getXrViewType();
+  viewLocateInfo.displayTime = displayTime;
+  viewLocateInfo.space = space;
+  const XrResult result = xrLocateViews(session, &viewLocateInfo, &eyeViewState, static_cast<uint32_t>(poses.size()),
+                                        &viewCount, poses.data());
+  if (XR_FAILED(result))
+  {
+    return false;
+  }
+
+  return viewCount == eyeCount;
+}
+
+void Headset::applyEyePoses()
+{
+  // Update the eye render infos, view and projection matrices
+  for (size_t eyeIndex = 0u; eyeIndex < eyeCount; ++eyeIndex)
+  {
+    // Copy the eye poses into the eye render infos
+    XrCompositionLayerProjectionView& eyeRenderInfo = eyeRenderInfos.at(eyeIndex);
+    const XrView& eyePose = currentFrame.eyePoses.at(eyeIndex);
+    eyeRenderInfo.pose = eyePose.pose;
+    eyeRenderInfo.fov = eyePose.fov;
+
+    // Update the view and projection matrices
+    const XrPosef& pose = eyeRenderInfo.pose;
+    eyeViewMatrices.at(eyeIndex) = glm::inverse(util::poseToMatrix(pose));
+    eyeProjectionMatrices.at(eyeIndex) = util::createProjectionMatrix(eyeRenderInfo.fov, 0.01f, 250.0f);
+  }
+}
+
 bool Headset::isValid() const
 {
   return valid;
@@ -582,7 +710,7 @@ XrSpace Headset::getXrSpace() const
 
 XrFrameState Headset::getXrFrameState() const
 {
-  return frameState;
+  return currentFrame.frameState;
 }
 
 VkRenderPass Headset::getVkRenderPass() const
@@ -590,6 +718,16 @@ VkRenderPass Headset::getVkRenderPass() const
   return renderPass;
 }
 
+VkRenderPass Headset::getVkContinuationRenderPass() const
+{
+  return continuationRenderPass;
+}
+
+const ImageBuffer* Headset::getDepthBuffer() const
+{
+  return depthBuffer;
+}
+
 size_t Headset::getEyeCount() const
 {
   return eyeCount;
@@ -601,6 +739,32 @@ VkExtent2D Headset::getEyeResolution(size_t eyeIndex) const
   return { eyeInfo.recommendedImageRectWidth, eyeInfo.recommendedImageRectHeight };
 }
 
+void Headset::setRenderScale(float scale)
+{
+  renderScale = std::clamp(scale, 0.0f, 1.0f);
+
+  // Tell the compositor which part of the eye images holds the frame
+  for (size_t eyeIndex = 0u; eyeIndex < eyeRenderInfos.size(); ++eyeIndex)
+  {
+    const VkExtent2D renderResolution = getRenderResolution(eyeIndex);
+    eyeRenderInfos.at(eyeIndex).subImage.imageRect.extent = { static_cast<int32_t>(renderResolution.width),
+                                                              static_cast<int32_t>(renderResolution.height) };
+  }
+}
+
+float Headset::getRenderScale() const
+{
+  return renderScale;
+}
+
+VkExtent2D Headset::getRenderResolution(size_t eyeIndex) const
+{
+  const VkExtent2D eyeResolution = getEyeResolution(eyeIndex);
+  const uint32_t width = static_cast<uint32_t>(std::lround(static_cast<float>(eyeResolution.width) * renderScale));
+  const uint32_t height = static_cast<uint32_t>(std::lround(static_cast<float>(eyeResolution.height) * renderScale));
+  return { std::clamp(width, 1u, eyeResolution.width), std::clamp(height, 1u, eyeResolution.height) };
+}
+
 glm::mat4 Headset::getEyeViewMatrix(size_t eyeIndex) const
 {
   return eyeViewMatrices.at(eyeIndex);
@@ -613,7 +777,7 @@ glm::mat4 Headset::getEyeProjectionMatrix(size_t eyeIndex) const
 
 std::vector<XrView> Headset::getEyePoses() const
 {
-  return eyePoses;
+  return currentFrame.eyePoses;
 }
 
 XrSessionState Headset::getSessionState() const
@@ -24,27 +24,61 @@ public:
   Headset(const Context* context);
   ~Headset();
 
-  enum class BeginFrameResult
+  // [tdbe] a frame goes through two threads. The simulation thread waits for it with waitFrame(), which also locates
+  // the eyes for the game mechanics, then hands it to the render thread. That one begins it with beginFrame(), renders
+  // it and ends it with endFrame(), while the simulation thread already waits for the next frame.
+  struct Frame
   {
-    Error,       // An error occurred
-    RenderFully, // Render this frame normally
-    SkipRender,  // Skip rendering the frame but end it
-    SkipFully    // Skip processing this frame entirely without ending it
+    XrFrameState frameState{ XR_TYPE_FRAME_STATE };
+    XrViewState viewState{ XR_TYPE_VIEW_STATE };
+    std::vector<XrView> eyePoses; // Only located if the frame should be rendered
   };
-  BeginFrameResult beginFrame(uint32_t& swapchainImageIndex);
+
+  enum class FrameResult
+  {
+    Error,           // An error occurred
+    RenderFully,     // Render this frame normally
+    SkipRender,      // Skip rendering the frame but begin and end it
+    SkipFully,       // Skip processing this frame entirely without beginning or ending it
+    SessionStopping  // Skip this frame, call endSession() once no frame is in progress anymore
+  };
+  // Polls the OpenXR events and waits for the next frame (simulation thread)
+  FrameResult waitFrame(Frame& frame);
+  // Begins a frame that waitFrame() returned RenderFully or SkipRender for, and acquires a swapchain image if it should
+  // be rendered (render thread). Returns false on error.
+  bool beginFrame(const Frame& frame, uint32_t& swapchainImageIndex);
+  // [tdbe] late latching: locates the eyes again for the display time of the current frame, right before the frame is
+  // submitted, and updates the eye poses and matrices. endFrame() hands the same poses to the compositor, so that what
+  // was rendered and what gets reprojected match. Returns false (keeping the poses of beginFrame()) if the eyes can't
+  // be located or aren't tracked.
+  bool lateLatchEyePoses();
   void endFrame() const;
+  bool endSession() const;
 
   bool isValid() const;
   bool isExitRequested() const;
 
   XrSession getXrSession() const;
   XrSpace getXrSpace() const;
+  // The frame state and eye poses of the frame the render thread is working on
   XrFrameState getXrFrameState() const;
 
   VkRenderPass getVkRenderPass() const;
+  // Compatible with the render pass, but loads the color and depth instead of clearing them
+  VkRenderPass getVkContinuationRenderPass() const;
+  // Multisampled, two layers (one per eye), left in depth read-only layout by the render pass
+  const ImageBuffer* getDepthBuffer() const;
 
   size_t getEyeCount() const;
   VkExtent2D getEyeResolution(size_t eyeIndex) const;
+
+  // [tdbe] dynamic resolution: only a scaled rectangle (from the top left corner) of the eye images gets rendered to,
+  // and OpenXR is told about it so the compositor upscales it. Set it before rendering a frame, it applies to the whole
+  // frame up until endFrame(). The scale is clamped to (0, 1].
+  void setRenderScale(float scale);
+  float getRenderScale() const;
+  // The eye resolution multiplied by the render scale
+  VkExtent2D getRenderResolution(size_t eyeIndex) const;
   glm::mat4 getEyeViewMatrix(size_t eyeIndex) const;
   glm::mat4 getEyeProjectionMatrix(size_t eyeIndex) const;
   std::vector<XrView> getEyePoses() const;
@@ -66,20 +100,24 @@ private:
   XrSession session = nullptr;
   XrSessionState sessionState = XR_SESSION_STATE_UNKNOWN;
   XrSpace space = nullptr;
-  XrFrameState frameState = {};
-  XrViewState viewState = {};
+  Frame currentFrame; // The frame between beginFrame() and endFrame()
 
   std::vector<XrViewConfigurationView> eyeImageInfos;
-  std::vector<XrView> eyePoses;
+  std::vector<XrView> lateEyePoses; // Located into by lateLatchEyePoses(), swapped with the eye poses when valid
   std::vector<XrCompositionLayerProjectionView> eyeRenderInfos;
+  float renderScale = 1.0f;
 
   XrSwapchain swapchain = nullptr;
   std::vector<RenderTarget*> swapchainRenderTargets;
 
-  VkRenderPass renderPass = nullptr;
+  VkRenderPass renderPass = nullptr, continuationRenderPass = nullptr;
 
   ImageBuffer *colorBuffer = nullptr, *depthBuffer = nullptr;
 
   bool beginSession() const;
-  bool endSession() const;
+
+  // Locates the eyes at the given display time, returns false on error
+  bool locateEyes(XrTime displayTime, XrViewState& eyeViewState, std::vector<XrView>& poses) const;
+  // Updates the eye render infos, view and projection matrices from the eye poses
+  void applyEyePoses();
 };
\ No newline at end of file
@@ -7,10 +7,11 @@
 ImageBuffer::ImageBuffer(const Context* context,
                          VkExtent2D size,
                          VkFormat format,
-                         VkImageUsageFlagBits usage,
+                         VkImageUsageFlags usage,
                          VkSampleCountFlagBits samples,
                          VkImageAspectFlags aspect,
-                         size_t layerCount)
+                         size_t layerCount,
+                         size_t mipLevelCount)
 : context(context)
 {
   const VkDevice device = context->getVkDevice();
@@ -21,7 +22,7 @@ ImageBuffer::ImageBuffer(const Context* context,
   imageCreateInfo.extent.width = size.width;
   imageCreateInfo.extent.height = size.height;
   imageCreateInfo.extent.depth = 1u;
-  imageCreateInfo.mipLevels = 1u;
+  imageCreateInfo.mipLevels = static_cast<uint32_t>(mipLevelCount);
   imageCreateInfo.arrayLayers = static_cast<uint32_t>(layerCount);
   imageCreateInfo.format = format;
   imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
@@ -81,7 +82,7 @@ ImageBuffer::ImageBuffer(const Context* context,
   imageViewCreateInfo.subresourceRange.aspectMask = aspect;
   imageViewCreateInfo.subresourceRange.baseArrayLayer = 0u;
   imageViewCreateInfo.subresourceRange.baseMipLevel = 0u;
-  imageViewCreateInfo.subresourceRange.levelCount = 1u;
+  imageViewCreateInfo.subresourceRange.levelCount = static_cast<uint32_t>(mipLevelCount);
   if (vkCreateImageView(device, &imageViewCreateInfo, nullptr, &imageView) != VK_SUCCESS)
   {
     util::error(Error::GenericVulkan);
@@ -117,6 +118,11 @@ bool ImageBuffer::isValid() const
   return valid;
 }
 
+VkImage ImageBuffer::getImage() const
+{
+  return image;
+}
+
 VkImageView ImageBuffer::getImageView() const
 {
   return imageView;
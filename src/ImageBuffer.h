@@ -5,6 +5,7 @@
 /*
  * The image buffer class represents a convienent combination of an image, its associated memory, and a corresponding
  * image view in Vulkan. The class is used to bundle all required resources for the color and depth buffer respectively.
+ * The image view covers all layers and mip levels.
  */
 class ImageBuffer final
 {
@@ -12,14 +13,16 @@ public:
   ImageBuffer(const Context* context,
               VkExtent2D size,
               VkFormat format,
-              VkImageUsageFlagBits usage,
+              VkImageUsageFlags usage,
               VkSampleCountFlagBits samples,
               VkImageAspectFlags aspect,
-              size_t layerCount);
+              size_t layerCount,
+              size_t mipLevelCount);
   ~ImageBuffer();
 
   bool isValid() const;
 
+  VkImage getImage() const;
   VkImageView getImageView() const;
 
 private:
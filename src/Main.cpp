@@ -1,5 +1,7 @@
 #pragma once
 #include "Context.h"
+#include "CpuProfiler.h"
+#include "DynamicResolution.h"
 #include "Input.h"
 #include "InputData.h"
 #include "Headset.h"
@@ -7,6 +9,7 @@
 #include "MirrorView.h"
 #include "GameData.h"
 #include "Renderer.h"
+#include "RenderThread.h"
 #include "gameMechanics/GameBehaviour.h"
 #include "gameMechanics/HandsBehaviour.h"
 #include "gameMechanics/InputTesterBehaviour.h"
@@ -20,10 +23,72 @@
 namespace
 {
 constexpr float flySpeedMultiplier = 2.5f;
+
+// [tdbe] 1 to 3, fewer frames in flight lower the latency, more keep the GPU busier
+constexpr size_t framesInFlightCount = 2u;
+
+// [tdbe] dynamic resolution lowers the render scale (down to the minimum) when the GPU can't keep up with the headset
+constexpr bool dynamicResolutionEnabled = true;
+constexpr float minRenderScale = 0.6f;
+constexpr float maxRenderScale = 1.0f;
+
+// [tdbe] late latching locates the eyes again right before submitting the frame, so the view projection matrices are
+// as fresh as possible, see Headset::lateLatchEyePoses()
+constexpr bool lateLatchingEnabled = true;
+
+// [tdbe] records zones of the main loop phases, press F9 in the mirror view window to write them to trace.json
+constexpr bool cpuProfilerEnabled = true;
+
+#ifdef DEBUG
+// Seconds between logs of the GPU timers
+constexpr float gpuTimingLogInterval = 5.0f;
+#endif
+
+// [tdbe] the cars get a generated checker texture, in texels
+constexpr uint32_t checkerTextureSize = 64u;
+constexpr uint32_t checkerSize = 8u;
+
+// RGBA8 pixel data of a checker pattern and all of its mip levels, each one the 2x2 average of the one before
+std::vector<std::vector<uint8_t>> createCheckerTexture()
+{
+  std::vector<std::vector<uint8_t>> mipLevels(1u);
+  std::vector<uint8_t>& pixels = mipLevels.front();
+  for (uint32_t y = 0u; y < checkerTextureSize; ++y)
+  {
+    for (uint32_t x = 0u; x < checkerTextureSize; ++x)
+    {
+      const uint8_t value = ((x / checkerSize + y / checkerSize) % 2u == 0u) ? 255u : 96u;
+      pixels.insert(pixels.end(), { value, value, value, 255u });
+    }
+  }
+
+  for (uint32_t mipSize = checkerTextureSize / 2u; mipSize > 0u; mipSize /= 2u)
+  {
+    const std::vector<uint8_t> previousLevel = mipLevels.back();
+    std::vector<uint8_t>& mipLevel = mipLevels.emplace_back(mipSize * mipSize * 4u);
+    for (uint32_t texel = 0u; texel < mipSize * mipSize; ++texel)
+    {
+      const uint32_t x = (texel % mipSize) * 2u, y = (texel / mipSize) * 2u;
+      for (uint32_t channel = 0u; channel < 4u; ++channel)
+      {
+        const auto previousTexel = [&](uint32_t dx, uint32_t dy)
+        { return previousLevel.at(((y + dy) * mipSize * 2u + x + dx) * 4u + channel); };
+        mipLevel.at(texel * 4u + channel) =
+          static_cast<uint8_t>((previousTexel(0u, 0u) + previousTexel(1u, 0u) + previousTexel(0u, 1u) +
+                                previousTexel(1u, 1u)) / 4u);
+      }
+    }
+  }
+
+  return mipLevels;
+}
 }
 
 int main()
 {
+  profiler::setEnabled(cpuProfilerEnabled);
+  profiler::setThreadName("Simulation");
+
   glm::mat4 cameraMatrix = glm::mat4(1.0f); // Transform from world to stage space
 
   Context context;
@@ -61,48 +126,56 @@ int main()
   std::vector<Model*> models = { &gridModel, &ruinsModel,    &carModelLeft,   &carModelRight, &beetleModel,
                                  &bikeModel, &handModelLeft, &handModelRight, &logoModel };
   
-  Material gridMaterial, diffuseMaterial, bikeMaterial, logoMaterial, locomotionMaterial, skyMaterial = {};
+  Material gridMaterial, diffuseMaterial, carMaterial, beetleMaterial, bikeMaterial, logoMaterial, locomotionMaterial,
+    skyMaterial = {};
   // [tdbe] init any non-default material props here.
   gridMaterial.vertShaderName = "shaders/Grid.vert.spv";
   gridMaterial.fragShaderName = "shaders/Grid.frag.spv";
-  gridMaterial.dynamicUniformData.colorMultiplier = glm::vec4(1.0f);
+  gridMaterial.setDynamicUniformData({ glm::vec4(1.0f) });
   diffuseMaterial.vertShaderName = "shaders/Diffuse.vert.spv";
   diffuseMaterial.fragShaderName = "shaders/Diffuse.frag.spv";
-  diffuseMaterial.dynamicUniformData.colorMultiplier = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
-  bikeMaterial.vertShaderName = "shaders/DiffuseTransparent.vert.spv";
-  bikeMaterial.fragShaderName = "shaders/DiffuseTransparent.frag.spv";
+  diffuseMaterial.setDynamicUniformData({ glm::vec4(1.0f, 1.0f, 1.0f, 1.0f) });
+  carMaterial.vertShaderName = "shaders/Diffuse.vert.spv";
+  carMaterial.fragShaderName = "shaders/Diffuse.frag.spv";
+  beetleMaterial.vertShaderName = "shaders/Diffuse.vert.spv";
+  beetleMaterial.fragShaderName = "shaders/Diffuse.frag.spv";
+  bikeMaterial.vertShaderName = "shaders/Diffuse.vert.spv";
+  bikeMaterial.fragShaderName = "shaders/Diffuse.frag.spv";
+  bikeMaterial.pipelineData.specialization.alphaOutput = VK_TRUE;
   //bikeMaterial.pipelineData.srcColorBlendFactor = VkBlendFactor::VK_BLEND_FACTOR_ONE;
   //bikeMaterial.pipelineData.dstColorBlendFactor = VkBlendFactor::VK_BLEND_FACTOR_ONE;
   bikeMaterial.pipelineData.cullMode = VkCullModeFlagBits::VK_CULL_MODE_NONE;
-  bikeMaterial.dynamicUniformData.colorMultiplier = glm::vec4(1.0f, 0.0f, 0.1f, 0.66f);
+  bikeMaterial.renderQueue = RenderQueue::Transparent;
+  bikeMaterial.setDynamicUniformData({ glm::vec4(1.0f, 0.0f, 0.1f, 0.66f) });
   logoMaterial.vertShaderName = "shaders/Diffuse.vert.spv";
   logoMaterial.fragShaderName = "shaders/Diffuse.frag.spv";
-  logoMaterial.dynamicUniformData.colorMultiplier = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+  logoMaterial.setDynamicUniformData({ glm::vec4(1.0f, 1.0f, 1.0f, 1.0f) });
   logoMaterial.pipelineData.cullMode = VkCullModeFlagBits::VK_CULL_MODE_NONE;
-  std::vector<Material*> materials = { &gridMaterial, &diffuseMaterial, &bikeMaterial, &logoMaterial, &locomotionMaterial, &skyMaterial};
+  std::vector<Material*> materials = { &gridMaterial, &diffuseMaterial, &carMaterial,        &beetleMaterial,
+                                       &bikeMaterial, &logoMaterial,    &locomotionMaterial, &skyMaterial };
   
   GameObject head = GameObject();
-  head.worldMatrix = glm::inverse(cameraMatrix);
+  head.setWorldMatrix(glm::inverse(cameraMatrix));
   GameObject handLeft = GameObject(&handModelLeft, &logoMaterial, true, "handLeft");
   GameObject handRight = GameObject(&handModelRight, &logoMaterial, true, "handRight");
   GameObject grid = GameObject(&gridModel, &gridMaterial, true, "grid");
   GameObject ruins = GameObject(&ruinsModel, &diffuseMaterial, true, "ruins");
-  GameObject carLeft = GameObject(&carModelLeft, &diffuseMaterial, true, "carLeft");
-  GameObject carRight = GameObject(&carModelRight, &diffuseMaterial, true, "handRight");
-  GameObject beetle = GameObject(&beetleModel, &diffuseMaterial, true, "beetle");
+  GameObject carLeft = GameObject(&carModelLeft, &carMaterial, true, "carLeft");
+  GameObject carRight = GameObject(&carModelRight, &carMaterial, true, "handRight");
+  GameObject beetle = GameObject(&beetleModel, &beetleMaterial, true, "beetle");
   GameObject bike = GameObject(&bikeModel, &bikeMaterial, true, "bike");
   GameObject logo = GameObject(&logoModel, &logoMaterial, true, "logo");
   std::vector<GameObject*> gameObjects = { &grid, &ruins, &carLeft, &carRight, &beetle, &bike, &handLeft, &handRight, &logo };
   PlayerObject playerObject = PlayerObject("XR Player 1", &head, &handLeft, &handRight);
 
-  carLeft.worldMatrix =
-    glm::rotate(glm::translate(glm::mat4(1.0f), { -3.5f, 0.0f, -7.0f }), glm::radians(75.0f), { 0.0f, 1.0f, 0.0f });
-  carRight.worldMatrix =
-    glm::rotate(glm::translate(glm::mat4(1.0f), { 8.0f, 0.0f, -15.0f }), glm::radians(-15.0f), { 0.0f, 1.0f, 0.0f });
-  beetle.worldMatrix =
-    glm::rotate(glm::translate(glm::mat4(1.0f), { -3.5f, 0.0f, -0.5f }), glm::radians(-125.0f), { 0.0f, 1.0f, 0.0f });
-  logo.worldMatrix = glm::translate(glm::mat4(1.0f), { 0.0f, 3.0f, -10.0f });
-  bike.worldMatrix = glm::rotate(glm::translate(glm::mat4(1.0f), { 0.5f, 0.0f, -4.5f }), 0.2f, { 0.0f, 1.0f, 0.0f });
+  carLeft.setWorldMatrix(
+    glm::rotate(glm::translate(glm::mat4(1.0f), { -3.5f, 0.0f, -7.0f }), glm::radians(75.0f), { 0.0f, 1.0f, 0.0f }));
+  carRight.setWorldMatrix(
+    glm::rotate(glm::translate(glm::mat4(1.0f), { 8.0f, 0.0f, -15.0f }), glm::radians(-15.0f), { 0.0f, 1.0f, 0.0f }));
+  beetle.setWorldMatrix(
+    glm::rotate(glm::translate(glm::mat4(1.0f), { -3.5f, 0.0f, -0.5f }), glm::radians(-125.0f), { 0.0f, 1.0f, 0.0f }));
+  logo.setWorldMatrix(glm::translate(glm::mat4(1.0f), { 0.0f, 3.0f, -10.0f }));
+  bike.setWorldMatrix(glm::rotate(glm::translate(glm::mat4(1.0f), { 0.5f, 0.0f, -4.5f }), 0.2f, { 0.0f, 1.0f, 0.0f }));
 
   MeshData* meshData = new MeshData;
   if (!meshData->loadModel("models/Grid.obj", MeshData::Color::FromNormals, models, 0u, 1u)) {
@@ -133,7 +206,7 @@ int main()
     return EXIT_FAILURE;
   }
 
-  Renderer renderer(&context, &headset, meshData, materials, gameObjects);
+  Renderer renderer(&context, &headset, meshData, materials, gameObjects, framesInFlightCount);
   if (!renderer.isValid())
   {
     return EXIT_FAILURE;
@@ -141,6 +214,15 @@ int main()
 
   delete meshData;
 
+  // [tdbe] materials refer to textures by their index in the texture array, see Renderer::addTexture()
+  DynamicMaterialUniformData carMaterialData = carMaterial.getDynamicUniformData();
+  carMaterialData.baseColorTexture =
+    renderer.addTexture({ checkerTextureSize, checkerTextureSize }, VK_FORMAT_R8G8B8A8_UNORM, createCheckerTexture());
+  carMaterial.setDynamicUniformData(carMaterialData);
+  DynamicMaterialUniformData beetleMaterialData = beetleMaterial.getDynamicUniformData();
+  beetleMaterialData.baseColorTexture = renderer.addTexture("textures/Tiles.ktx2");
+  beetleMaterial.setDynamicUniformData(beetleMaterialData);
+
   if (!mirrorView.connect(&headset, &renderer))
   {
     return EXIT_FAILURE;
@@ -155,35 +237,147 @@ int main()
     new WorldObjectsMiscBehaviour(bike, logoMaterial)
   };
     
+  DynamicResolution dynamicResolution(minRenderScale, maxRenderScale);
+
+  // [tdbe] the render thread begins, renders and ends frame N while the main thread simulates frame N+1. It only sees
+  // the scene through the snapshot in the frame data, see RenderThread.h.
+  RenderThread renderThread([&](const RenderThread::FrameData& frame) {
+    profiler::Zone frameZone("Render frame");
+
+    uint32_t swapchainImageIndex;
+    profiler::Zone beginFrameZone("Headset::beginFrame");
+    if (!headset.beginFrame(frame.headsetFrame, swapchainImageIndex))
+    {
+      return false;
+    }
+    beginFrameZone.end();
+
+    if (frame.render)
+    {
+      // Pick the render scale for this frame from the GPU time of an earlier one
+      float gpuFrameTime;
+      if (dynamicResolutionEnabled && renderer.getGpuFrameTime(gpuFrameTime))
+      {
+        const float frameBudget = static_cast<float>(headset.getXrFrameState().predictedDisplayPeriod) / 1e6f;
+        headset.setRenderScale(dynamicResolution.update(gpuFrameTime, frameBudget));
+      }
+      profiler::counter("Render scale", headset.getRenderScale());
+
+      // Render
+      profiler::Zone renderZone("Renderer::render");
+      renderer.render(frame.scene, swapchainImageIndex);
+      renderZone.end();
+      profiler::counter("Fence wait (ms)", renderer.getFenceWaitTime());
+
+      profiler::Zone mirrorRenderZone("MirrorView::render");
+      const MirrorView::RenderResult mirrorResult = mirrorView.render(swapchainImageIndex);
+      mirrorRenderZone.end();
+      if (mirrorResult == MirrorView::RenderResult::Error)
+      {
+        return false;
+      }
+
+      const bool mirrorViewVisible = (mirrorResult == MirrorView::RenderResult::Visible);
+
+      if (lateLatchingEnabled)
+      {
+        profiler::Zone lateLatchZone("Headset::lateLatchEyePoses");
+        if (headset.lateLatchEyePoses())
+        {
+          renderer.updateViewProjection();
+        }
+      }
+
+      profiler::Zone submitZone("Renderer::submit");
+      renderer.submit(mirrorViewVisible);
+      submitZone.end();
+
+      if (mirrorViewVisible)
+      {
+        profiler::Zone presentZone("MirrorView::present");
+        mirrorView.present();
+      }
+
+#ifdef DEBUG
+      // [tdbe] a GPU frame time close to the CPU frame time means the frame is GPU bound, a much lower one CPU bound
+      static float gpuTimingLogTime = 0.0f;
+      gpuTimingLogTime += frame.deltaTime;
+      if (gpuTimingLogTime >= gpuTimingLogInterval)
+      {
+        gpuTimingLogTime = 0.0f;
+        const GpuProfiler& gpuProfiler = renderer.getGpuProfiler();
+        std::printf("\n[Main][log] cpu frame: %.2fms (fence wait %.2fms, %zu frames in flight), gpu frame: %.2fms "
+                    "(culling %.2fms, eyes %.2fms, pyramid %.2fms, eyes second phase %.2fms, mirror %.2fms), "
+                    "render scale: %.2f",
+                    frame.deltaTime * 1000.0f, renderer.getFenceWaitTime(), renderer.getFramesInFlightCount(),
+                    gpuProfiler.getAverage(GpuTimer::Frame),
+                    gpuProfiler.getAverage(GpuTimer::OcclusionCulling), gpuProfiler.getAverage(GpuTimer::EyeRenderPass),
+                    gpuProfiler.getAverage(GpuTimer::DepthPyramid),
+                    gpuProfiler.getAverage(GpuTimer::EyeContinuationRenderPass),
+                    gpuProfiler.getAverage(GpuTimer::MirrorBlit), headset.getRenderScale());
+      }
+#endif
+    }
+
+    profiler::Zone endFrameZone("Headset::endFrame");
+    headset.endFrame();
+    return true;
+  });
+
   static float gameTime = 0.0f;
   
-  // Main loop
+  // Main loop, the simulation stage
   std::chrono::high_resolution_clock::time_point previousTime = std::chrono::high_resolution_clock::now();
   while (!headset.isExitRequested() && !mirrorView.isExitRequested())
   {
+    profiler::Zone frameZone("Simulation frame");
+
     // Calculate the delta time in seconds
     const std::chrono::high_resolution_clock::time_point nowTime = std::chrono::high_resolution_clock::now();
     const long long elapsedNanoseconds =
       std::chrono::duration_cast<std::chrono::nanoseconds>(nowTime - previousTime).count();
     const float deltaTime = static_cast<float>(elapsedNanoseconds) / 1e9f;
     previousTime = nowTime;
+    profiler::counter("CPU frame time (ms)", deltaTime * 1000.0);
 
+    profiler::Zone processWindowEventsZone("MirrorView::processWindowEvents");
     mirrorView.processWindowEvents();
+    processWindowEventsZone.end();
     
-    uint32_t swapchainImageIndex;
-    const Headset::BeginFrameResult frameResult = headset.beginFrame(swapchainImageIndex);
-    if (frameResult == Headset::BeginFrameResult::Error)
+    RenderThread::FrameData& frame = renderThread.getSimulationFrame();
+    profiler::Zone waitFrameZone("Headset::waitFrame");
+    const Headset::FrameResult frameResult = headset.waitFrame(frame.headsetFrame);
+    waitFrameZone.end();
+    if (frameResult == Headset::FrameResult::Error)
     {
       return EXIT_FAILURE;
     }
-    else if (frameResult == Headset::BeginFrameResult::RenderFully)
+    else if (frameResult == Headset::FrameResult::SessionStopping)
     {
-      
-      if (!inputSystem.Sync(headset.getXrSpace(), headset.getXrFrameState().predictedDisplayTime, 
-                            headset.getEyePoses(), headset.getSessionState()))
+      // Let the render thread end the frame it is working on first
+      renderThread.flush();
+      if (!headset.endSession())
+      {
+        return EXIT_FAILURE;
+      }
+      continue;
+    }
+    else if (frameResult == Headset::FrameResult::SkipFully)
+    {
+      continue;
+    }
+
+    frame.render = (frameResult == Headset::FrameResult::RenderFully);
+    frame.deltaTime = deltaTime;
+    if (frame.render)
+    {
+      profiler::Zone syncZone("Input::Sync");
+      if (!inputSystem.Sync(headset.getXrSpace(), frame.headsetFrame.frameState.predictedDisplayTime,
+                            frame.headsetFrame.eyePoses, headset.getSessionState()))
       {
         return EXIT_FAILURE;
       }
+      syncZone.end();
       const Inputspace::InputData& inputData = inputSystem.GetInputData();
       Inputspace::InputHaptics& inputHaptics = inputSystem.GetInputHaptics();
       
@@ -191,36 +385,27 @@ int main()
 
       // [tdbe] Update
       for(size_t i = 0; i < gameBehaviours.size(); i++){
+        profiler::Zone updateZone(gameBehaviours[i]->GetName());
         gameBehaviours[i]->Update(deltaTime, gameTime, inputData, inputHaptics);
       }
       inputSystem.ApplyHapticFeedbackRequests(inputHaptics);
 
       // [tdbe] TODO: do a xrRequestExitSession(session); ?
 
-      // Render
-      renderer.render(glm::inverse(head.worldMatrix), swapchainImageIndex, gameTime);
-
-      const MirrorView::RenderResult mirrorResult = mirrorView.render(swapchainImageIndex);
-      if (mirrorResult == MirrorView::RenderResult::Error)
-      {
-        return EXIT_FAILURE;
-      }
-
-      const bool mirrorViewVisible = (mirrorResult == MirrorView::RenderResult::Visible);
-      renderer.submit(mirrorViewVisible);
-
-      if (mirrorViewVisible)
-      {
-        mirrorView.present();
-      }
+      profiler::Zone captureZone("Renderer::captureScene");
+      renderer.captureScene(frame.scene, glm::inverse(head.getWorldMatrix()), gameTime);
     }
 
-    if (frameResult == Headset::BeginFrameResult::RenderFully || frameResult == Headset::BeginFrameResult::SkipRender)
+    // Hand the frame over, this waits for the render thread to finish the frame before it
+    profiler::Zone submitFrameZone("RenderThread::submitFrame");
+    if (!renderThread.submitFrame())
     {
-      headset.endFrame();
+      return EXIT_FAILURE;
     }
   }
 
+  renderThread.flush();
+
   for(size_t i=0; i<gameBehaviours.size(); i++){
     delete(gameBehaviours[i]);
   }
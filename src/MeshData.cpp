@@ -5,7 +5,10 @@
 
 #include <tinyobjloader/tiny_obj_loader.h>
 
+#include <glm/common.hpp>
+
 #include <cstring>
+#include <limits>
 
 bool MeshData::loadModel(const std::string& filename,
                          Color color,
@@ -22,15 +25,18 @@ bool MeshData::loadModel(const std::string& filename,
   }
 
   const size_t oldIndexCount = indices.size();
+  glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+  glm::vec3 boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
 
   for (const tinyobj::shape_t& shape : shapes)
   {
     for (const tinyobj::index_t& index : shape.mesh.indices)
     {
-      Vertex vertex;
+      const glm::vec3 position = { attrib.vertices[3 * index.vertex_index + 0],
+                                   attrib.vertices[3 * index.vertex_index + 1],
+                                   attrib.vertices[3 * index.vertex_index + 2] };
 
-      vertex.position = { attrib.vertices[3 * index.vertex_index + 0], attrib.vertices[3 * index.vertex_index + 1],
-                          attrib.vertices[3 * index.vertex_index + 2] };
+      Vertex vertex;
 
       if (index.normal_index >= 0)
       {
@@ -42,6 +48,17 @@ bool MeshData::loadModel(const std::string& filename,
         vertex.normal = { 0.0f, 0.0f, 0.0f };
       }
 
+      // OBJ texture coordinates start at the bottom left, Vulkan ones at the top left
+      if (index.texcoord_index >= 0)
+      {
+        vertex.texCoord = { attrib.texcoords[2 * index.texcoord_index + 0],
+                            1.0f - attrib.texcoords[2 * index.texcoord_index + 1] };
+      }
+      else
+      {
+        vertex.texCoord = { 0.0f, 0.0f };
+      }
+
       switch (color)
       {
       case Color::White:
@@ -52,6 +69,10 @@ bool MeshData::loadModel(const std::string& filename,
         break;
       }
 
+      boundsMin = glm::min(boundsMin, position);
+      boundsMax = glm::max(boundsMax, position);
+
+      positions.push_back(position);
       vertices.push_back(vertex);
       indices.push_back(static_cast<uint32_t>(indices.size()));
     }
@@ -62,6 +83,8 @@ bool MeshData::loadModel(const std::string& filename,
     Model* model = models.at(modelIndex);
     model->firstIndex = oldIndexCount;
     model->indexCount = indices.size() - oldIndexCount;
+    model->boundsMin = model->indexCount > 0u ? boundsMin : glm::vec3(0.0f);
+    model->boundsMax = model->indexCount > 0u ? boundsMax : glm::vec3(0.0f);
   }
 
   return true;
@@ -69,18 +92,26 @@ bool MeshData::loadModel(const std::string& filename,
 
 size_t MeshData::getSize() const
 {
-  return sizeof(vertices.at(0u)) * vertices.size() + sizeof(indices.at(0u)) * indices.size();
+  return sizeof(positions.at(0u)) * positions.size() + sizeof(vertices.at(0u)) * vertices.size() +
+         sizeof(indices.at(0u)) * indices.size();
+}
+
+size_t MeshData::getVertexOffset() const
+{
+  return sizeof(positions.at(0u)) * positions.size();
 }
 
 size_t MeshData::getIndexOffset() const
 {
-  return sizeof(vertices.at(0u)) * vertices.size();
+  return getVertexOffset() + sizeof(vertices.at(0u)) * vertices.size();
 }
 
 void MeshData::writeTo(char* destination) const
 {
+  const size_t positionsSize = sizeof(positions.at(0u)) * positions.size();
   const size_t verticesSize = sizeof(vertices.at(0u)) * vertices.size();
   const size_t indicesSize = sizeof(indices.at(0u)) * indices.size();
-  memcpy(destination, vertices.data(), verticesSize);              // Vertex section first
-  memcpy(destination + verticesSize, indices.data(), indicesSize); // Index section next
+  memcpy(destination, positions.data(), positionsSize);                           // Position section first
+  memcpy(destination + positionsSize, vertices.data(), verticesSize);             // Vertex section next
+  memcpy(destination + positionsSize + verticesSize, indices.data(), indicesSize); // Index section last
 }
\ No newline at end of file
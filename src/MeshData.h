@@ -1,5 +1,6 @@
 #pragma once
 
+#include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 
 #include <string>
@@ -8,13 +9,15 @@
 struct Model;
 
 /*
- * The vertex struct provides the vertex definition used for all geometry in the project.
+ * The vertex struct provides the vertex definition used for all geometry in the project. Vertex positions are not part
+ * of it, they are stored in a separate, tightly packed stream so that depth-only passes don't have to read the other
+ * vertex attributes.
  */
 struct Vertex final
 {
-  glm::vec3 position;
   glm::vec3 normal;
   glm::vec3 color;
+  glm::vec2 texCoord;
 };
 
 /*
@@ -36,11 +39,13 @@ public:
   bool loadModel(const std::string& filename, Color color, std::vector<Model*>& models, size_t offset, size_t count);
 
   size_t getSize() const;
+  size_t getVertexOffset() const;
   size_t getIndexOffset() const;
 
   void writeTo(char* destination) const;
 
 private:
+  std::vector<glm::vec3> positions;
   std::vector<Vertex> vertices;
   std::vector<uint32_t> indices;
 };
\ No newline at end of file
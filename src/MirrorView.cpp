@@ -1,6 +1,7 @@
 #include "MirrorView.h"
 
 #include "Context.h"
+#include "CpuProfiler.h"
 #include "Headset.h"
 #include "RenderTarget.h"
 #include "Renderer.h"
@@ -12,17 +13,20 @@
 
 #include <sstream>
 
+#include <stdio.h>
+
 namespace
 {
 constexpr const char* windowTitle = "OpenXR Vulkan Example";
 constexpr VkFormat colorFormat = VK_FORMAT_B8G8R8A8_SRGB;
 constexpr VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
 constexpr size_t mirrorEyeIndex = 1u; // Eye index to mirror, 0 = left, 1 = right
+constexpr const char* traceFilename = "trace.json"; // Written by the CPU profiler on demand
 
 void framebufferSizeCallback(GLFWwindow* window, int width, int height)
 {
   MirrorView* mirrorView = reinterpret_cast<MirrorView*>(glfwGetWindowUserPointer(window));
-  mirrorView->onWindowResize();
+  mirrorView->onWindowResize(width, height);
 }
 
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -31,6 +35,14 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
   {
     glfwSetWindowShouldClose(window, 1);
   }
+  else if (action == GLFW_RELEASE && key == GLFW_KEY_F9 && profiler::isEnabled())
+  {
+    // [tdbe] F9 writes out the recent CPU profiler zones, open the file in ui.perfetto.dev or chrome://tracing
+    if (profiler::writeChromeTrace(traceFilename))
+    {
+      printf("\n[MirrorView][log] CPU profiler trace written to %s", traceFilename);
+    }
+  }
 }
 } // namespace
 
@@ -99,8 +111,10 @@ MirrorView::~MirrorView()
   glfwTerminate();
 }
 
-void MirrorView::onWindowResize()
+void MirrorView::onWindowResize(int width, int height)
 {
+  framebufferWidth = width;
+  framebufferHeight = height;
   resizeDetected = true;
 }
 
@@ -109,6 +123,11 @@ bool MirrorView::connect(const Headset* headset, const Renderer* renderer)
   this->headset = headset;
   this->renderer = renderer;
 
+  int width, height;
+  glfwGetFramebufferSize(window, &width, &height);
+  framebufferWidth = width;
+  framebufferHeight = height;
+
   if (!recreateSwapchain())
   {
     return false;
@@ -162,9 +181,11 @@ MirrorView::RenderResult MirrorView::render(uint32_t swapchainImageIndex)
   }
 
   const VkCommandBuffer commandBuffer = renderer->getCurrentCommandBuffer();
+  renderer->beginGpuTimer(GpuTimer::MirrorBlit);
   const VkImage sourceImage = headset->getRenderTarget(swapchainImageIndex)->getImage();
   const VkImage destinationImage = swapchainImages.at(destinationImageIndex);
-  const VkExtent2D eyeResolution = headset->getEyeResolution(mirrorEyeIndex);
+  // Only the dynamic resolution rectangle of the eye image holds the frame
+  const VkExtent2D eyeResolution = headset->getRenderResolution(mirrorEyeIndex);
 
   // Convert the source image layout from undefined to transfer source
   VkImageMemoryBarrier imageMemoryBarrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
@@ -263,6 +284,7 @@ MirrorView::RenderResult MirrorView::render(uint32_t swapchainImageIndex)
   imageMemoryBarrier.subresourceRange.baseMipLevel = 0u;
   vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
                        VK_DEPENDENCY_BY_REGION_BIT, 0u, nullptr, 0u, nullptr, 1u, &imageMemoryBarrier);
+  renderer->endGpuTimer(GpuTimer::MirrorBlit);
 
   return RenderResult::Visible;
 }
@@ -337,9 +359,9 @@ bool MirrorView::recreateSwapchain()
     }
     else
     {
-      // Find the closest extent to use instead of an invalid extent
-      int width, height;
-      glfwGetFramebufferSize(window, &width, &height);
+      // Find the closest extent to use instead of an invalid extent. GLFW can only be asked on the main thread, so
+      // this uses the size its callback reported.
+      const int width = framebufferWidth, height = framebufferHeight;
 
       swapchainResolution.width = glm::clamp(width, static_cast<int>(surfaceCapabilities.minImageExtent.width),
                                              static_cast<int>(surfaceCapabilities.maxImageExtent.width));
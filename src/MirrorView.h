@@ -2,6 +2,7 @@
 
 #include <vulkan/vulkan.h>
 
+#include <atomic>
 #include <vector>
 
 class Context;
@@ -13,6 +14,9 @@ class Renderer;
  * The mirror view class handles the creation, updating, resizing, and eventual closing of the desktop window that shows
  * a copy of what is rendered into the headset. It depends on GLFW for handling the operating system, and Vulkan for the
  * blitting into the window surface.
+ *
+ * [tdbe] processWindowEvents() and isExitRequested() have to be called on the main thread (GLFW), render() and present()
+ * on the render thread.
  */
 class MirrorView final
 {
@@ -20,7 +24,7 @@ public:
   MirrorView(const Context* context);
   ~MirrorView();
 
-  void onWindowResize();
+  void onWindowResize(int width, int height);
 
   bool connect(const Headset* headset, const Renderer* renderer);
   void processWindowEvents() const;
@@ -53,7 +57,9 @@ private:
   VkExtent2D swapchainResolution = { 0u, 0u };
 
   uint32_t destinationImageIndex = 0u;
-  bool resizeDetected = false;
+  // Written by the window events on the main thread, read by the render thread
+  std::atomic<bool> resizeDetected = false;
+  std::atomic<int> framebufferWidth = 0, framebufferHeight = 0;
 
   bool recreateSwapchain();
 };
\ No newline at end of file
@@ -0,0 +1,497 @@
+#include "OcclusionCuller.h"
+
+#include "Context.h"
+#include "Headset.h"
+#include "ImageBuffer.h"
+#include "ShaderLibrary.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <array>
+
+namespace
+{
+constexpr VkFormat depthPyramidFormat = VK_FORMAT_R32_SFLOAT;
+
+constexpr const char* depthShaderName = "shaders/HiZDepth.comp.spv";
+constexpr const char* reduceShaderName = "shaders/HiZReduce.comp.spv";
+constexpr const char* cullShaderName = "shaders/OcclusionCull.comp.spv";
+
+// Have to match the local sizes of the compute shaders
+constexpr uint32_t pyramidGroupSize = 8u;
+constexpr uint32_t cullGroupSize = 64u;
+
+struct PyramidPushConstants
+{
+  uint32_t sourceWidth, sourceHeight;
+  uint32_t destinationWidth, destinationHeight;
+  uint32_t sampleCount;
+};
+
+struct CullPushConstants
+{
+  uint32_t drawCount, drawCapacity;
+  uint32_t phase;
+  uint32_t useDepthPyramid;
+  uint32_t depthWidth, depthHeight;
+  uint32_t levelCount;
+};
+
+uint32_t groupCount(uint32_t size, uint32_t groupSize)
+{
+  return (size + groupSize - 1u) / groupSize;
+}
+
+VkExtent2D halfResolution(VkExtent2D resolution)
+{
+  return { std::max((resolution.width + 1u) / 2u, 1u), std::max((resolution.height + 1u) / 2u, 1u) };
+}
+
+// Makes the compute shader writes visible to the following compute shader reads, and to indirect draws
+void computeWriteBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask)
+{
+  VkMemoryBarrier memoryBarrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+  memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  memoryBarrier.dstAccessMask = dstAccessMask;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStageMask, 0u, 1u, &memoryBarrier, 0u,
+                       nullptr, 0u, nullptr);
+}
+} // namespace
+
+OcclusionCuller::OcclusionCuller(const Context* context,
+                                 const Headset* headset,
+                                 VkDescriptorSetLayout descriptorSetLayout)
+: context(context), headset(headset)
+{
+  const VkDevice device = context->getVkDevice();
+
+  // Level 0 is half the eye resolution, every following level halves it again (rounding up) down to 1x1
+  depthResolution = headset->getEyeResolution(0u);
+  VkExtent2D levelResolution = halfResolution(depthResolution);
+  while (true)
+  {
+    levelResolutions.push_back(levelResolution);
+    if (levelResolution.width == 1u && levelResolution.height == 1u)
+    {
+      break;
+    }
+
+    levelResolution = halfResolution(levelResolution);
+  }
+
+  // Create the depth pyramid, one layer per eye
+  depthPyramid = new ImageBuffer(context, levelResolutions.at(0u), depthPyramidFormat,
+                                 VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_SAMPLE_COUNT_1_BIT,
+                                 VK_IMAGE_ASPECT_COLOR_BIT, 2u, levelResolutions.size());
+  if (!depthPyramid->isValid())
+  {
+    valid = false;
+    return;
+  }
+
+  // Create an image view for each level, they get written to one by one
+  levelImageViews.resize(levelResolutions.size(), nullptr);
+  for (size_t levelIndex = 0u; levelIndex < levelImageViews.size(); ++levelIndex)
+  {
+    VkImageViewCreateInfo imageViewCreateInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+    imageViewCreateInfo.image = depthPyramid->getImage();
+    imageViewCreateInfo.format = depthPyramidFormat;
+    imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    imageViewCreateInfo.components = { VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+                                       VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY };
+    imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageViewCreateInfo.subresourceRange.baseArrayLayer = 0u;
+    imageViewCreateInfo.subresourceRange.layerCount = 2u;
+    imageViewCreateInfo.subresourceRange.baseMipLevel = static_cast<uint32_t>(levelIndex);
+    imageViewCreateInfo.subresourceRange.levelCount = 1u;
+    if (vkCreateImageView(device, &imageViewCreateInfo, nullptr, &levelImageViews.at(levelIndex)) != VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      valid = false;
+      return;
+    }
+  }
+
+  // Create a sampler, all shaders fetch texels directly so it never filters
+  VkSamplerCreateInfo samplerCreateInfo{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+  samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+  samplerCreateInfo.minFilter = VK_FILTER_NEAREST;
+  samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+  if (vkCreateSampler(device, &samplerCreateInfo, nullptr, &sampler) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    valid = false;
+    return;
+  }
+
+  // Create a descriptor pool, one set per pyramid level and one for culling
+  const uint32_t levelCount = static_cast<uint32_t>(levelResolutions.size());
+  std::array<VkDescriptorPoolSize, 2u> descriptorPoolSizes;
+
+  descriptorPoolSizes.at(0u).type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorPoolSizes.at(0u).descriptorCount = levelCount + 1u;
+
+  descriptorPoolSizes.at(1u).type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  descriptorPoolSizes.at(1u).descriptorCount = levelCount;
+
+  VkDescriptorPoolCreateInfo descriptorPoolCreateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+  descriptorPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(descriptorPoolSizes.size());
+  descriptorPoolCreateInfo.pPoolSizes = descriptorPoolSizes.data();
+  descriptorPoolCreateInfo.maxSets = levelCount + 1u;
+  if (vkCreateDescriptorPool(device, &descriptorPoolCreateInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    valid = false;
+    return;
+  }
+
+  // Create the descriptor set layouts, pyramid levels are built from the level below (or the depth buffer)
+  std::array<VkDescriptorSetLayoutBinding, 2u> pyramidDescriptorSetLayoutBindings;
+
+  pyramidDescriptorSetLayoutBindings.at(0u).binding = 0u;
+  pyramidDescriptorSetLayoutBindings.at(0u).descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  pyramidDescriptorSetLayoutBindings.at(0u).descriptorCount = 1u;
+  pyramidDescriptorSetLayoutBindings.at(0u).stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pyramidDescriptorSetLayoutBindings.at(0u).pImmutableSamplers = nullptr;
+
+  pyramidDescriptorSetLayoutBindings.at(1u).binding = 1u;
+  pyramidDescriptorSetLayoutBindings.at(1u).descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  pyramidDescriptorSetLayoutBindings.at(1u).descriptorCount = 1u;
+  pyramidDescriptorSetLayoutBindings.at(1u).stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pyramidDescriptorSetLayoutBindings.at(1u).pImmutableSamplers = nullptr;
+
+  VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+  descriptorSetLayoutCreateInfo.bindingCount = static_cast<uint32_t>(pyramidDescriptorSetLayoutBindings.size());
+  descriptorSetLayoutCreateInfo.pBindings = pyramidDescriptorSetLayoutBindings.data();
+  if (vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, nullptr, &pyramidDescriptorSetLayout) !=
+      VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    valid = false;
+    return;
+  }
+
+  // Culling only reads the whole pyramid
+  descriptorSetLayoutCreateInfo.bindingCount = 1u;
+  if (vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, nullptr, &cullDescriptorSetLayout) !=
+      VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    valid = false;
+    return;
+  }
+
+  // Allocate the descriptor sets
+  pyramidDescriptorSets.resize(levelResolutions.size(), nullptr);
+  const std::vector<VkDescriptorSetLayout> pyramidDescriptorSetLayouts(pyramidDescriptorSets.size(),
+                                                                       pyramidDescriptorSetLayout);
+  VkDescriptorSetAllocateInfo descriptorSetAllocateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+  descriptorSetAllocateInfo.descriptorPool = descriptorPool;
+  descriptorSetAllocateInfo.descriptorSetCount = static_cast<uint32_t>(pyramidDescriptorSetLayouts.size());
+  descriptorSetAllocateInfo.pSetLayouts = pyramidDescriptorSetLayouts.data();
+  if (vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, pyramidDescriptorSets.data()) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    valid = false;
+    return;
+  }
+
+  descriptorSetAllocateInfo.descriptorSetCount = 1u;
+  descriptorSetAllocateInfo.pSetLayouts = &cullDescriptorSetLayout;
+  if (vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, &cullDescriptorSet) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    valid = false;
+    return;
+  }
+
+  // Update the descriptor sets. The depth buffer is read in the layout the first render pass leaves it in, the pyramid
+  // stays in general layout at all times.
+  std::vector<VkDescriptorImageInfo> descriptorImageInfos(levelResolutions.size() * 2u + 1u);
+  std::vector<VkWriteDescriptorSet> writeDescriptorSets(descriptorImageInfos.size(),
+                                                        { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET });
+  for (size_t levelIndex = 0u; levelIndex < levelResolutions.size(); ++levelIndex)
+  {
+    VkDescriptorImageInfo& sourceImageInfo = descriptorImageInfos.at(levelIndex * 2u);
+    sourceImageInfo.sampler = sampler;
+    if (levelIndex == 0u)
+    {
+      sourceImageInfo.imageView = headset->getDepthBuffer()->getImageView();
+      sourceImageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    }
+    else
+    {
+      sourceImageInfo.imageView = levelImageViews.at(levelIndex - 1u);
+      sourceImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    }
+
+    VkDescriptorImageInfo& destinationImageInfo = descriptorImageInfos.at(levelIndex * 2u + 1u);
+    destinationImageInfo.sampler = nullptr;
+    destinationImageInfo.imageView = levelImageViews.at(levelIndex);
+    destinationImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkWriteDescriptorSet& sourceWriteDescriptorSet = writeDescriptorSets.at(levelIndex * 2u);
+    sourceWriteDescriptorSet.dstSet = pyramidDescriptorSets.at(levelIndex);
+    sourceWriteDescriptorSet.dstBinding = 0u;
+    sourceWriteDescriptorSet.descriptorCount = 1u;
+    sourceWriteDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    sourceWriteDescriptorSet.pImageInfo = &sourceImageInfo;
+
+    VkWriteDescriptorSet& destinationWriteDescriptorSet = writeDescriptorSets.at(levelIndex * 2u + 1u);
+    destinationWriteDescriptorSet.dstSet = pyramidDescriptorSets.at(levelIndex);
+    destinationWriteDescriptorSet.dstBinding = 1u;
+    destinationWriteDescriptorSet.descriptorCount = 1u;
+    destinationWriteDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    destinationWriteDescriptorSet.pImageInfo = &destinationImageInfo;
+  }
+
+  VkDescriptorImageInfo& pyramidImageInfo = descriptorImageInfos.back();
+  pyramidImageInfo.sampler = sampler;
+  pyramidImageInfo.imageView = depthPyramid->getImageView();
+  pyramidImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+  VkWriteDescriptorSet& pyramidWriteDescriptorSet = writeDescriptorSets.back();
+  pyramidWriteDescriptorSet.dstSet = cullDescriptorSet;
+  pyramidWriteDescriptorSet.dstBinding = 0u;
+  pyramidWriteDescriptorSet.descriptorCount = 1u;
+  pyramidWriteDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  pyramidWriteDescriptorSet.pImageInfo = &pyramidImageInfo;
+
+  vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0u,
+                         nullptr);
+
+  // Create the pipeline layouts
+  VkPushConstantRange pushConstantRange;
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushConstantRange.offset = 0u;
+  pushConstantRange.size = sizeof(PyramidPushConstants);
+
+  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+  pipelineLayoutCreateInfo.setLayoutCount = 1u;
+  pipelineLayoutCreateInfo.pSetLayouts = &pyramidDescriptorSetLayout;
+  pipelineLayoutCreateInfo.pushConstantRangeCount = 1u;
+  pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+  if (vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pyramidPipelineLayout) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    valid = false;
+    return;
+  }
+
+  // Culling uses the descriptor set of the render process as set 0 and the pyramid as set 1
+  const std::array cullDescriptorSetLayouts = { descriptorSetLayout, cullDescriptorSetLayout };
+  pushConstantRange.size = sizeof(CullPushConstants);
+  pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(cullDescriptorSetLayouts.size());
+  pipelineLayoutCreateInfo.pSetLayouts = cullDescriptorSetLayouts.data();
+  if (vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &cullPipelineLayout) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    valid = false;
+    return;
+  }
+
+  // Create the compute pipelines
+  if (!createComputePipeline(depthShaderName, pyramidPipelineLayout, depthPipeline) ||
+      !createComputePipeline(reduceShaderName, pyramidPipelineLayout, reducePipeline) ||
+      !createComputePipeline(cullShaderName, cullPipelineLayout, cullPipeline))
+  {
+    valid = false;
+    return;
+  }
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+  const VkDevice device = context->getVkDevice();
+  if (device)
+  {
+    for (const VkPipeline pipeline : { cullPipeline, reducePipeline, depthPipeline })
+    {
+      if (pipeline)
+      {
+        vkDestroyPipeline(device, pipeline, nullptr);
+      }
+    }
+
+    for (const VkPipelineLayout pipelineLayout : { cullPipelineLayout, pyramidPipelineLayout })
+    {
+      if (pipelineLayout)
+      {
+        vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+      }
+    }
+
+    for (const VkDescriptorSetLayout descriptorSetLayout : { cullDescriptorSetLayout, pyramidDescriptorSetLayout })
+    {
+      if (descriptorSetLayout)
+      {
+        vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+      }
+    }
+
+    if (descriptorPool)
+    {
+      vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    }
+
+    if (sampler)
+    {
+      vkDestroySampler(device, sampler, nullptr);
+    }
+
+    for (const VkImageView imageView : levelImageViews)
+    {
+      if (imageView)
+      {
+        vkDestroyImageView(device, imageView, nullptr);
+      }
+    }
+  }
+
+  delete depthPyramid;
+}
+
+bool OcclusionCuller::createComputePipeline(const std::string& filename,
+                                            VkPipelineLayout pipelineLayout,
+                                            VkPipeline& pipeline) const
+{
+  const VkDevice device = context->getVkDevice();
+
+  // Nothing else uses the compute shaders, so their modules only live until the pipeline is created
+  ShaderLibrary* shaderLibrary = context->getShaderLibrary();
+  ShaderLibrary::Handle shaderHandle;
+  if (!shaderLibrary->acquire(filename, shaderHandle))
+  {
+    return false;
+  }
+
+  VkComputePipelineCreateInfo computePipelineCreateInfo{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+  computePipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  computePipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  computePipelineCreateInfo.stage.module = shaderLibrary->getShaderModule(shaderHandle);
+  computePipelineCreateInfo.stage.pName = "main";
+  computePipelineCreateInfo.layout = pipelineLayout;
+  const VkResult result = vkCreateComputePipelines(device, context->getVkPipelineCache(), 1u,
+                                                   &computePipelineCreateInfo, nullptr, &pipeline);
+
+  shaderLibrary->release(shaderHandle);
+
+  if (result != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    return false;
+  }
+
+  return true;
+}
+
+void OcclusionCuller::cull(VkCommandBuffer commandBuffer,
+                           VkDescriptorSet descriptorSet,
+                           Phase phase,
+                           size_t drawCount,
+                           size_t drawCapacity,
+                           VkExtent2D renderResolution) const
+{
+  if (drawCount == 0u)
+  {
+    return;
+  }
+
+  CullPushConstants pushConstants;
+  pushConstants.drawCount = static_cast<uint32_t>(drawCount);
+  pushConstants.drawCapacity = static_cast<uint32_t>(drawCapacity);
+  pushConstants.phase = static_cast<uint32_t>(phase);
+  // Without a pyramid to test against the first phase lets every opaque draw through. The same goes for a pyramid
+  // built at another render resolution.
+  const bool pyramidMatches = depthPyramidValid && pyramidResolution.width == renderResolution.width &&
+                              pyramidResolution.height == renderResolution.height;
+  pushConstants.useDepthPyramid = (phase == Phase::Second || pyramidMatches) ? 1u : 0u;
+  pushConstants.depthWidth = renderResolution.width;
+  pushConstants.depthHeight = renderResolution.height;
+  pushConstants.levelCount = static_cast<uint32_t>(levelResolutions.size());
+
+  const std::array descriptorSets = { descriptorSet, cullDescriptorSet };
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0u,
+                          static_cast<uint32_t>(descriptorSets.size()), descriptorSets.data(), 0u, nullptr);
+  vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0u, sizeof(pushConstants),
+                     &pushConstants);
+  vkCmdDispatch(commandBuffer, groupCount(pushConstants.drawCount, cullGroupSize), 1u, 1u);
+
+  // The indirect draws consume the commands, the second phase also reads the commands of the first one
+  computeWriteBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                      VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+}
+
+void OcclusionCuller::buildDepthPyramid(VkCommandBuffer commandBuffer, VkExtent2D renderResolution)
+{
+  // The pyramid is transitioned once and stays in general layout from then on
+  if (!depthPyramidInitialized)
+  {
+    VkImageMemoryBarrier imageMemoryBarrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+    imageMemoryBarrier.srcAccessMask = 0u;
+    imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageMemoryBarrier.image = depthPyramid->getImage();
+    imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageMemoryBarrier.subresourceRange.baseMipLevel = 0u;
+    imageMemoryBarrier.subresourceRange.levelCount = static_cast<uint32_t>(levelResolutions.size());
+    imageMemoryBarrier.subresourceRange.baseArrayLayer = 0u;
+    imageMemoryBarrier.subresourceRange.layerCount = 2u;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0u,
+                         0u, nullptr, 0u, nullptr, 1u, &imageMemoryBarrier);
+    depthPyramidInitialized = true;
+  }
+
+  // Level 0 is reduced from the multisampled depth buffer, every other level from the level below. Only the part that
+  // covers the render resolution is built, the rest of each level is left as it was.
+  VkExtent2D sourceResolution = renderResolution;
+  for (size_t levelIndex = 0u; levelIndex < levelResolutions.size(); ++levelIndex)
+  {
+    const VkExtent2D destinationResolution = halfResolution(sourceResolution);
+
+    PyramidPushConstants pushConstants;
+    pushConstants.sourceWidth = sourceResolution.width;
+    pushConstants.sourceHeight = sourceResolution.height;
+    pushConstants.destinationWidth = destinationResolution.width;
+    pushConstants.destinationHeight = destinationResolution.height;
+    pushConstants.sampleCount = levelIndex == 0u ? static_cast<uint32_t>(context->getMultisampleCount()) : 1u;
+
+    if (levelIndex <= 1u)
+    {
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, levelIndex == 0u ? depthPipeline : reducePipeline);
+    }
+
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pyramidPipelineLayout, 0u, 1u,
+                            &pyramidDescriptorSets.at(levelIndex), 0u, nullptr);
+    vkCmdPushConstants(commandBuffer, pyramidPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0u, sizeof(pushConstants),
+                       &pushConstants);
+    vkCmdDispatch(commandBuffer, groupCount(destinationResolution.width, pyramidGroupSize),
+                  groupCount(destinationResolution.height, pyramidGroupSize), 2u);
+
+    // The next level (or the culling after the last level) reads what was just written
+    computeWriteBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+    sourceResolution = destinationResolution;
+  }
+
+  pyramidResolution = renderResolution;
+  depthPyramidValid = true;
+}
+
+void OcclusionCuller::invalidateDepthPyramid()
+{
+  depthPyramidValid = false;
+}
+
+bool OcclusionCuller::isValid() const
+{
+  return valid;
+}
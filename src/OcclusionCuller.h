@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+#include <vector>
+
+class Context;
+class Headset;
+class ImageBuffer;
+
+/*
+ * The occlusion culler class owns a hierarchical depth buffer (depth pyramid) of both eyes and the compute pipelines
+ * that build it and test the bounds of the draws against it. Each level of the pyramid holds the farthest depth of a
+ * 2x2 block of the level below, level 0 being half the eye resolution. The culling shader uses the descriptor set of
+ * the render process (object table, view projection matrices, draw list and indirect draw commands) as its first set.
+ *
+ * Culling happens in two phases per frame. The first phase tests the opaque draws against the pyramid of the previous
+ * frame, the visible ones are rendered and a new pyramid is built from their depth. The second phase then tests what
+ * the first phase rejected (plus the transparent draws) against the new pyramid, so that models that became visible
+ * this frame are never missing.
+ */
+class OcclusionCuller final
+{
+public:
+  OcclusionCuller(const Context* context, const Headset* headset, VkDescriptorSetLayout descriptorSetLayout);
+  ~OcclusionCuller();
+
+  enum class Phase
+  {
+    First = 0,
+    Second = 1
+  };
+
+  // Writes an indirect draw command for each of the first 'drawCount' draws of the draw list. The render resolution is
+  // the part of the eye images that is rendered to (see Headset::setRenderScale()).
+  void cull(VkCommandBuffer commandBuffer, VkDescriptorSet descriptorSet, Phase phase, size_t drawCount,
+            size_t drawCapacity, VkExtent2D renderResolution) const;
+
+  // Builds the pyramid from the rendered part of the headset depth buffer, which has to be in depth read-only layout
+  void buildDepthPyramid(VkCommandBuffer commandBuffer, VkExtent2D renderResolution);
+
+  // The pyramid is stale after the culling was turned off, the first phase lets everything through until it is rebuilt
+  void invalidateDepthPyramid();
+
+  bool isValid() const;
+
+private:
+  bool valid = true;
+
+  const Context* context = nullptr;
+  const Headset* headset = nullptr;
+
+  VkExtent2D depthResolution = { 0u, 0u };   // Full eye resolution, the pyramid is sized for it
+  VkExtent2D pyramidResolution = { 0u, 0u }; // The render resolution the pyramid was last built from
+  std::vector<VkExtent2D> levelResolutions;
+  ImageBuffer* depthPyramid = nullptr;
+  std::vector<VkImageView> levelImageViews;
+  bool depthPyramidInitialized = false, depthPyramidValid = false;
+
+  VkSampler sampler = nullptr;
+  VkDescriptorPool descriptorPool = nullptr;
+  VkDescriptorSetLayout pyramidDescriptorSetLayout = nullptr, cullDescriptorSetLayout = nullptr;
+  std::vector<VkDescriptorSet> pyramidDescriptorSets; // One per level
+  VkDescriptorSet cullDescriptorSet = nullptr;
+
+  VkPipelineLayout pyramidPipelineLayout = nullptr, cullPipelineLayout = nullptr;
+  VkPipeline depthPipeline = nullptr, reducePipeline = nullptr, cullPipeline = nullptr;
+
+  bool createComputePipeline(const std::string& filename, VkPipelineLayout pipelineLayout, VkPipeline& pipeline) const;
+};
@@ -3,72 +3,324 @@
 
 
 #include "Context.h"
+#include "ShaderLibrary.h"
 #include "Util.h"
 
+#include <algorithm>
 #include <array>
-#include <sstream>
+#include <cstddef>
 
+namespace
+{
+// Bits per field in PipelineMaterialPayload::pack()
+constexpr uint32_t blendFactorBits = 5u; // VK_BLEND_FACTOR_ONE_MINUS_SRC1_ALPHA is 18
+constexpr uint32_t blendOpBits = 3u;     // VK_BLEND_OP_MAX is 4
+constexpr uint32_t cullModeBits = 2u;
+constexpr uint32_t depthWriteBits = 1u;
+constexpr uint32_t compareOpBits = 3u;   // VK_COMPARE_OP_ALWAYS is 7
+constexpr uint32_t flagBits = 1u;
+constexpr uint32_t vertexColorSourceBits = 4u;
+
+// The specialization constants of MaterialSpecialization, in the order of their constant IDs
+constexpr std::array<VkSpecializationMapEntry, 4u> specializationMapEntries = {
+  { { 0u, offsetof(MaterialSpecialization, alphaOutput), sizeof(VkBool32) },
+    { 1u, offsetof(MaterialSpecialization, lightingEnabled), sizeof(VkBool32) },
+    { 2u, offsetof(MaterialSpecialization, vertexColorSource), sizeof(uint32_t) },
+    { 3u, offsetof(MaterialSpecialization, objectDataFromTable), sizeof(VkBool32) } }
+};
+
+void hashCombine(uint64_t& hash, uint64_t value)
+{
+  hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6u) + (hash >> 2u);
+}
+
+// 64-bit FNV-1a
+uint64_t hashBytes(const void* data, size_t size)
+{
+  uint64_t hash = 14695981039346656037ull;
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t byteIndex = 0u; byteIndex < size; ++byteIndex)
+  {
+    hash ^= bytes[byteIndex];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+} // namespace
+
+uint64_t PipelineMaterialPayload::pack() const
+{
+  uint64_t bits = 0u;
+  const auto append = [&bits](uint32_t value, uint32_t bitCount)
+  {
+    bits = (bits << bitCount) | (value & ((1u << bitCount) - 1u));
+  };
+
+  append(static_cast<uint32_t>(srcColorBlendFactor), blendFactorBits);
+  append(static_cast<uint32_t>(dstColorBlendFactor), blendFactorBits);
+  append(static_cast<uint32_t>(colorBlendOp), blendOpBits);
+  append(static_cast<uint32_t>(srcAlphaBlendFactor), blendFactorBits);
+  append(static_cast<uint32_t>(dstAlphaBlendFactor), blendFactorBits);
+  append(static_cast<uint32_t>(alphaBlendOp), blendOpBits);
+  append(static_cast<uint32_t>(cullMode), cullModeBits);
+  append(static_cast<uint32_t>(depthWriteEnable), depthWriteBits);
+  append(static_cast<uint32_t>(depthCompareOp), compareOpBits);
+  append(static_cast<uint32_t>(specialization.alphaOutput), flagBits);
+  append(static_cast<uint32_t>(specialization.lightingEnabled), flagBits);
+  append(static_cast<uint32_t>(specialization.vertexColorSource), vertexColorSourceBits);
+  append(static_cast<uint32_t>(specialization.objectDataFromTable), flagBits);
+  return bits;
+}
+
+PipelineKey PipelineKey::create(ShaderLibrary& shaderLibrary,
+                                const std::string& vertShaderName,
+                                const std::string& fragShaderName,
+                                const PipelineMaterialPayload& pipelineData)
+{
+  PipelineKey key;
+  key.vertShader = shaderLibrary.getHandle(vertShaderName);
+  key.fragShader = shaderLibrary.getHandle(fragShaderName);
+  key.pipelineData = pipelineData.pack();
+  return key;
+}
+
+size_t PipelineKey::Hash::operator()(const PipelineKey& key) const
+{
+  // The shader handles are small consecutive numbers, so they go through the combine as well
+  uint64_t hash = key.pipelineData;
+  hashCombine(hash, key.vertShader);
+  hashCombine(hash, key.fragShader);
+  return static_cast<size_t>(hash);
+}
+
+void PipelineLibraryCache::PartKey::append(const void* data, size_t size)
+{
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  state.insert(state.end(), bytes, bytes + size);
+}
+
+size_t PipelineLibraryCache::PartKey::Hash::operator()(const PartKey& key) const
+{
+  uint64_t hash = hashBytes(key.state.data(), key.state.size());
+  hashCombine(hash, key.part);
+  return static_cast<size_t>(hash);
+}
+
+PipelineLibraryCache::PipelineLibraryCache(const Context* context) : context(context) {}
+
+PipelineLibraryCache::~PipelineLibraryCache()
+{
+  const VkDevice device = context->getVkDevice();
+  for (const auto& [key, library] : libraries)
+  {
+    if (library.pipeline)
+    {
+      vkDestroyPipeline(device, library.pipeline, nullptr);
+    }
+  }
+}
+
+VkPipeline PipelineLibraryCache::getLibrary(const PartKey& key, const VkGraphicsPipelineCreateInfo& createInfo)
+{
+  {
+    // The first thread to ask for a part claims it, later ones wait for it to be compiled
+    std::unique_lock<std::mutex> lock(mutex);
+    const auto [it, inserted] = libraries.try_emplace(key);
+    if (!inserted)
+    {
+      const Library& library = it->second;
+      libraryCompiled.wait(lock, [&library] { return !library.compiling; });
+      return library.pipeline;
+    }
+  }
+
+  // Only the shader stages of the part go into it
+  const VkGraphicsPipelineLibraryFlagsEXT part = key.part;
+  VkShaderStageFlags partStages = 0u;
+  if (part == VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT)
+  {
+    partStages = VK_SHADER_STAGE_VERTEX_BIT;
+  }
+  else if (part == VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT)
+  {
+    partStages = VK_SHADER_STAGE_FRAGMENT_BIT;
+  }
+
+  std::vector<VkPipelineShaderStageCreateInfo> stages;
+  for (uint32_t stageIndex = 0u; stageIndex < createInfo.stageCount; ++stageIndex)
+  {
+    if (createInfo.pStages[stageIndex].stage & partStages)
+    {
+      stages.push_back(createInfo.pStages[stageIndex]);
+    }
+  }
+
+  VkGraphicsPipelineLibraryCreateInfoEXT graphicsPipelineLibraryCreateInfo{
+    VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT
+  };
+  graphicsPipelineLibraryCreateInfo.flags = part;
+
+  VkGraphicsPipelineCreateInfo libraryCreateInfo = createInfo;
+  libraryCreateInfo.pNext = &graphicsPipelineLibraryCreateInfo;
+  libraryCreateInfo.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR;
+  libraryCreateInfo.stageCount = static_cast<uint32_t>(stages.size());
+  libraryCreateInfo.pStages = stages.data();
+
+  // Compiled without holding the lock, so that other parts can compile at the same time
+  VkPipeline library;
+  if (vkCreateGraphicsPipelines(context->getVkDevice(), context->getVkPipelineCache(), 1u, &libraryCreateInfo, nullptr,
+                                &library) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    library = nullptr; // Stays failed, the pipelines that need it fall back to compile()
+  }
+
+  {
+    // Entries never get removed, so the reference stays valid
+    const std::lock_guard<std::mutex> lock(mutex);
+    Library& entry = libraries.at(key);
+    entry.pipeline = library;
+    entry.compiling = false;
+  }
+  libraryCompiled.notify_all();
+  return library;
+}
+
+VkPipeline PipelineLibraryCache::findLibrary(const PartKey& key)
+{
+  const std::lock_guard<std::mutex> lock(mutex);
+  const auto it = libraries.find(key);
+  if (it == libraries.end())
+  {
+    return nullptr;
+  }
+  return it->second.pipeline;
+}
 
+struct Pipeline::CreateInfo
+{
+  std::array<VkPipelineShaderStageCreateInfo, 2u> shaderStages;
+  VkSpecializationInfo specializationInfo;
+  VkPipelineVertexInputStateCreateInfo vertexInputState{ VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+  VkPipelineInputAssemblyStateCreateInfo inputAssemblyState{
+    VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO
+  };
+  VkPipelineViewportStateCreateInfo viewportState{ VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+  VkPipelineRasterizationStateCreateInfo rasterizationState{
+    VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO
+  };
+  VkPipelineMultisampleStateCreateInfo multisampleState{ VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
+  VkPipelineColorBlendAttachmentState colorBlendAttachmentState{};
+  VkPipelineColorBlendStateCreateInfo colorBlendState{ VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+  std::vector<VkDynamicState> dynamicStates;
+  VkPipelineDynamicStateCreateInfo dynamicState{ VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+  VkPipelineDepthStencilStateCreateInfo depthStencilState{
+    VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO
+  };
+  VkGraphicsPipelineCreateInfo graphicsPipelineCreateInfo{ VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+};
 
 Pipeline::Pipeline(const Context* context,
                    VkPipelineLayout pipelineLayout,
                    VkRenderPass renderPass,
+                   uint32_t subpass,
                    const std::string& vertexFilename,
                    const std::string& fragmentFilename,
                    const std::vector<VkVertexInputBindingDescription>& vertexInputBindingDescriptions,
                    const std::vector<VkVertexInputAttributeDescription>& vertexInputAttributeDescriptions,
                    PipelineMaterialPayload pipelineData
                    )
-: context(context)
+: context(context), pipelineLayout(pipelineLayout), renderPass(renderPass), subpass(subpass),
+  vertexInputBindingDescriptions(vertexInputBindingDescriptions),
+  vertexInputAttributeDescriptions(vertexInputAttributeDescriptions)
 {
-  const VkDevice device = context->getVkDevice();
-
   this->pipelineData = pipelineData;
   vertShaderName = vertexFilename;
   fragShaderName = fragmentFilename;
 
-  // Load the vertex shader
-  VkShaderModule vertexShaderModule;
-  if (!util::loadShaderFromFile(device, vertexFilename, vertexShaderModule))
+  // Get the vertex shader, the shader library only loads it if no other pipeline did already
+  ShaderLibrary* shaderLibrary = context->getShaderLibrary();
+  ShaderLibrary::Handle vertexShaderHandle;
+  if (!shaderLibrary->acquire(vertexFilename, vertexShaderHandle))
   {
-    std::stringstream s;
-    s << "Vertex shader \"" << vertexFilename << "\"";
-    util::error(Error::FileMissing, s.str());
     valid = false;
     return;
   }
+  shaderHandles.push_back(vertexShaderHandle);
+  vertexShaderModule = shaderLibrary->getShaderModule(vertexShaderHandle);
 
-  // Load the fragment shader
-  VkShaderModule fragmentShaderModule;
-  if (!util::loadShaderFromFile(device, fragmentFilename, fragmentShaderModule))
+  // Get the fragment shader, unless this is a depth-only pipeline
+  const bool depthOnly = fragmentFilename.empty();
+  if (!depthOnly)
   {
-    std::stringstream s;
-    s << "Fragment shader \"" << fragmentFilename << "\"";
-    util::error(Error::FileMissing, s.str());
-    valid = false;
-    return;
+    ShaderLibrary::Handle fragmentShaderHandle;
+    if (!shaderLibrary->acquire(fragmentFilename, fragmentShaderHandle))
+    {
+      valid = false;
+      return;
+    }
+    shaderHandles.push_back(fragmentShaderHandle);
+    fragmentShaderModule = shaderLibrary->getShaderModule(fragmentShaderHandle);
   }
 
-  VkPipelineShaderStageCreateInfo pipelineShaderStageCreateInfoVertex{
-    VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO
-  };
+  const Context::ExtendedDynamicState& extendedDynamicState = context->getExtendedDynamicState();
+  dynamicCullAndDepthState = extendedDynamicState.enabled;
+  dynamicBlendEquation = extendedDynamicState.blendEquationEnabled && !depthOnly; // Depth-only has nothing to blend
+
+  valid = true;
+}
+
+Pipeline::~Pipeline()
+{
+  const VkDevice device = context->getVkDevice();
+  if (device)
+  {
+    if (pipeline)
+    {
+      vkDestroyPipeline(device, pipeline, nullptr);
+    }
+
+    for (const VkPipeline replacedPipeline : replacedPipelines)
+    {
+      vkDestroyPipeline(device, replacedPipeline, nullptr);
+    }
+  }
+
+  // The shader modules stay loaded as long as other pipelines use them
+  for (const uint64_t shaderHandle : shaderHandles)
+  {
+    context->getShaderLibrary()->release(shaderHandle);
+  }
+}
+
+void Pipeline::fillCreateInfo(CreateInfo& createInfo) const
+{
+  const bool depthOnly = !fragmentShaderModule;
+
+  VkPipelineShaderStageCreateInfo& pipelineShaderStageCreateInfoVertex = createInfo.shaderStages.at(0u);
+  pipelineShaderStageCreateInfoVertex = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
   pipelineShaderStageCreateInfoVertex.module = vertexShaderModule;
   pipelineShaderStageCreateInfoVertex.stage = VK_SHADER_STAGE_VERTEX_BIT;
   pipelineShaderStageCreateInfoVertex.pName = "main";
 
-  VkPipelineShaderStageCreateInfo pipelineShaderStageCreateInfoFragment{
-    VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO
-  };
+  // Both stages get all specialization constants, each uses the ones it declares
+  VkSpecializationInfo& specializationInfo = createInfo.specializationInfo;
+  specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationMapEntries.size());
+  specializationInfo.pMapEntries = specializationMapEntries.data();
+  specializationInfo.dataSize = sizeof(MaterialSpecialization);
+  specializationInfo.pData = &pipelineData.specialization;
+  pipelineShaderStageCreateInfoVertex.pSpecializationInfo = &specializationInfo;
+
+  VkPipelineShaderStageCreateInfo& pipelineShaderStageCreateInfoFragment = createInfo.shaderStages.at(1u);
+  pipelineShaderStageCreateInfoFragment = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
   pipelineShaderStageCreateInfoFragment.module = fragmentShaderModule;
   pipelineShaderStageCreateInfoFragment.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
   pipelineShaderStageCreateInfoFragment.pName = "main";
+  pipelineShaderStageCreateInfoFragment.pSpecializationInfo = &specializationInfo;
 
-  const std::array shaderStages = { pipelineShaderStageCreateInfoVertex, pipelineShaderStageCreateInfoFragment };
-
-  VkPipelineVertexInputStateCreateInfo pipelineVertexInputStateCreateInfo{
-    VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO
-  };
+  const uint32_t shaderStageCount = depthOnly ? 1u : static_cast<uint32_t>(createInfo.shaderStages.size());
 
+  VkPipelineVertexInputStateCreateInfo& pipelineVertexInputStateCreateInfo = createInfo.vertexInputState;
   pipelineVertexInputStateCreateInfo.vertexBindingDescriptionCount =
     static_cast<uint32_t>(vertexInputBindingDescriptions.size());
   pipelineVertexInputStateCreateInfo.pVertexBindingDescriptions = vertexInputBindingDescriptions.data();
@@ -76,33 +328,19 @@ Pipeline::Pipeline(const Context* context,
     static_cast<uint32_t>(vertexInputAttributeDescriptions.size());
   pipelineVertexInputStateCreateInfo.pVertexAttributeDescriptions = vertexInputAttributeDescriptions.data();
 
-  VkPipelineInputAssemblyStateCreateInfo pipelineInputAssemblyStateCreateInfo{
-    VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO
-  };
-  pipelineInputAssemblyStateCreateInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  createInfo.inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 
-  VkPipelineViewportStateCreateInfo pipelineViewportStateCreateInfo{
-    VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO
-  };
-  pipelineViewportStateCreateInfo.viewportCount = 1u;
-  pipelineViewportStateCreateInfo.scissorCount = 1u;
+  createInfo.viewportState.viewportCount = 1u;
+  createInfo.viewportState.scissorCount = 1u;
 
-  VkPipelineRasterizationStateCreateInfo pipelineRasterizationStateCreateInfo{
-    VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO
-  };
+  VkPipelineRasterizationStateCreateInfo& pipelineRasterizationStateCreateInfo = createInfo.rasterizationState;
   pipelineRasterizationStateCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
   pipelineRasterizationStateCreateInfo.lineWidth = 1.0f;
   pipelineRasterizationStateCreateInfo.cullMode = pipelineData.cullMode;
 
-  VkPipelineMultisampleStateCreateInfo pipelineMultisampleStateCreateInfo{
-    VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO
-  };
-  pipelineMultisampleStateCreateInfo.rasterizationSamples = context->getMultisampleCount();
+  createInfo.multisampleState.rasterizationSamples = context->getMultisampleCount();
 
-  VkPipelineColorBlendStateCreateInfo pipelineColorBlendStateCreateInfo{
-    VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO
-  };
-  VkPipelineColorBlendAttachmentState pipelineColorBlendAttachmentState{};
+  VkPipelineColorBlendAttachmentState& pipelineColorBlendAttachmentState = createInfo.colorBlendAttachmentState;
   pipelineColorBlendAttachmentState.colorWriteMask =
     VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
   pipelineColorBlendAttachmentState.blendEnable = VK_TRUE;
@@ -113,61 +351,211 @@ Pipeline::Pipeline(const Context* context,
   pipelineColorBlendAttachmentState.dstAlphaBlendFactor = pipelineData.dstAlphaBlendFactor;
   pipelineColorBlendAttachmentState.alphaBlendOp = pipelineData.alphaBlendOp;
 
-  pipelineColorBlendStateCreateInfo.attachmentCount = 1;
-  pipelineColorBlendStateCreateInfo.pAttachments = &pipelineColorBlendAttachmentState;
+  // The depth prepass has no color attachment
+  createInfo.colorBlendState.attachmentCount = depthOnly ? 0u : 1u;
+  createInfo.colorBlendState.pAttachments = &pipelineColorBlendAttachmentState;
 
-  VkPipelineDynamicStateCreateInfo pipelineDynamicStateCreateInfo{
-    VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO
-  };
-  constexpr std::array dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
-  pipelineDynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
-  pipelineDynamicStateCreateInfo.pDynamicStates = dynamicStates.data();
+  createInfo.dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+  if (dynamicCullAndDepthState)
+  {
+    createInfo.dynamicStates.insert(createInfo.dynamicStates.end(),
+                                    { VK_DYNAMIC_STATE_CULL_MODE_EXT, VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT,
+                                      VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT, VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT });
+  }
+  if (dynamicBlendEquation)
+  {
+    createInfo.dynamicStates.push_back(VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT);
+  }
+  createInfo.dynamicState.dynamicStateCount = static_cast<uint32_t>(createInfo.dynamicStates.size());
+  createInfo.dynamicState.pDynamicStates = createInfo.dynamicStates.data();
 
-  VkPipelineDepthStencilStateCreateInfo pipelineDepthStencilStateCreateInfo{
-    VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO
-  };
-  pipelineDepthStencilStateCreateInfo.depthTestEnable = VK_TRUE;
-  pipelineDepthStencilStateCreateInfo.depthWriteEnable = VK_TRUE;
-  pipelineDepthStencilStateCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS;
+  createInfo.depthStencilState.depthTestEnable = VK_TRUE;
+  createInfo.depthStencilState.depthWriteEnable = pipelineData.depthWriteEnable;
+  createInfo.depthStencilState.depthCompareOp = pipelineData.depthCompareOp;
 
-  VkGraphicsPipelineCreateInfo graphicsPipelineCreateInfo{ VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+  VkGraphicsPipelineCreateInfo& graphicsPipelineCreateInfo = createInfo.graphicsPipelineCreateInfo;
   graphicsPipelineCreateInfo.layout = pipelineLayout;
-  graphicsPipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
-  graphicsPipelineCreateInfo.pStages = shaderStages.data();
+  graphicsPipelineCreateInfo.stageCount = shaderStageCount;
+  graphicsPipelineCreateInfo.pStages = createInfo.shaderStages.data();
   graphicsPipelineCreateInfo.pVertexInputState = &pipelineVertexInputStateCreateInfo;
-  graphicsPipelineCreateInfo.pInputAssemblyState = &pipelineInputAssemblyStateCreateInfo;
-  graphicsPipelineCreateInfo.pViewportState = &pipelineViewportStateCreateInfo;
+  graphicsPipelineCreateInfo.pInputAssemblyState = &createInfo.inputAssemblyState;
+  graphicsPipelineCreateInfo.pViewportState = &createInfo.viewportState;
   graphicsPipelineCreateInfo.pRasterizationState = &pipelineRasterizationStateCreateInfo;
-  graphicsPipelineCreateInfo.pMultisampleState = &pipelineMultisampleStateCreateInfo;
-  graphicsPipelineCreateInfo.pColorBlendState = &pipelineColorBlendStateCreateInfo;
-  graphicsPipelineCreateInfo.pDynamicState = &pipelineDynamicStateCreateInfo;
-  graphicsPipelineCreateInfo.pDepthStencilState = &pipelineDepthStencilStateCreateInfo;
+  graphicsPipelineCreateInfo.pMultisampleState = &createInfo.multisampleState;
+  graphicsPipelineCreateInfo.pColorBlendState = &createInfo.colorBlendState;
+  graphicsPipelineCreateInfo.pDynamicState = &createInfo.dynamicState;
+  graphicsPipelineCreateInfo.pDepthStencilState = &createInfo.depthStencilState;
   graphicsPipelineCreateInfo.renderPass = renderPass;
-  if (vkCreateGraphicsPipelines(device, nullptr, 1u, &graphicsPipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS)
+  graphicsPipelineCreateInfo.subpass = subpass;
+}
+
+bool Pipeline::compile()
+{
+  CreateInfo createInfo;
+  fillCreateInfo(createInfo);
+
+  VkPipeline newPipeline;
+  if (vkCreateGraphicsPipelines(context->getVkDevice(), context->getVkPipelineCache(), 1u,
+                                &createInfo.graphicsPipelineCreateInfo, nullptr, &newPipeline) != VK_SUCCESS)
   {
     util::error(Error::GenericVulkan);
     valid = false;
-    return;
+    return false;
   }
 
-  // These shader modules can now be destroyed
-  vkDestroyShaderModule(device, vertexShaderModule, nullptr);
-  vkDestroyShaderModule(device, fragmentShaderModule, nullptr);
-  valid = true;
+  swapIn(newPipeline, true);
+  return true;
 }
 
-Pipeline::~Pipeline()
+bool Pipeline::getLibraries(PipelineLibraryCache& libraryCache,
+                            bool compileMissing,
+                            std::array<VkPipeline, 4u>& libraries) const
 {
-  const VkDevice device = context->getVkDevice();
-  if (device && pipeline)
+  CreateInfo createInfo;
+  fillCreateInfo(createInfo);
+  const VkGraphicsPipelineCreateInfo& graphicsPipelineCreateInfo = createInfo.graphicsPipelineCreateInfo;
+
+  // Each part only depends on some of the state, which is what its key is made of. The render pass and the pipeline
+  // layout go into all of them. State that is dynamic is left at its defaults in the pipeline data.
+  PipelineLibraryCache::PartKey commonKey;
+  commonKey.append(&pipelineLayout, sizeof(pipelineLayout));
+  commonKey.append(&renderPass, sizeof(renderPass));
+  commonKey.append(&subpass, sizeof(subpass));
+
+  std::array<PipelineLibraryCache::PartKey, 4u> keys;
+  keys.fill(commonKey);
+
+  // The counts go in first, so that descriptions of different lengths never end up as the same bytes
+  PipelineLibraryCache::PartKey& vertexInputKey = keys.at(0u);
+  vertexInputKey.part = VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT;
+  const size_t bindingCount = vertexInputBindingDescriptions.size();
+  const size_t attributeCount = vertexInputAttributeDescriptions.size();
+  vertexInputKey.append(&bindingCount, sizeof(bindingCount));
+  vertexInputKey.append(&attributeCount, sizeof(attributeCount));
+  vertexInputKey.append(vertexInputBindingDescriptions.data(), bindingCount * sizeof(VkVertexInputBindingDescription));
+  vertexInputKey.append(vertexInputAttributeDescriptions.data(),
+                        attributeCount * sizeof(VkVertexInputAttributeDescription));
+
+  PipelineLibraryCache::PartKey& preRasterizationKey = keys.at(1u);
+  preRasterizationKey.part = VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT;
+  const ShaderLibrary::Handle vertShader = context->getShaderLibrary()->getHandle(vertShaderName);
+  preRasterizationKey.append(&vertShader, sizeof(vertShader));
+  preRasterizationKey.append(&pipelineData.specialization, sizeof(MaterialSpecialization));
+  preRasterizationKey.append(&pipelineData.cullMode, sizeof(pipelineData.cullMode));
+
+  PipelineLibraryCache::PartKey& fragmentShaderKey = keys.at(2u);
+  fragmentShaderKey.part = VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT;
+  const ShaderLibrary::Handle fragShader = context->getShaderLibrary()->getHandle(fragShaderName);
+  fragmentShaderKey.append(&fragShader, sizeof(fragShader));
+  fragmentShaderKey.append(&pipelineData.specialization, sizeof(MaterialSpecialization));
+  fragmentShaderKey.append(&pipelineData.depthWriteEnable, sizeof(pipelineData.depthWriteEnable));
+  fragmentShaderKey.append(&pipelineData.depthCompareOp, sizeof(pipelineData.depthCompareOp));
+
+  PipelineLibraryCache::PartKey& fragmentOutputKey = keys.at(3u);
+  fragmentOutputKey.part = VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT;
+  const bool depthOnly = fragShaderName.empty();
+  fragmentOutputKey.append(&depthOnly, sizeof(depthOnly));
+  fragmentOutputKey.append(&pipelineData.srcColorBlendFactor, sizeof(pipelineData.srcColorBlendFactor));
+  fragmentOutputKey.append(&pipelineData.dstColorBlendFactor, sizeof(pipelineData.dstColorBlendFactor));
+  fragmentOutputKey.append(&pipelineData.colorBlendOp, sizeof(pipelineData.colorBlendOp));
+  fragmentOutputKey.append(&pipelineData.srcAlphaBlendFactor, sizeof(pipelineData.srcAlphaBlendFactor));
+  fragmentOutputKey.append(&pipelineData.dstAlphaBlendFactor, sizeof(pipelineData.dstAlphaBlendFactor));
+  fragmentOutputKey.append(&pipelineData.alphaBlendOp, sizeof(pipelineData.alphaBlendOp));
+
+  for (size_t partIndex = 0u; partIndex < keys.size(); ++partIndex)
   {
-    vkDestroyPipeline(device, pipeline, nullptr);
+    const PipelineLibraryCache::PartKey& key = keys.at(partIndex);
+    libraries.at(partIndex) =
+      compileMissing ? libraryCache.getLibrary(key, graphicsPipelineCreateInfo) : libraryCache.findLibrary(key);
+  }
+
+  return std::find(libraries.begin(), libraries.end(), nullptr) == libraries.end();
+}
+
+bool Pipeline::compileLibraries(PipelineLibraryCache& libraryCache) const
+{
+  std::array<VkPipeline, 4u> libraries;
+  return getLibraries(libraryCache, true, libraries);
+}
+
+bool Pipeline::link(PipelineLibraryCache& libraryCache)
+{
+  std::array<VkPipeline, 4u> libraries;
+  if (!getLibraries(libraryCache, false, libraries))
+  {
+    return false;
+  }
+
+  // Linking without link time optimization is what makes it fast
+  VkPipelineLibraryCreateInfoKHR pipelineLibraryCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR };
+  pipelineLibraryCreateInfo.libraryCount = static_cast<uint32_t>(libraries.size());
+  pipelineLibraryCreateInfo.pLibraries = libraries.data();
+
+  VkGraphicsPipelineCreateInfo graphicsPipelineCreateInfo{ VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+  graphicsPipelineCreateInfo.pNext = &pipelineLibraryCreateInfo;
+  graphicsPipelineCreateInfo.layout = pipelineLayout;
+
+  VkPipeline linkedPipeline;
+  if (vkCreateGraphicsPipelines(context->getVkDevice(), context->getVkPipelineCache(), 1u, &graphicsPipelineCreateInfo,
+                                nullptr, &linkedPipeline) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    return false;
+  }
+
+  swapIn(linkedPipeline, false);
+  return true;
+}
+
+void Pipeline::setFallback(const Pipeline* fallback)
+{
+  this->fallback = fallback;
+}
+
+void Pipeline::swapIn(VkPipeline newPipeline, bool isOptimized)
+{
+  const VkPipeline previousPipeline = pipeline.exchange(newPipeline);
+  optimized = isOptimized;
+  if (previousPipeline)
+  {
+    const std::lock_guard<std::mutex> lock(replacedPipelinesMutex);
+    replacedPipelines.push_back(previousPipeline);
   }
 }
 
 void Pipeline::bindPipeline(VkCommandBuffer commandBuffer) const
 {
-  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  VkPipeline boundPipeline = pipeline.load();
+  if (!boundPipeline && fallback)
+  {
+    boundPipeline = fallback->pipeline.load();
+  }
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, boundPipeline);
+}
+
+void Pipeline::setDynamicState(VkCommandBuffer commandBuffer, const PipelineMaterialPayload& pipelineData) const
+{
+  const Context::ExtendedDynamicState& extendedDynamicState = context->getExtendedDynamicState();
+  if (dynamicCullAndDepthState)
+  {
+    extendedDynamicState.vkCmdSetCullModeEXT(commandBuffer, pipelineData.cullMode);
+    extendedDynamicState.vkCmdSetDepthTestEnableEXT(commandBuffer, VK_TRUE);
+    extendedDynamicState.vkCmdSetDepthWriteEnableEXT(commandBuffer, pipelineData.depthWriteEnable);
+    extendedDynamicState.vkCmdSetDepthCompareOpEXT(commandBuffer, pipelineData.depthCompareOp);
+  }
+
+  if (dynamicBlendEquation)
+  {
+    VkColorBlendEquationEXT colorBlendEquation;
+    colorBlendEquation.srcColorBlendFactor = pipelineData.srcColorBlendFactor;
+    colorBlendEquation.dstColorBlendFactor = pipelineData.dstColorBlendFactor;
+    colorBlendEquation.colorBlendOp = pipelineData.colorBlendOp;
+    colorBlendEquation.srcAlphaBlendFactor = pipelineData.srcAlphaBlendFactor;
+    colorBlendEquation.dstAlphaBlendFactor = pipelineData.dstAlphaBlendFactor;
+    colorBlendEquation.alphaBlendOp = pipelineData.alphaBlendOp;
+    extendedDynamicState.vkCmdSetColorBlendEquationEXT(commandBuffer, 0u, 1u, &colorBlendEquation);
+  }
 }
 
 bool Pipeline::isValid() const
@@ -175,6 +563,11 @@ bool Pipeline::isValid() const
   return valid;
 }
 
+bool Pipeline::isOptimized() const
+{
+  return optimized;
+}
+
 const std::string Pipeline::getVertShaderName() const{
   return vertShaderName;
 }
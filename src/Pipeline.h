@@ -1,8 +1,16 @@
 #pragma once
 
+#include "ShaderLibrary.h"
+
 #include <vulkan/vulkan.h>
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <glm/vec4.hpp>
@@ -10,9 +18,29 @@
 class Context;
 
 // [tdbe] uniform properties to bind to a material's shader.
-// properties need to be copied to DynamicVertexUniformData
+// properties need to be copied to RenderProcess::MaterialData
 struct DynamicMaterialUniformData{
 	glm::vec4 colorMultiplier = glm::vec4(1.0f);
+	uint32_t baseColorTexture = 0u; // Index returned by Renderer::addTexture(), 0 is plain white
+};
+
+// [tdbe] shader variant of a material. These are passed to the shaders as specialization constants
+// (layout(constant_id = ...)), so one shader source covers all variants and the driver still compiles each variant
+// without the code it doesn't use. Shaders that don't declare a constant ignore it.
+enum class VertexColorSource : uint32_t
+{
+  Vertex = 0u, // The color of the model's vertices, times the color multiplier
+  None = 1u    // Only the color multiplier
+};
+
+struct MaterialSpecialization{
+  VkBool32 alphaOutput = VK_FALSE;     // constant_id 0: output the alpha of the color multiplier, for blending
+  VkBool32 lightingEnabled = VK_TRUE;  // constant_id 1: unlit materials output their color as is
+  VertexColorSource vertexColorSource = VertexColorSource::Vertex; // constant_id 2
+  // constant_id 3: read the object data from the object table rather than push constants. The renderer sets this for
+  // its Renderer::ObjectDataSource, materials leave it alone.
+  VkBool32 objectDataFromTable = VK_TRUE;
+  bool operator==(const MaterialSpecialization& other) const = default;
 };
 
 // [tdbe] pipeline configurations for this pipeline / "material"
@@ -24,6 +52,10 @@ struct PipelineMaterialPayload{
 	VkBlendFactor dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
 	VkBlendOp alphaBlendOp = VK_BLEND_OP_ADD;
 	VkCullModeFlagBits cullMode = VkCullModeFlagBits::VK_CULL_MODE_BACK_BIT;
+	// [tdbe] the renderer switches opaque materials to EQUAL without depth writes when the depth prepass is enabled.
+	VkBool32 depthWriteEnable = VK_TRUE;
+	VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS;
+	MaterialSpecialization specialization = {};
   bool operator==(const PipelineMaterialPayload& other) const
   {
       return
@@ -39,14 +71,96 @@ struct PipelineMaterialPayload{
       &&
       (alphaBlendOp == other.alphaBlendOp)
       &&
-      (cullMode == other.cullMode);
+      (cullMode == other.cullMode)
+      &&
+      (depthWriteEnable == other.depthWriteEnable)
+      &&
+      (depthCompareOp == other.depthCompareOp)
+      &&
+      (specialization == other.specialization);
   }
+  // [tdbe] all of the above in 64 bits, for pipeline keys. Only the core blend ops fit, the advanced ones need an
+  // extension that isn't enabled anyway.
+  uint64_t pack() const;
+};
+
+// [tdbe] identifies a pipeline by its shaders and pipeline data, compact enough to be hashed and compared quickly.
+// Shaders are identified by their interned handle (see ShaderLibrary::getHandle()), so equal keys always mean the same
+// shader files.
+struct PipelineKey
+{
+  ShaderLibrary::Handle vertShader = 0u;
+  ShaderLibrary::Handle fragShader = 0u;
+  uint64_t pipelineData = 0u;
+
+  static PipelineKey create(ShaderLibrary& shaderLibrary,
+                            const std::string& vertShaderName,
+                            const std::string& fragShaderName,
+                            const PipelineMaterialPayload& pipelineData);
+
+  bool operator==(const PipelineKey& other) const = default;
+
+  struct Hash
+  {
+    size_t operator()(const PipelineKey& key) const;
+  };
+};
+
+/*
+ * [tdbe] With VK_EXT_graphics_pipeline_library, a pipeline can be linked from four separately compiled parts: the
+ * vertex input interface, the pre-rasterization shaders, the fragment shader and the fragment output interface. The
+ * library cache keeps each part around, keyed by the state it depends on, so a pipeline for a new material usually
+ * only compiles the parts that actually differ (e.g. just its blend state) and links the rest, which is fast. It is
+ * safe to use from several threads at once.
+ */
+class PipelineLibraryCache final
+{
+public:
+  // Identifies a part by all the state it depends on. The state is compared in full on lookup, not just its hash, so
+  // parts whose hashes collide never get mixed up.
+  struct PartKey
+  {
+    VkGraphicsPipelineLibraryFlagsEXT part = 0u;
+    std::vector<uint8_t> state;
+
+    void append(const void* data, size_t size);
+    bool operator==(const PartKey& other) const = default;
+
+    struct Hash
+    {
+      size_t operator()(const PartKey& key) const;
+    };
+  };
+
+  explicit PipelineLibraryCache(const Context* context);
+  ~PipelineLibraryCache();
+
+  // Returns the part of the pipeline described by 'createInfo' that 'key' names, compiling it unless there is one for
+  // 'key' already. If another thread is compiling the same part, it waits for that instead of compiling it twice. The
+  // key has to hold all state the part depends on. Returns nullptr on error.
+  VkPipeline getLibrary(const PartKey& key, const VkGraphicsPipelineCreateInfo& createInfo);
+  // Returns the part for 'key' if it is compiled already, nullptr otherwise. Never blocks on a compile.
+  VkPipeline findLibrary(const PartKey& key);
+
+private:
+  struct Library
+  {
+    VkPipeline pipeline = nullptr; // Null while compiling, and after an error
+    bool compiling = true;
+  };
+
+  const Context* context = nullptr;
+  std::unordered_map<PartKey, Library, PartKey::Hash> libraries;
+  std::mutex mutex;                          // Guards the libraries, but parts compile outside of it
+  std::condition_variable libraryCompiled;   // Signalled whenever a part is done compiling
 };
 
 /*
  * The pipeline class wraps a Vulkan pipeline for convenience. It describes the rendering technique to use, including
  * shaders, culling, scissoring (renderable area, similar to viewport (but changing the scissor rect won't affect coordinates), 
- * and other aspects.
+ * and other aspects. Leaving the fragment filename empty creates a depth-only pipeline.
+ * [tdbe] Constructing a pipeline only loads its shaders, the Vulkan pipeline is created by compile() or link(). A
+ * pipeline that is still compiling can bind a fallback pipeline in its place.
  */
 class Pipeline final
 {
@@ -54,6 +168,7 @@ public:
   Pipeline(const Context* context,
            VkPipelineLayout pipelineLayout,
            VkRenderPass renderPass,
+           uint32_t subpass,
            const std::string& vertexFilename,
            const std::string& fragmentFilename,
            const std::vector<VkVertexInputBindingDescription>& vertexInputBindingDescriptions,
@@ -62,9 +177,27 @@ public:
            );
   ~Pipeline();
 
+  // Creates the complete, optimized pipeline and swaps it in for whatever was bound so far. It blocks until done, but
+  // it is safe to call on another thread (e.g. the thread pool) while the pipeline is in use. Returns false on error.
+  bool compile();
+  // [tdbe] links the pipeline from its parts in the library cache, which is much faster than compile(), but the linked
+  // pipeline may run slower, so compile() should follow in the background. It never compiles parts itself, so it is
+  // cheap enough for the simulation thread. Returns false if a part isn't compiled yet, or on error.
+  bool link(PipelineLibraryCache& libraryCache);
+  // Compiles the parts of this pipeline into the library cache, so that pipelines that share them link quickly later
+  bool compileLibraries(PipelineLibraryCache& libraryCache) const;
+  // Binds 'fallback' in place of this pipeline until compile() or link() created it. Set it before the pipeline gets
+  // used on other threads.
+  void setFallback(const Pipeline* fallback);
+
   void bindPipeline(VkCommandBuffer commandBuffer) const;
+  // [tdbe] sets the parts of 'pipelineData' that this pipeline left dynamic (see Context::ExtendedDynamicState), the
+  // rest was baked in when the pipeline was created. Call it after binding the pipeline.
+  void setDynamicState(VkCommandBuffer commandBuffer, const PipelineMaterialPayload& pipelineData) const;
 
   bool isValid() const;
+  // False while the fallback or the linked pipeline is bound in its place
+  bool isOptimized() const;
 
   const std::string getVertShaderName() const;
   const std::string getFragShaderName() const;
@@ -73,10 +206,32 @@ public:
 private:
   std::string vertShaderName;
   std::string fragShaderName;
-  bool valid = false;
+  std::atomic<bool> valid = false;
 
   const Context* context = nullptr;
-  VkPipeline pipeline = nullptr;
+  VkPipelineLayout pipelineLayout = nullptr;
+  VkRenderPass renderPass = nullptr;
+  uint32_t subpass = 0u;
+  std::vector<VkVertexInputBindingDescription> vertexInputBindingDescriptions;
+  std::vector<VkVertexInputAttributeDescription> vertexInputAttributeDescriptions;
+  VkShaderModule vertexShaderModule = nullptr, fragmentShaderModule = nullptr;
+  bool dynamicCullAndDepthState = false, dynamicBlendEquation = false;
+  std::vector<ShaderLibrary::Handle> shaderHandles; // Shader library references, held for as long as the pipeline lives
+
+  std::atomic<VkPipeline> pipeline = nullptr; // The one that gets bound, swapped by compile()
+  std::atomic<bool> optimized = false;
+  const Pipeline* fallback = nullptr;
+  std::vector<VkPipeline> replacedPipelines; // Frames in flight may still use them, so they live as long as this does
+  std::mutex replacedPipelinesMutex;
 
   PipelineMaterialPayload pipelineData;
+
+  // The state of the pipeline, kept together since the create info points into it
+  struct CreateInfo;
+  void fillCreateInfo(CreateInfo& createInfo) const;
+  // Looks up the parts of the pipeline, compiling the missing ones only if 'compileMissing' is set
+  bool getLibraries(PipelineLibraryCache& libraryCache,
+                    bool compileMissing,
+                    std::array<VkPipeline, 4u>& libraries) const;
+  void swapIn(VkPipeline newPipeline, bool isOptimized);
 };
\ No newline at end of file
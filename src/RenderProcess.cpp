@@ -2,29 +2,28 @@
 
 #include "Context.h"
 #include "DataBuffer.h"
+#include "ImageBuffer.h"
+#include "Texture.h"
 #include "Util.h"
 
+#include <algorithm>
 #include <cstring>
 
+namespace
+{
+constexpr uint32_t gpuTimerQueryCount = static_cast<uint32_t>(GpuTimer::Count) * 2u;
+constexpr size_t initialMaterialCapacity = 16u;
+} // namespace
+
 RenderProcess::RenderProcess(const Context* context,
                              VkCommandPool commandPool,
                              VkDescriptorPool descriptorPool,
                              VkDescriptorSetLayout descriptorSetLayout,
-                             size_t gameObjectCount,
-                             size_t materialsCount
-                             )
+                             size_t gameObjectCount)
 : context(context)
 {
   // Initialize the uniform buffer data
-  dynamicVertexUniformData.resize(gameObjectCount);
-  for (size_t modelIndex = 0u; modelIndex < gameObjectCount; ++modelIndex)
-  {
-    dynamicVertexUniformData[modelIndex].worldMatrix = glm::mat4(1.0f);
-    dynamicVertexUniformData[modelIndex].colorMultiplier = glm::vec4(1.0f);
-  }
-
-  // Initialize the uniform buffer data
-   for (glm::mat4& viewProjectionMatrix : staticVertexUniformData.viewProjectionMatrices)
+  for (glm::mat4& viewProjectionMatrix : staticVertexUniformData.viewProjectionMatrices)
   {
     viewProjectionMatrix = glm::mat4(1.0f);
   }
@@ -71,24 +70,34 @@ RenderProcess::RenderProcess(const Context* context,
     return;
   }
 
+  // Create a query pool for the begin and end timestamps of the GPU timers
+  if (context->getTimestampPeriod() > 0.0f)
+  {
+    VkQueryPoolCreateInfo queryPoolCreateInfo{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+    queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolCreateInfo.queryCount = gpuTimerQueryCount;
+    if (vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &timestampQueryPool) != VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      valid = false;
+      return;
+    }
+  }
+
   const VkDeviceSize uniformBufferOffsetAlignment = context->getUniformBufferOffsetAlignment();
 
   // Partition the uniform buffer data
-  std::array<VkDescriptorBufferInfo, 3u> descriptorBufferInfos;
+  std::array<VkDescriptorBufferInfo, 2u> descriptorBufferInfos;
 
   descriptorBufferInfos.at(0u).offset = 0u;
-  descriptorBufferInfos.at(0u).range = sizeof(DynamicVertexUniformData);
+  descriptorBufferInfos.at(0u).range = sizeof(StaticVertexUniformData);
 
-  descriptorBufferInfos.at(1u).offset = util::align(descriptorBufferInfos.at(0u).range, uniformBufferOffsetAlignment) *
-                                        static_cast<VkDeviceSize>(gameObjectCount);
-  descriptorBufferInfos.at(1u).range = sizeof(StaticVertexUniformData);
-
-  descriptorBufferInfos.at(2u).offset = 
-    descriptorBufferInfos.at(1u).offset + util::align(descriptorBufferInfos.at(1u).range, uniformBufferOffsetAlignment);
-  descriptorBufferInfos.at(2u).range = sizeof(StaticFragmentUniformData);
+  descriptorBufferInfos.at(1u).offset =
+    descriptorBufferInfos.at(0u).offset + util::align(descriptorBufferInfos.at(0u).range, uniformBufferOffsetAlignment);
+  descriptorBufferInfos.at(1u).range = sizeof(StaticFragmentUniformData);
 
   // Create an empty uniform buffer
-  const VkDeviceSize uniformBufferSize = descriptorBufferInfos.at(2u).offset + descriptorBufferInfos.at(2u).range;
+  const VkDeviceSize uniformBufferSize = descriptorBufferInfos.at(1u).offset + descriptorBufferInfos.at(1u).range;
   uniformBuffer =
     new DataBuffer(context, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBufferSize);
@@ -126,15 +135,15 @@ RenderProcess::RenderProcess(const Context* context,
   }
 
   // Update the descriptor sets
-  std::array<VkWriteDescriptorSet, 3u> writeDescriptorSets;
+  std::array<VkWriteDescriptorSet, 2u> writeDescriptorSets;
 
   writeDescriptorSets.at(0u).sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
   writeDescriptorSets.at(0u).pNext = nullptr;
   writeDescriptorSets.at(0u).dstSet = descriptorSet;
-  writeDescriptorSets.at(0u).dstBinding = 0u;
+  writeDescriptorSets.at(0u).dstBinding = 1u;
   writeDescriptorSets.at(0u).dstArrayElement = 0u;
   writeDescriptorSets.at(0u).descriptorCount = 1u;
-  writeDescriptorSets.at(0u).descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  writeDescriptorSets.at(0u).descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
   writeDescriptorSets.at(0u).pBufferInfo = &descriptorBufferInfos.at(0u);
   writeDescriptorSets.at(0u).pImageInfo = nullptr;
   writeDescriptorSets.at(0u).pTexelBufferView = nullptr;
@@ -142,7 +151,7 @@ RenderProcess::RenderProcess(const Context* context,
   writeDescriptorSets.at(1u).sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
   writeDescriptorSets.at(1u).pNext = nullptr;
   writeDescriptorSets.at(1u).dstSet = descriptorSet;
-  writeDescriptorSets.at(1u).dstBinding = 1u;
+  writeDescriptorSets.at(1u).dstBinding = 2u;
   writeDescriptorSets.at(1u).dstArrayElement = 0u;
   writeDescriptorSets.at(1u).descriptorCount = 1u;
   writeDescriptorSets.at(1u).descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
@@ -150,23 +159,47 @@ RenderProcess::RenderProcess(const Context* context,
   writeDescriptorSets.at(1u).pImageInfo = nullptr;
   writeDescriptorSets.at(1u).pTexelBufferView = nullptr;
 
-  writeDescriptorSets.at(2u).sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  writeDescriptorSets.at(2u).pNext = nullptr;
-  writeDescriptorSets.at(2u).dstSet = descriptorSet;
-  writeDescriptorSets.at(2u).dstBinding = 2u;
-  writeDescriptorSets.at(2u).dstArrayElement = 0u;
-  writeDescriptorSets.at(2u).descriptorCount = 1u;
-  writeDescriptorSets.at(2u).descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  writeDescriptorSets.at(2u).pBufferInfo = &descriptorBufferInfos.at(2u);
-  writeDescriptorSets.at(2u).pImageInfo = nullptr;
-  writeDescriptorSets.at(2u).pTexelBufferView = nullptr;
-
   vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0u,
                          nullptr);
+
+  // Create the object buffer, big enough for the initial objects
+  if (!createObjectBuffer(std::max(gameObjectCount, size_t(1u))))
+  {
+    valid = false;
+    return;
+  }
+
+  if (!createMaterialBuffer(initialMaterialCapacity))
+  {
+    valid = false;
+    return;
+  }
 }
 
 RenderProcess::~RenderProcess()
 {
+  deleteIdleBuffers();
+
+  delete indirectBuffer;
+
+  if (drawBuffer)
+  {
+    drawBuffer->unmap();
+  }
+  delete drawBuffer;
+
+  if (materialBuffer)
+  {
+    materialBuffer->unmap();
+  }
+  delete materialBuffer;
+
+  if (objectBuffer)
+  {
+    objectBuffer->unmap();
+  }
+  delete objectBuffer;
+
   if (uniformBuffer)
   {
     uniformBuffer->unmap();
@@ -176,6 +209,11 @@ RenderProcess::~RenderProcess()
   const VkDevice device = context->getVkDevice();
   if (device)
   {
+    if (timestampQueryPool)
+    {
+      vkDestroyQueryPool(device, timestampQueryPool, nullptr);
+    }
+
     if (busyFence)
     {
       vkDestroyFence(device, busyFence, nullptr);
@@ -223,6 +261,363 @@ VkDescriptorSet RenderProcess::getDescriptorSet() const
   return descriptorSet;
 }
 
+VkBuffer RenderProcess::getIndirectBuffer() const
+{
+  return indirectBuffer ? indirectBuffer->getBuffer() : nullptr;
+}
+
+size_t RenderProcess::getDrawCapacity() const
+{
+  return objectBufferCapacity;
+}
+
+bool RenderProcess::reserveObjectData(size_t gameObjectCount)
+{
+  if (gameObjectCount <= objectBufferCapacity)
+  {
+    return true;
+  }
+
+  // The object buffer has to be replaced, so wait until this frame in flight is no longer using it. Other frames in
+  // flight have their own object buffer and grow it when it is their turn again.
+  if (!waitUntilIdle())
+  {
+    return false;
+  }
+
+  // Grow geometrically so that spawning objects one by one doesn't reallocate every frame
+  return createObjectBuffer(std::max(gameObjectCount, objectBufferCapacity * 2u));
+}
+
+bool RenderProcess::reserveMaterialData(size_t materialCount)
+{
+  if (materialCount <= uploadedMaterials.size())
+  {
+    return true;
+  }
+
+  if (!waitUntilIdle())
+  {
+    return false;
+  }
+
+  return createMaterialBuffer(std::max(materialCount, uploadedMaterials.size() * 2u));
+}
+
+bool RenderProcess::waitUntilIdle() const
+{
+  const VkFence fence = busyFence;
+  if (vkWaitForFences(context->getVkDevice(), 1u, &fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    return false;
+  }
+
+  return true;
+}
+
+bool RenderProcess::createObjectBuffer(size_t capacity)
+{
+  // Create an empty object buffer, its entries are tightly packed without any alignment padding
+  const VkDeviceSize objectBufferSize =
+    static_cast<VkDeviceSize>(sizeof(ObjectData)) * static_cast<VkDeviceSize>(capacity);
+  DataBuffer* newObjectBuffer =
+    new DataBuffer(context, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, objectBufferSize);
+  if (!newObjectBuffer->isValid())
+  {
+    delete newObjectBuffer;
+    return false;
+  }
+
+  // Map the object buffer memory
+  void* newObjectBufferMemory = newObjectBuffer->map();
+  if (!newObjectBufferMemory)
+  {
+    delete newObjectBuffer;
+    return false;
+  }
+
+  // The draw list and the indirect draw commands never hold more draws than there are objects, so they grow along
+  const VkDeviceSize drawBufferSize = static_cast<VkDeviceSize>(sizeof(DrawData)) * static_cast<VkDeviceSize>(capacity);
+  DataBuffer* newDrawBuffer =
+    new DataBuffer(context, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, drawBufferSize);
+  void* newDrawBufferMemory = newDrawBuffer->isValid() ? newDrawBuffer->map() : nullptr;
+  if (!newDrawBufferMemory)
+  {
+    delete newDrawBuffer;
+    newObjectBuffer->unmap();
+    delete newObjectBuffer;
+    return false;
+  }
+
+  // Only ever written by the culling compute shader, so it can live in device local memory
+  const VkDeviceSize indirectBufferSize =
+    static_cast<VkDeviceSize>(sizeof(VkDrawIndexedIndirectCommand)) * static_cast<VkDeviceSize>(capacity * 2u);
+  DataBuffer* newIndirectBuffer =
+    new DataBuffer(context, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indirectBufferSize);
+  if (!newIndirectBuffer->isValid())
+  {
+    delete newIndirectBuffer;
+    newDrawBuffer->unmap();
+    delete newDrawBuffer;
+    newObjectBuffer->unmap();
+    delete newObjectBuffer;
+    return false;
+  }
+
+  // Point the descriptor set to the new buffers
+  std::array<VkDescriptorBufferInfo, 3u> descriptorBufferInfos;
+  descriptorBufferInfos.at(0u).buffer = newObjectBuffer->getBuffer();
+  descriptorBufferInfos.at(1u).buffer = newDrawBuffer->getBuffer();
+  descriptorBufferInfos.at(2u).buffer = newIndirectBuffer->getBuffer();
+
+  constexpr std::array<uint32_t, 3u> bindings = { 0u, 3u, 4u };
+  std::array<VkWriteDescriptorSet, 3u> writeDescriptorSets;
+  for (size_t index = 0u; index < writeDescriptorSets.size(); ++index)
+  {
+    descriptorBufferInfos.at(index).offset = 0u;
+    descriptorBufferInfos.at(index).range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet& writeDescriptorSet = writeDescriptorSets.at(index);
+    writeDescriptorSet = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    writeDescriptorSet.dstSet = descriptorSet;
+    writeDescriptorSet.dstBinding = bindings.at(index);
+    writeDescriptorSet.dstArrayElement = 0u;
+    writeDescriptorSet.descriptorCount = 1u;
+    writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptorSet.pBufferInfo = &descriptorBufferInfos.at(index);
+  }
+  vkUpdateDescriptorSets(context->getVkDevice(), static_cast<uint32_t>(writeDescriptorSets.size()),
+                         writeDescriptorSets.data(), 0u, nullptr);
+
+  // Release the old buffers
+  delete indirectBuffer;
+
+  if (drawBuffer)
+  {
+    drawBuffer->unmap();
+  }
+  delete drawBuffer;
+
+  if (objectBuffer)
+  {
+    objectBuffer->unmap();
+  }
+  delete objectBuffer;
+
+  objectBuffer = newObjectBuffer;
+  objectBufferMemory = newObjectBufferMemory;
+  objectBufferCapacity = capacity;
+  drawBuffer = newDrawBuffer;
+  drawBufferMemory = newDrawBufferMemory;
+  indirectBuffer = newIndirectBuffer;
+
+  // The new object buffer starts off empty, so every entry has to be uploaded again
+  uploadedObjects.assign(capacity, UploadedObject());
+  return true;
+}
+
+bool RenderProcess::createMaterialBuffer(size_t capacity)
+{
+  const VkDeviceSize materialBufferSize =
+    static_cast<VkDeviceSize>(sizeof(MaterialData)) * static_cast<VkDeviceSize>(capacity);
+  DataBuffer* newMaterialBuffer =
+    new DataBuffer(context, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, materialBufferSize);
+  void* newMaterialBufferMemory = newMaterialBuffer->isValid() ? newMaterialBuffer->map() : nullptr;
+  if (!newMaterialBufferMemory)
+  {
+    delete newMaterialBuffer;
+    return false;
+  }
+
+  // Point the descriptor set to the new buffer
+  VkDescriptorBufferInfo descriptorBufferInfo;
+  descriptorBufferInfo.buffer = newMaterialBuffer->getBuffer();
+  descriptorBufferInfo.offset = 0u;
+  descriptorBufferInfo.range = VK_WHOLE_SIZE;
+
+  VkWriteDescriptorSet writeDescriptorSet{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+  writeDescriptorSet.dstSet = descriptorSet;
+  writeDescriptorSet.dstBinding = 5u;
+  writeDescriptorSet.dstArrayElement = 0u;
+  writeDescriptorSet.descriptorCount = 1u;
+  writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  writeDescriptorSet.pBufferInfo = &descriptorBufferInfo;
+  vkUpdateDescriptorSets(context->getVkDevice(), 1u, &writeDescriptorSet, 0u, nullptr);
+
+  // Release the old buffer
+  if (materialBuffer)
+  {
+    materialBuffer->unmap();
+  }
+  delete materialBuffer;
+
+  materialBuffer = newMaterialBuffer;
+  materialBufferMemory = newMaterialBufferMemory;
+
+  // The new material table starts off empty, so every entry has to be uploaded again
+  uploadedMaterials.assign(capacity, UploadedMaterial());
+  return true;
+}
+
+size_t RenderProcess::updateObjectData(const std::vector<GameObjectSnapshot>& gameObjects)
+{
+  if (!objectBufferMemory || gameObjects.size() > uploadedObjects.size())
+  {
+    return 0u;
+  }
+
+  // Only write the entries that are out of date. The object buffer is write-combined memory, so entries are written
+  // whole and never read back.
+  ObjectData* objectData = static_cast<ObjectData*>(objectBufferMemory);
+  size_t uploadCount = 0u;
+  for (size_t goIndex = 0u; goIndex < gameObjects.size(); ++goIndex)
+  {
+    const GameObjectSnapshot& gameObject = gameObjects.at(goIndex);
+    UploadedObject& uploadedObject = uploadedObjects.at(goIndex);
+    if (uploadedObject.gameObject == gameObject.gameObject && uploadedObject.gameObjectVersion == gameObject.version &&
+        uploadedObject.materialIndex == gameObject.materialIndex)
+    {
+      continue;
+    }
+
+    ObjectData entry;
+    entry.worldMatrix = gameObject.worldMatrix;
+    entry.materialIndex = gameObject.materialIndex;
+    memcpy(&objectData[goIndex], &entry, sizeof(ObjectData));
+
+    uploadedObject.gameObject = gameObject.gameObject;
+    uploadedObject.gameObjectVersion = gameObject.version;
+    uploadedObject.materialIndex = gameObject.materialIndex;
+    ++uploadCount;
+  }
+
+  return uploadCount;
+}
+
+size_t RenderProcess::updateMaterialData(const std::vector<MaterialSnapshot>& materials)
+{
+  if (!materialBufferMemory || materials.size() > uploadedMaterials.size())
+  {
+    return 0u;
+  }
+
+  // Like the object buffer, the material table is write-combined memory, so entries are written whole
+  MaterialData* materialData = static_cast<MaterialData*>(materialBufferMemory);
+  size_t uploadCount = 0u;
+  for (size_t materialIndex = 0u; materialIndex < materials.size(); ++materialIndex)
+  {
+    const MaterialSnapshot& material = materials.at(materialIndex);
+    UploadedMaterial& uploadedMaterial = uploadedMaterials.at(materialIndex);
+    if (!material.material ||
+        (uploadedMaterial.material == material.material && uploadedMaterial.version == material.version))
+    {
+      continue;
+    }
+
+    MaterialData entry;
+    entry.colorMultiplier = material.materialData.colorMultiplier;
+    entry.baseColorTexture = material.materialData.baseColorTexture;
+    memcpy(&materialData[materialIndex], &entry, sizeof(MaterialData));
+
+    uploadedMaterial.material = material.material;
+    uploadedMaterial.version = material.version;
+    ++uploadCount;
+  }
+
+  return uploadCount;
+}
+
+void RenderProcess::updateTextureDescriptors(const std::vector<Texture*>& textures, VkSampler sampler)
+{
+  if (boundImageViews.size() < textures.size())
+  {
+    boundImageViews.resize(textures.size(), nullptr);
+  }
+
+  // Only added textures and the ones streaming changed since the previous frame of this render process need writing
+  std::vector<VkDescriptorImageInfo> descriptorImageInfos;
+  std::vector<uint32_t> textureIndices;
+  for (size_t textureIndex = 0u; textureIndex < textures.size(); ++textureIndex)
+  {
+    // A texture whose mip tail failed to upload has no image, it shows texture 0 (plain white) instead
+    VkImageView imageView = textures.at(textureIndex)->getImageView();
+    if (!imageView)
+    {
+      imageView = textures.at(0u)->getImageView();
+    }
+
+    if (!imageView || boundImageViews.at(textureIndex) == imageView)
+    {
+      continue;
+    }
+
+    VkDescriptorImageInfo descriptorImageInfo;
+    descriptorImageInfo.sampler = sampler;
+    descriptorImageInfo.imageView = imageView;
+    descriptorImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    descriptorImageInfos.push_back(descriptorImageInfo);
+    textureIndices.push_back(static_cast<uint32_t>(textureIndex));
+    boundImageViews.at(textureIndex) = imageView;
+  }
+
+  if (descriptorImageInfos.empty())
+  {
+    return;
+  }
+
+  // The image infos are complete by now, so they don't move anymore while the writes point into them
+  std::vector<VkWriteDescriptorSet> writeDescriptorSets(descriptorImageInfos.size());
+  for (size_t writeIndex = 0u; writeIndex < writeDescriptorSets.size(); ++writeIndex)
+  {
+    VkWriteDescriptorSet& writeDescriptorSet = writeDescriptorSets.at(writeIndex);
+    writeDescriptorSet = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    writeDescriptorSet.dstSet = descriptorSet;
+    writeDescriptorSet.dstBinding = 6u;
+    writeDescriptorSet.dstArrayElement = textureIndices.at(writeIndex);
+    writeDescriptorSet.descriptorCount = 1u;
+    writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writeDescriptorSet.pImageInfo = &descriptorImageInfos.at(writeIndex);
+  }
+  vkUpdateDescriptorSets(context->getVkDevice(), static_cast<uint32_t>(writeDescriptorSets.size()),
+                         writeDescriptorSets.data(), 0u, nullptr);
+}
+
+void RenderProcess::deleteWhenIdle(ImageBuffer* imageBuffer)
+{
+  if (imageBuffer)
+  {
+    idleImageBuffers.push_back(imageBuffer);
+  }
+}
+
+void RenderProcess::deleteWhenIdle(DataBuffer* dataBuffer)
+{
+  if (dataBuffer)
+  {
+    idleDataBuffers.push_back(dataBuffer);
+  }
+}
+
+void RenderProcess::deleteIdleBuffers()
+{
+  for (const ImageBuffer* imageBuffer : idleImageBuffers)
+  {
+    delete imageBuffer;
+  }
+  idleImageBuffers.clear();
+
+  for (const DataBuffer* dataBuffer : idleDataBuffers)
+  {
+    delete dataBuffer;
+  }
+  idleDataBuffers.clear();
+}
+
 void RenderProcess::updateUniformBufferData() const
 {
   if (!uniformBufferMemory)
@@ -233,14 +628,7 @@ void RenderProcess::updateUniformBufferData() const
   const VkDeviceSize uniformBufferOffsetAlignment = context->getUniformBufferOffsetAlignment();
 
   char* offset = static_cast<char*>(uniformBufferMemory);
-  VkDeviceSize length = sizeof(DynamicVertexUniformData);
-  for (const DynamicVertexUniformData& dynamicData : dynamicVertexUniformData)
-  {
-    memcpy(offset, &dynamicData, length);
-    offset += util::align(length, uniformBufferOffsetAlignment);
-  }
-
-  length = sizeof(StaticVertexUniformData);
+  VkDeviceSize length = sizeof(StaticVertexUniformData);
   memcpy(offset, &staticVertexUniformData, length);
   offset += util::align(length, uniformBufferOffsetAlignment);
 
@@ -248,4 +636,125 @@ void RenderProcess::updateUniformBufferData() const
   memcpy(offset, &staticFragmentUniformData, length);
   offset += util::align(length, uniformBufferOffsetAlignment);
 
-}
\ No newline at end of file
+}
+
+void RenderProcess::updateViewProjectionUniformData() const
+{
+  if (!uniformBufferMemory)
+  {
+    return;
+  }
+
+  // The static vertex uniform data comes first in the uniform buffer
+  memcpy(uniformBufferMemory, &staticVertexUniformData, sizeof(StaticVertexUniformData));
+}
+
+void RenderProcess::setDrawData(size_t drawIndex, const DrawData& drawData) const
+{
+  if (!drawBufferMemory || drawIndex >= objectBufferCapacity)
+  {
+    return;
+  }
+
+  memcpy(static_cast<DrawData*>(drawBufferMemory) + drawIndex, &drawData, sizeof(DrawData));
+}
+
+void RenderProcess::writeFrameBeginTimestamp()
+{
+  if (!timestampQueryPool)
+  {
+    return;
+  }
+
+  // Resets the queries of the other timers as well, they are written in between
+  vkCmdResetQueryPool(commandBuffer, timestampQueryPool, 0u, gpuTimerQueryCount);
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, 0u);
+  writtenGpuTimers = 0u;
+}
+
+void RenderProcess::writeFrameEndTimestamp()
+{
+  if (!timestampQueryPool)
+  {
+    return;
+  }
+
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, 1u);
+  timestampsPending = true;
+}
+
+bool RenderProcess::readGpuFrameTime(float& milliseconds)
+{
+  if (!timestampsPending)
+  {
+    return false;
+  }
+
+  // Without the wait flag this returns VK_NOT_READY instead of blocking when the GPU isn't done yet
+  std::array<uint64_t, 2u> timestamps;
+  if (vkGetQueryPoolResults(context->getVkDevice(), timestampQueryPool, 0u, 2u, sizeof(timestamps), timestamps.data(),
+                            sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+  {
+    return false;
+  }
+
+  timestampsPending = false;
+  const double nanoseconds = static_cast<double>(timestamps.at(1u) - timestamps.at(0u)) * context->getTimestampPeriod();
+  milliseconds = static_cast<float>(nanoseconds / 1e6);
+  return true;
+}
+
+void RenderProcess::beginGpuTimer(GpuTimer timer) const
+{
+  if (!timestampQueryPool)
+  {
+    return;
+  }
+
+  const uint32_t query = static_cast<uint32_t>(timer) * 2u;
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, query);
+}
+
+void RenderProcess::endGpuTimer(GpuTimer timer)
+{
+  if (!timestampQueryPool)
+  {
+    return;
+  }
+
+  const uint32_t query = static_cast<uint32_t>(timer) * 2u + 1u;
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, query);
+  writtenGpuTimers |= 1u << static_cast<uint32_t>(timer);
+}
+
+bool RenderProcess::readGpuTimers(GpuProfiler& gpuProfiler)
+{
+  if (writtenGpuTimers == 0u)
+  {
+    return false;
+  }
+
+  // Without the wait flag the results are VK_NOT_READY instead of blocking, the timers stay pending then
+  const VkDevice device = context->getVkDevice();
+  const double timestampPeriod = static_cast<double>(context->getTimestampPeriod());
+  for (uint32_t timerIndex = 0u; timerIndex < static_cast<uint32_t>(GpuTimer::Count); ++timerIndex)
+  {
+    if (!(writtenGpuTimers & (1u << timerIndex)))
+    {
+      continue;
+    }
+
+    std::array<uint64_t, 2u> timestamps;
+    if (vkGetQueryPoolResults(device, timestampQueryPool, timerIndex * 2u, 2u, sizeof(timestamps), timestamps.data(),
+                              sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+    {
+      return false;
+    }
+
+    const double nanoseconds = static_cast<double>(timestamps.at(1u) - timestamps.at(0u)) * timestampPeriod;
+    gpuProfiler.addSample(static_cast<GpuTimer>(timerIndex), static_cast<float>(nanoseconds / 1e6));
+    writtenGpuTimers &= ~(1u << timerIndex);
+  }
+
+  return true;
+}
@@ -8,9 +8,12 @@
 #include <vector>
 
 #include "GameData.h"
+#include "GpuProfiler.h"
 
 class Context;
 class DataBuffer;
+class ImageBuffer;
+class Texture;
 
 /*
  * The render process class consolidates all the resources that needs to be duplicated for each frame that can be
@@ -19,8 +22,9 @@ class DataBuffer;
  * duplication, the application can be sure that one frame does not modify a resource that is still in use by another
  * simultaneous frame.
  * 
- * [tdbe] TODO: We should create descriptor sets (the main way of connecting CPU data to the GPU), per-material, 
- * to also be able to push different (texture) data per gameobject/mat. (vkCmdPushConstants is a limited alternative.)
+ * [tdbe] There are no per-material descriptor sets. The one descriptor set of each render process holds the object
+ * table, the material table and an array of all textures, and materials refer to their textures by index, so drawing
+ * a textured material doesn't bind anything extra.
  */
 class RenderProcess final
 {
@@ -29,20 +33,40 @@ public:
                 VkCommandPool commandPool,
                 VkDescriptorPool descriptorPool,
                 VkDescriptorSetLayout descriptorSetLayout,
-                size_t gameObjectCount,
-                size_t materialsCount
-                );
+                size_t gameObjectCount);
   ~RenderProcess();
 
-  // [tdbe] uniform properties to bind to per model.
-  // Also the per-material properties get sent here.
-  struct DynamicVertexUniformData{
-    // per model/mesh
+  // [tdbe] per model/mesh properties, stored in a tightly packed storage buffer (std430) that shaders index with
+  // gl_InstanceIndex. The renderer draws each model with its object index as the first instance.
+  struct ObjectData
+  {
     glm::mat4 worldMatrix = glm::mat4(1.0f);
-    // "per material" (ie it doesn't -need- to be unique per model/mesh)
+    uint32_t materialIndex = 0u; // Into the material table
+    std::array<uint32_t, 3u> padding = { 0u, 0u, 0u }; // std430 pads the struct to the alignment of the matrix
+  };
+
+  // [tdbe] per material properties, stored in the material table, a storage buffer (std430) that shaders index with
+  // the material index of the object. Objects share the entry of their material, so a material change is a single
+  // write, however many objects use it.
+  struct MaterialData
+  {
     glm::vec4 colorMultiplier = glm::vec4(1.0f);
+    uint32_t baseColorTexture = 0u; // Into the texture array
+    std::array<uint32_t, 3u> padding = { 0u, 0u, 0u };
   };
-  std::vector<DynamicVertexUniformData> dynamicVertexUniformData;
+
+  // One entry per draw of the frame, in draw order (opaque queue, then transparent queue). The occlusion culling compute
+  // shader tests the bounds and writes an indirect draw command for each entry.
+  struct DrawData
+  {
+    glm::vec4 boundsCenter = glm::vec4(0.0f);  // Local space, w unused
+    glm::vec4 boundsExtents = glm::vec4(0.0f); // Local space half size, w unused
+    uint32_t objectIndex = 0u;
+    uint32_t firstIndex = 0u;
+    uint32_t indexCount = 0u;
+    uint32_t flags = 0u; // See drawDataFlagOpaque
+  };
+  static constexpr uint32_t drawDataFlagOpaque = 1u;
 
   // [tdbe] uniform properties available globally
   struct StaticVertexUniformData
@@ -62,8 +86,57 @@ public:
   VkSemaphore getPresentableSemaphore() const;
   VkFence getBusyFence() const;
   VkDescriptorSet getDescriptorSet() const;
+  // Holds two indirect draw commands per draw, the first phase of occlusion culling writes them at
+  // [0, getDrawCapacity()), the second phase at [getDrawCapacity(), 2 * getDrawCapacity())
+  VkBuffer getIndirectBuffer() const;
+  size_t getDrawCapacity() const;
 
+  // Blocks until the GPU is done with the previous frame of this render process, i.e. its busy fence is signaled.
+  // Returns false on error.
+  bool waitUntilIdle() const;
+  // Grows the object buffer if it can't hold that many objects. Must be called before the busy fence gets reset,
+  // growing waits for this render process to finish its previous frame.
+  bool reserveObjectData(size_t gameObjectCount);
+  // Copies the object data of the game objects that changed since this render process last uploaded them, returns the
+  // number of entries written.
+  size_t updateObjectData(const std::vector<GameObjectSnapshot>& gameObjects);
+  // Grows the material table if it can't hold that many materials, same as reserveObjectData()
+  bool reserveMaterialData(size_t materialCount);
+  // Copies the entries of the material table that changed since this render process last uploaded them, returns the
+  // number of entries written.
+  size_t updateMaterialData(const std::vector<MaterialSnapshot>& materials);
+  // Points the elements of the texture array whose image view changed since this render process last wrote them to
+  // their textures, sampled with 'sampler'. Streaming swaps the image views of textures (see TextureStreamer.h). The
+  // GPU must be done with the previous frame of this render process (see waitUntilIdle()).
+  void updateTextureDescriptors(const std::vector<Texture*>& textures, VkSampler sampler);
+  // Takes ownership of buffers that the commands of the current frame or earlier frames still use, they get deleted
+  // once this render process is idle again, i.e. after the GPU is done with all frames up to the current one
+  void deleteWhenIdle(ImageBuffer* imageBuffer);
+  void deleteWhenIdle(DataBuffer* dataBuffer);
+  // Deletes what was passed to deleteWhenIdle() during the previous frame of this render process, call it after
+  // waitUntilIdle()
+  void deleteIdleBuffers();
   void updateUniformBufferData() const;
+  // Copies only the static vertex uniform data (the view projection matrices) into the uniform buffer
+  void updateViewProjectionUniformData() const;
+  // Writes an entry of the draw list for occlusion culling, it can't hold more draws than objects
+  void setDrawData(size_t drawIndex, const DrawData& drawData) const;
+
+  // Timestamps around the whole command buffer, to measure how long the GPU took for the frame. Only available if the
+  // device supports timestamps.
+  void writeFrameBeginTimestamp();
+  void writeFrameEndTimestamp();
+  // Doesn't wait for the GPU, returns false if the previous frame of this render process hasn't finished yet (or was
+  // already read)
+  bool readGpuFrameTime(float& milliseconds);
+  // Timestamps around parts of the frame, in between the frame timestamps and outside of any render pass. They share
+  // the query pool of the frame timestamps, each timer gets a begin and an end query. GpuTimer::Frame is the frame
+  // timestamps above.
+  void beginGpuTimer(GpuTimer timer) const;
+  void endGpuTimer(GpuTimer timer);
+  // Adds the timers of the parts of the previous frame of this render process to the profiler, same as
+  // readGpuFrameTime(). Returns false if there was nothing to read.
+  bool readGpuTimers(GpuProfiler& gpuProfiler);
 
 private:
   bool valid = true;
@@ -72,7 +145,42 @@ private:
   VkCommandBuffer commandBuffer = nullptr;
   VkSemaphore drawableSemaphore = nullptr, presentableSemaphore = nullptr;
   VkFence busyFence = nullptr;
+  VkQueryPool timestampQueryPool = nullptr;
+  bool timestampsPending = false;
+  uint32_t writtenGpuTimers = 0u; // One bit per timer, the ones the previous frame wrote
   DataBuffer* uniformBuffer = nullptr;
   void* uniformBufferMemory = nullptr;
+  DataBuffer* objectBuffer = nullptr;
+  void* objectBufferMemory = nullptr;
+  size_t objectBufferCapacity = 0u;
+  DataBuffer* materialBuffer = nullptr;
+  void* materialBufferMemory = nullptr;
+  DataBuffer* drawBuffer = nullptr;
+  void* drawBufferMemory = nullptr;
+  DataBuffer* indirectBuffer = nullptr;
   VkDescriptorSet descriptorSet = nullptr;
+
+  // What was last written to each entry of the object buffer, compared against to find the entries that changed
+  struct UploadedObject
+  {
+    const GameObject* gameObject = nullptr;
+    uint64_t gameObjectVersion = 0u;
+    uint32_t materialIndex = 0u;
+  };
+  std::vector<UploadedObject> uploadedObjects;
+
+  // Same for each entry of the material table
+  struct UploadedMaterial
+  {
+    const Material* material = nullptr;
+    uint64_t version = 0u;
+  };
+  std::vector<UploadedMaterial> uploadedMaterials; // One per entry, so its size is the capacity of the material table
+
+  std::vector<VkImageView> boundImageViews; // What each element of the texture array was last written with
+  std::vector<ImageBuffer*> idleImageBuffers;
+  std::vector<DataBuffer*> idleDataBuffers;
+
+  bool createObjectBuffer(size_t capacity);
+  bool createMaterialBuffer(size_t capacity);
 };
\ No newline at end of file
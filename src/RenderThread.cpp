@@ -0,0 +1,89 @@
+#include "RenderThread.h"
+
+#include "CpuProfiler.h"
+
+RenderThread::RenderThread(const RenderFunction& renderFunction) : renderFunction(renderFunction)
+{
+  thread = std::thread(&RenderThread::run, this);
+}
+
+RenderThread::~RenderThread()
+{
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    stopRequested = true;
+  }
+  condition.notify_all();
+
+  if (thread.joinable())
+  {
+    thread.join();
+  }
+}
+
+RenderThread::FrameData& RenderThread::getSimulationFrame()
+{
+  return frames.at(simulationFrameIndex);
+}
+
+bool RenderThread::submitFrame()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  framesSubmitted.at(simulationFrameIndex) = true;
+  condition.notify_all();
+
+  simulationFrameIndex = (simulationFrameIndex + 1u) % frames.size();
+  condition.wait(lock, [this] { return !framesSubmitted.at(simulationFrameIndex) || !valid; });
+  return valid;
+}
+
+void RenderThread::flush()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  condition.wait(lock, [this] { return (!framesSubmitted.at(0u) && !framesSubmitted.at(1u)) || !valid; });
+}
+
+bool RenderThread::isValid() const
+{
+  const std::lock_guard<std::mutex> lock(mutex);
+  return valid;
+}
+
+void RenderThread::run()
+{
+  profiler::setThreadName("Render");
+
+  // Frames are rendered in the order they were submitted, which alternates between the two
+  size_t renderFrameIndex = 0u;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [this, renderFrameIndex] { return framesSubmitted.at(renderFrameIndex) || stopRequested; });
+      if (!framesSubmitted.at(renderFrameIndex))
+      {
+        return; // Stop requested with nothing left to render
+      }
+    }
+
+    // The simulation thread leaves this frame alone until it is marked as rendered below
+    const bool success = renderFunction(frames.at(renderFrameIndex));
+
+    {
+      const std::lock_guard<std::mutex> lock(mutex);
+      framesSubmitted.at(renderFrameIndex) = false;
+      if (!success)
+      {
+        valid = false;
+      }
+    }
+    condition.notify_all();
+
+    if (!success)
+    {
+      return;
+    }
+
+    renderFrameIndex = (renderFrameIndex + 1u) % frames.size();
+  }
+}
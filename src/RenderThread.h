@@ -0,0 +1,61 @@
+#pragma once
+
+#include "GameData.h"
+#include "Headset.h"
+
+#include <array>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*
+ * The render thread class runs the second stage of a two-stage frame pipeline. The simulation thread (the main thread)
+ * waits for a headset frame, runs the game mechanics and fills in a frame with an immutable snapshot of the scene, then
+ * hands it over and goes on to simulate the next frame while the render thread records and submits the previous one.
+ * Frames are double buffered, so each thread works on a frame of its own and the simulation never runs more than one
+ * frame ahead.
+ */
+class RenderThread final
+{
+public:
+  // Everything the render thread needs for a frame. The simulation thread only writes it before submitting it.
+  struct FrameData
+  {
+    Headset::Frame headsetFrame;
+    bool render = false;    // False for frames that only get begun and ended (see Headset::FrameResult::SkipRender)
+    SceneSnapshot scene;    // Only captured for frames that get rendered
+    float deltaTime = 0.0f; // Of the simulation, in seconds
+  };
+
+  // Called on the render thread for each submitted frame, returning false stops the render thread
+  using RenderFunction = std::function<bool(const FrameData& frame)>;
+
+  RenderThread(const RenderFunction& renderFunction);
+  ~RenderThread(); // Renders the frames that were already submitted, then joins the thread
+
+  // The frame for the simulation thread to fill in, the render thread is done with it
+  FrameData& getSimulationFrame();
+  // Hands the simulation frame to the render thread, then waits until the render thread is done with the other frame,
+  // which becomes the next simulation frame. Returns false if the render thread stopped on an error.
+  bool submitFrame();
+  // Waits until the render thread is done with all submitted frames
+  void flush();
+
+  bool isValid() const;
+
+private:
+  bool valid = true;
+
+  RenderFunction renderFunction;
+  std::array<FrameData, 2u> frames;
+  std::array<bool, 2u> framesSubmitted = { false, false }; // Handed over but not rendered yet
+  size_t simulationFrameIndex = 0u;
+  bool stopRequested = false;
+
+  mutable std::mutex mutex; // Guards all of the above except the frames themselves
+  std::condition_variable condition;
+  std::thread thread;
+
+  void run();
+};
@@ -1,34 +1,87 @@
 #include "Renderer.h"
 
 #include "Context.h"
+#include "CpuProfiler.h"
 #include "DataBuffer.h"
 #include "Headset.h"
 #include "MeshData.h"
+#include "OcclusionCuller.h"
 #include "GameData.h"
 #include "Pipeline.h"
 #include "RenderProcess.h"
 #include "RenderTarget.h"
+#include "Texture.h"
+#include "TextureStreamer.h"
+#include "ThreadPool.h"
 #include "Util.h"
 
+#include <glm/mat4x4.hpp>
+
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
 #include <stdio.h>
 
 
 namespace
 {
-constexpr size_t framesInFlightCount = 2u;
+// [tdbe] more frames in flight let the CPU run further ahead of the GPU (throughput), fewer keep the latency down
+constexpr size_t minFramesInFlightCount = 1u;
+constexpr size_t maxFramesInFlightCount = 3u;
+
+// Subpasses of the headset render pass
+constexpr uint32_t depthPrepassSubpass = 0u;
+constexpr uint32_t mainSubpass = 1u;
+
+constexpr const char* depthPrepassVertShaderName = "shaders/Depth.vert.spv";
+
+// Per-draw object data, delivered through push constants with ObjectDataSource::PushConstants. This has to stay within
+// the 128 bytes that every Vulkan implementation guarantees for push constants, and match the push constant block of
+// the vertex shaders.
+struct PushConstantData
+{
+  glm::mat4 worldMatrix = glm::mat4(1.0f);
+  uint32_t materialIndex = 0u; // Into the material table
+};
+static_assert(sizeof(PushConstantData) <= 128u, "Push constant data exceeds the guaranteed minimum size");
+
+// [tdbe] device memory for the streamed mip levels of the textures until setTextureBudget() says otherwise
+constexpr VkDeviceSize defaultTextureBudget = 512u * 1024u * 1024u;
+
+// The depth prepass only reads positions, and only the culling of the material matters to it
+PipelineMaterialPayload getDepthPrepassPipelineData(const PipelineMaterialPayload& pipelineData)
+{
+  PipelineMaterialPayload depthPrepassPipelineData = {};
+  depthPrepassPipelineData.cullMode = pipelineData.cullMode;
+  return depthPrepassPipelineData;
+}
+
+// Draws over the depth that the prepass wrote already
+PipelineMaterialPayload getDepthEqualPipelineData(const PipelineMaterialPayload& pipelineData)
+{
+  PipelineMaterialPayload depthEqualPipelineData = pipelineData;
+  depthEqualPipelineData.depthWriteEnable = VK_FALSE;
+  depthEqualPipelineData.depthCompareOp = VK_COMPARE_OP_EQUAL;
+  return depthEqualPipelineData;
+}
 } // namespace
 
 Renderer::Renderer(const Context* context,
                    const Headset* headset,
                    const MeshData* meshData,
                    const std::vector<Material*>& materials,
-                   const std::vector<GameObject*>& gameObjects
+                   const std::vector<GameObject*>& gameObjects,
+                   size_t framesInFlightCount,
+                   ObjectDataSource objectDataSource
                    )
-: context(context), headset(headset), materials(materials), gameObjects(gameObjects)
+: context(context), headset(headset), materials(materials), gameObjects(gameObjects),
+  objectDataSource(objectDataSource)
 {
   const VkDevice device = context->getVkDevice();
 
+  framesInFlightCount = std::clamp(framesInFlightCount, minFramesInFlightCount, maxFramesInFlightCount);
+
   // Create a command pool
   VkCommandPoolCreateInfo commandPoolCreateInfo{ VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
   commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
@@ -41,14 +94,18 @@ Renderer::Renderer(const Context* context,
   }
 
   // Create a descriptor pool
-  std::array<VkDescriptorPoolSize, 2u> descriptorPoolSizes;
+  std::array<VkDescriptorPoolSize, 3u> descriptorPoolSizes;
 
-  descriptorPoolSizes.at(0u).type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-  descriptorPoolSizes.at(0u).descriptorCount = static_cast<uint32_t>(framesInFlightCount);
+  descriptorPoolSizes.at(0u).type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptorPoolSizes.at(0u).descriptorCount = static_cast<uint32_t>(framesInFlightCount * 4u);
 
   descriptorPoolSizes.at(1u).type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
   descriptorPoolSizes.at(1u).descriptorCount = static_cast<uint32_t>(framesInFlightCount * 2u);
 
+  descriptorPoolSizes.at(2u).type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorPoolSizes.at(2u).descriptorCount =
+    static_cast<uint32_t>(framesInFlightCount) * context->getMaxTextureCount();
+
   VkDescriptorPoolCreateInfo descriptorPoolCreateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
   descriptorPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(descriptorPoolSizes.size());
   descriptorPoolCreateInfo.pPoolSizes = descriptorPoolSizes.data();
@@ -73,34 +130,75 @@ Renderer::Renderer(const Context* context,
   //        such that if it fits the main pipeline's layout's descriptor set layout (🙂), you don't need to make 
   //        a new pipeline or a new descriptor.
 
-  // [tdbe] NOTE: TODO: We also need a descriptor set layout that supports textures, 
-  // and a descriptor set per-material, (or descriptor set data per-materal), 
-  // to bind textures to each material.
-  // Rn we have one universal descriptor set for all our materials, and can only push floats, arrays etc.
+  // [tdbe] NOTE: we have one universal descriptor set for all our materials. Textures are bindless (binding 6): one
+  // array of all of them, that materials index into, instead of a descriptor set per material.
 
   // Create a descriptor set layout
-  std::array<VkDescriptorSetLayoutBinding, 3u> descriptorSetLayoutBindings;
+  // The descriptor set doesn't change between draws, so it only has to be bound once per pass.
+  std::array<VkDescriptorSetLayoutBinding, 7u> descriptorSetLayoutBindings;
 
-  // [tdbe] per model/mesh data, vertex dynamic; 
-  //        and also per-material data go here.
+  // [tdbe] per model/mesh data, a tightly packed object table indexed by gl_InstanceIndex.
   descriptorSetLayoutBindings.at(0u).binding = 0u;
-  descriptorSetLayoutBindings.at(0u).descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  descriptorSetLayoutBindings.at(0u).descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
   descriptorSetLayoutBindings.at(0u).descriptorCount = 1u;
-  descriptorSetLayoutBindings.at(0u).stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  descriptorSetLayoutBindings.at(0u).stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+  descriptorSetLayoutBindings.at(0u).pImmutableSamplers = nullptr;
 
   // [tdbe] cross-shader global (pipeline/descriptorset wide) vertex static
   descriptorSetLayoutBindings.at(1u).binding = 1u;
   descriptorSetLayoutBindings.at(1u).descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
   descriptorSetLayoutBindings.at(1u).descriptorCount = 1u;
-  descriptorSetLayoutBindings.at(1u).stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  descriptorSetLayoutBindings.at(1u).stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+  descriptorSetLayoutBindings.at(1u).pImmutableSamplers = nullptr;
 
   // [tdbe] cross-shader global (pipeline/descriptorset wide) fragment static
   descriptorSetLayoutBindings.at(2u).binding = 2u;
   descriptorSetLayoutBindings.at(2u).descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
   descriptorSetLayoutBindings.at(2u).descriptorCount = 1u;
   descriptorSetLayoutBindings.at(2u).stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  descriptorSetLayoutBindings.at(2u).pImmutableSamplers = nullptr;
+
+  // Occlusion culling reads the draw list of the frame and writes the indirect draw commands
+  descriptorSetLayoutBindings.at(3u).binding = 3u;
+  descriptorSetLayoutBindings.at(3u).descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptorSetLayoutBindings.at(3u).descriptorCount = 1u;
+  descriptorSetLayoutBindings.at(3u).stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  descriptorSetLayoutBindings.at(3u).pImmutableSamplers = nullptr;
+
+  descriptorSetLayoutBindings.at(4u).binding = 4u;
+  descriptorSetLayoutBindings.at(4u).descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptorSetLayoutBindings.at(4u).descriptorCount = 1u;
+  descriptorSetLayoutBindings.at(4u).stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  descriptorSetLayoutBindings.at(4u).pImmutableSamplers = nullptr;
+
+  // [tdbe] per material data, the material table indexed by the material index in the object table. One entry for
+  //        all objects of a material, so all materials that share shaders can also share their pipeline.
+  descriptorSetLayoutBindings.at(5u).binding = 5u;
+  descriptorSetLayoutBindings.at(5u).descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptorSetLayoutBindings.at(5u).descriptorCount = 1u;
+  descriptorSetLayoutBindings.at(5u).stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  descriptorSetLayoutBindings.at(5u).pImmutableSamplers = nullptr;
+
+  // [tdbe] bindless textures: one array of all textures, indexed by the texture indices in the material table. Adding
+  //        a texture only writes its array element, materials never bind anything of their own. Elements past the
+  //        textures that exist stay unwritten, which is fine as long as no shader reads them (partially bound).
+  descriptorSetLayoutBindings.at(6u).binding = 6u;
+  descriptorSetLayoutBindings.at(6u).descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorSetLayoutBindings.at(6u).descriptorCount = context->getMaxTextureCount();
+  descriptorSetLayoutBindings.at(6u).stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  descriptorSetLayoutBindings.at(6u).pImmutableSamplers = nullptr;
+
+  std::array<VkDescriptorBindingFlags, 7u> descriptorBindingFlags = {};
+  descriptorBindingFlags.at(6u) = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+
+  VkDescriptorSetLayoutBindingFlagsCreateInfo descriptorSetLayoutBindingFlagsCreateInfo{
+    VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO
+  };
+  descriptorSetLayoutBindingFlagsCreateInfo.bindingCount = static_cast<uint32_t>(descriptorBindingFlags.size());
+  descriptorSetLayoutBindingFlagsCreateInfo.pBindingFlags = descriptorBindingFlags.data();
 
   VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+  descriptorSetLayoutCreateInfo.pNext = &descriptorSetLayoutBindingFlagsCreateInfo;
   descriptorSetLayoutCreateInfo.bindingCount = static_cast<uint32_t>(descriptorSetLayoutBindings.size());
   descriptorSetLayoutCreateInfo.pBindings = descriptorSetLayoutBindings.data();
   if (vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
@@ -110,10 +208,18 @@ Renderer::Renderer(const Context* context,
     return;
   }
 
-  // Create a pipeline layout
+  // Create a pipeline layout with a push constant range for the per-draw object data, the pipelines work with either
+  // object data source
+  VkPushConstantRange pushConstantRange;
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  pushConstantRange.offset = 0u;
+  pushConstantRange.size = static_cast<uint32_t>(sizeof(PushConstantData));
+
   VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
   pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
   pipelineLayoutCreateInfo.setLayoutCount = 1u;
+  pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+  pipelineLayoutCreateInfo.pushConstantRangeCount = 1u;
   if (vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
   {
     util::error(Error::GenericVulkan);
@@ -121,24 +227,22 @@ Renderer::Renderer(const Context* context,
     return;
   }
 
-  // Create a render process for each frame in flight
-  renderProcesses.resize(framesInFlightCount);
-  for (RenderProcess*& renderProcess : renderProcesses)
-  {
-    renderProcess = new RenderProcess(context, commandPool, descriptorPool, descriptorSetLayout, gameObjects.size(), materials.size());
-    if (!renderProcess->isValid())
-    {
-      valid = false;
-      return;
-    }
-  }
+  // Create the pipelines
+  // [tdbe] the vertex input is kept around, so that materials added later on can get a pipeline on demand.
+  // Vertex positions come from their own stream (binding 0), which is all the depth prepass reads. The rest of the
+  // vertex attributes come from a second stream (binding 1).
+  VkVertexInputBindingDescription positionInputBindingDescription;
+  positionInputBindingDescription.binding = 0u;
+  positionInputBindingDescription.stride = sizeof(glm::vec3);
+  positionInputBindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-  // Create the pipeline
   VkVertexInputBindingDescription vertexInputBindingDescription;
-  vertexInputBindingDescription.binding = 0u;
+  vertexInputBindingDescription.binding = 1u;
   vertexInputBindingDescription.stride = sizeof(Vertex);
   vertexInputBindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
+  vertexInputBindingDescriptions = { positionInputBindingDescription, vertexInputBindingDescription };
+
   // [tdbe] This is where you bind vertex uniform data for shader input 
   // (e.g. vertex pos, vertex normal, vertex color), and assign per-pipeline.
   // (not related to the descriptor set layout above)
@@ -146,62 +250,109 @@ Renderer::Renderer(const Context* context,
   vertexInputAttributePosition.binding = 0u;
   vertexInputAttributePosition.location = 0u;
   vertexInputAttributePosition.format = VK_FORMAT_R32G32B32_SFLOAT;
-  vertexInputAttributePosition.offset = offsetof(Vertex, position);
+  vertexInputAttributePosition.offset = 0u;
 
   VkVertexInputAttributeDescription vertexInputAttributeNormal;
-  vertexInputAttributeNormal.binding = 0u;
+  vertexInputAttributeNormal.binding = 1u;
   vertexInputAttributeNormal.location = 1u;
   vertexInputAttributeNormal.format = VK_FORMAT_R32G32B32_SFLOAT;
   vertexInputAttributeNormal.offset = offsetof(Vertex, normal);
 
   VkVertexInputAttributeDescription vertexInputAttributeColor;
-  vertexInputAttributeColor.binding = 0u;
+  vertexInputAttributeColor.binding = 1u;
   vertexInputAttributeColor.location = 2u;
   vertexInputAttributeColor.format = VK_FORMAT_R32G32B32_SFLOAT;
   vertexInputAttributeColor.offset = offsetof(Vertex, color);
-  
-  PipelineMaterialPayload pipelineMaterialPayload = {};
-  pipelines.resize(2);
-  pipelines[0] = new Pipeline(context, pipelineLayout, headset->getVkRenderPass(), "shaders/Grid.vert.spv", "shaders/Grid.frag.spv",
-                    { vertexInputBindingDescription }, 
-                    { vertexInputAttributePosition, vertexInputAttributeColor
-                    },
-                    pipelineMaterialPayload);
-  pipelines[1] = new Pipeline(context, pipelineLayout, headset->getVkRenderPass(), "shaders/Diffuse.vert.spv", "shaders/Diffuse.frag.spv",
-                    { vertexInputBindingDescription }, 
-                    { vertexInputAttributePosition, vertexInputAttributeNormal, vertexInputAttributeColor
-                    },
-                    pipelineMaterialPayload);
-
-  for(size_t i=0; i<materials.size(); i++){
-    int pipelineExistsAt = findExistingPipeline(materials[i]->vertShaderName, materials[i]->fragShaderName, materials[i]->pipelineData);
-    //std::printf("\n[Renderer][log] pipelining materials: index: {%d}, shader.name: {%s}, exists: {%d}", i, materials[i]->fragShaderName.c_str(), pipelineExistsAt );
-    // [tdbe] default grid pipeline
-    if(i==0){   
-      materials[0]->pipeline = pipelines[0];
-        
-    }// [tdbe] default diffuse pipeline
-    else if (pipelineExistsAt > -1)
+
+  VkVertexInputAttributeDescription vertexInputAttributeTexCoord;
+  vertexInputAttributeTexCoord.binding = 1u;
+  vertexInputAttributeTexCoord.location = 3u;
+  vertexInputAttributeTexCoord.format = VK_FORMAT_R32G32_SFLOAT;
+  vertexInputAttributeTexCoord.offset = offsetof(Vertex, texCoord);
+
+  vertexInputAttributeDescriptions = { vertexInputAttributePosition, vertexInputAttributeNormal,
+                                       vertexInputAttributeColor, vertexInputAttributeTexCoord };
+
+  // [tdbe] pipelines get compiled in two phases. First the pipelines of all materials are gathered without duplicates,
+  // then they are compiled in parallel on the thread pool, Vulkan allows creating pipelines from several threads at
+  // once. The rest of the renderer gets created in the meantime, only the end of the constructor waits for them.
+  // The grid pipeline comes first, it reads fewer vertex attributes than the others and the grid material picks it up.
+  std::vector<PipelineDescription> pipelineDescriptions = {
+    { "shaders/Grid.vert.spv", "shaders/Grid.frag.spv", getStaticPipelineData({}), mainSubpass,
+      vertexInputBindingDescriptions,
+      { vertexInputAttributePosition, vertexInputAttributeColor } }
+  };
+  ShaderLibrary& shaderLibrary = *context->getShaderLibrary();
+  std::unordered_map<PipelineKey, size_t, PipelineKey::Hash> pipelineIndices = {
+    { pipelineDescriptions.at(0u).getKey(shaderLibrary), 0u }
+  };
+  const auto gatherPipelineDescriptions = [this, &shaderLibrary, &pipelineDescriptions,
+                                           &pipelineIndices](const Material* material)
+  {
+    std::vector<PipelineDescription> materialPipelineDescriptions;
+    getPipelineDescriptions(material, materialPipelineDescriptions);
+    for (PipelineDescription& description : materialPipelineDescriptions)
     {
-      materials[i]->pipeline = pipelines[pipelineExistsAt];
-    }// [tdbe] create a new pipeline from material shader name, with default parameters
-    else{
-      pipelines.emplace_back(new Pipeline(context, pipelineLayout, headset->getVkRenderPass(), 
-                    materials[i]->vertShaderName, materials[i]->fragShaderName,
-                    { vertexInputBindingDescription }, 
-                    { vertexInputAttributePosition, vertexInputAttributeNormal, vertexInputAttributeColor
-                    },
-                    materials[i]->pipelineData));
-      materials[i]->pipeline = pipelines[pipelines.size()-1];
+      if (pipelineIndices.emplace(description.getKey(shaderLibrary), pipelineDescriptions.size()).second)
+      {
+        pipelineDescriptions.push_back(std::move(description));
+      }
     }
-    
-    if (!materials[i]->pipeline->isValid())
+  };
+
+  // The pipelines of the default material stand in for the pipelines of materials added later on, until those are
+  // compiled (see findOrCreatePipeline())
+  const Material defaultMaterial;
+  std::vector<PipelineDescription> fallbackPipelineDescriptions;
+  getPipelineDescriptions(&defaultMaterial, fallbackPipelineDescriptions);
+  gatherPipelineDescriptions(&defaultMaterial);
+
+  for (const Material* material : materials)
+  {
+    gatherPipelineDescriptions(material);
+  }
+
+  threadPool = new ThreadPool();
+  pipelines.resize(pipelineDescriptions.size(), nullptr);
+  for (size_t pipelineIndex = 0u; pipelineIndex < pipelineDescriptions.size(); ++pipelineIndex)
+  {
+    // Each job only writes its own pipeline, nothing else touches the pipelines until all jobs are done
+    threadPool->enqueue(
+      [this, pipelineIndex, description = pipelineDescriptions.at(pipelineIndex)]
+      {
+        const profiler::Zone zone("Compile pipeline");
+        Pipeline* pipeline =
+          new Pipeline(context, pipelineLayout, headset->getVkRenderPass(), description.subpass, description.vertShader,
+                       description.fragShader, description.bindingDescriptions, description.attributeDescriptions,
+                       description.pipelineData);
+        pipelines.at(pipelineIndex) = pipeline;
+        if (pipeline->isValid())
+        {
+          pipeline->compile();
+        }
+      });
+  }
+
+  // Create the occlusion culler, it shares the descriptor set layout of the render processes
+  occlusionCuller = new OcclusionCuller(context, headset, descriptorSetLayout);
+  if (!occlusionCuller->isValid())
+  {
+    valid = false;
+    return;
+  }
+
+  // Create a render process for each frame in flight
+  renderProcesses.resize(framesInFlightCount);
+  for (RenderProcess*& renderProcess : renderProcesses)
+  {
+    renderProcess = new RenderProcess(context, commandPool, descriptorPool, descriptorSetLayout, gameObjects.size());
+    if (!renderProcess->isValid())
     {
       valid = false;
-      return; 
+      return;
     }
   }
-  
+
   // Create a vertex index buffer
   {
     // Create a staging buffer
@@ -249,21 +400,124 @@ Renderer::Renderer(const Context* context,
     delete stagingBuffer;
   }
 
+  vertexOffset = meshData->getVertexOffset();
   indexOffset = meshData->getIndexOffset();
+
+  // Create the sampler that all textures share
+  VkSamplerCreateInfo samplerCreateInfo{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+  samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+  samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+  samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerCreateInfo.minLod = 0.0f;
+  samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+  if (vkCreateSampler(device, &samplerCreateInfo, nullptr, &textureSampler) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    valid = false;
+    return;
+  }
+
+  textureStreamer = new TextureStreamer(context, threadPool, defaultTextureBudget, renderProcesses.size());
+  if (!textureStreamer->isValid())
+  {
+    valid = false;
+    return;
+  }
+
+  // Texture index 0 is plain white, for materials without a texture
+  if (addTexture({ 1u, 1u }, VK_FORMAT_R8G8B8A8_UNORM, { { 255u, 255u, 255u, 255u } }) != 0u || textures.empty())
+  {
+    valid = false;
+    return;
+  }
+
+  // The first frame needs the pipelines
+  {
+    const profiler::Zone zone("Wait for pipelines");
+    threadPool->wait();
+  }
+
+  for (const Pipeline* pipeline : pipelines)
+  {
+    if (!pipeline->isValid())
+    {
+      valid = false;
+      return;
+    }
+  }
+
+  for (const auto& [key, pipelineIndex] : pipelineIndices)
+  {
+    pipelinesByKey.emplace(key, pipelines.at(pipelineIndex));
+  }
+
+  fallbackPipeline = pipelinesByKey.at(fallbackPipelineDescriptions.at(0u).getKey(shaderLibrary));
+  fallbackDepthPrepassPipeline = pipelinesByKey.at(fallbackPipelineDescriptions.at(1u).getKey(shaderLibrary));
+  fallbackDepthEqualPipeline = pipelinesByKey.at(fallbackPipelineDescriptions.at(2u).getKey(shaderLibrary));
+
+  // With graphics pipeline libraries, the parts of the pipelines so far get compiled in the background, so that later
+  // pipelines which share most of them only have to link them
+  if (context->isGraphicsPipelineLibraryEnabled())
+  {
+    pipelineLibraryCache = new PipelineLibraryCache(context);
+    for (const Pipeline* pipeline : pipelines)
+    {
+      threadPool->enqueue(
+        [this, pipeline]
+        {
+          const profiler::Zone zone("Compile pipeline libraries");
+          pipeline->compileLibraries(*pipelineLibraryCache);
+        });
+    }
+  }
+
+  // From now on new pipelines don't stall the frame, see findOrCreatePipeline()
+  compilePipelinesAsync = true;
+
+  // All pipelines exist by now, so this only looks them up
+  for (Material* material : materials)
+  {
+    if (!assignPipelines(material))
+    {
+      valid = false;
+      return;
+    }
+
+    assignMaterialIndex(material);
+  }
 }
 
 Renderer::~Renderer()
 {
+  // Finishes pipelines that are still compiling
+  delete threadPool;
+
   delete vertexIndexBuffer;
+  delete occlusionCuller;
   
   for (size_t i = 0; i<pipelines.size(); i++) {
     //vkDestroyPipeline(device, materials[i]->pipeline, nullptr);
     delete pipelines[i];
   }
 
+  delete pipelineLibraryCache;
+
+  for (const Texture* texture : textures)
+  {
+    delete texture;
+  }
+  delete textureStreamer;
+
   const VkDevice device = context->getVkDevice();
   if (device)
   {
+    if (textureSampler)
+    {
+      vkDestroySampler(device, textureSampler, nullptr);
+    }
 
     if (pipelineLayout)
     {
@@ -292,33 +546,550 @@ Renderer::~Renderer()
   }
 }
 
-// returns i of pipeline vectors, or -1 if a pipeline for these shaders hasn't been created yet.
-const int Renderer::findExistingPipeline(const std::string& vertShader, const std::string& fragShader, const PipelineMaterialPayload& pipelineData) const{
-  for(size_t i = 0; i< pipelines.size(); i++){
-    if(pipelines[i]->getVertShaderName() == vertShader &&
-      pipelines[i]->getFragShaderName() == fragShader
-      ){
-        if(pipelineData == pipelines[i]->getPipelineMaterialData()){
-          return (int)i;
+// [tdbe] returns an existing pipeline with the same shaders and pipeline data, or compiles a new one.
+// Pipelines are never destroyed before the renderer is, so command buffers still in flight can keep using them.
+Pipeline* Renderer::findOrCreatePipeline(const PipelineDescription& description)
+{
+  const PipelineKey key = description.getKey(*context->getShaderLibrary());
+  const auto it = pipelinesByKey.find(key);
+  if (it != pipelinesByKey.end())
+  {
+    return it->second;
+  }
+
+  Pipeline* pipeline = new Pipeline(context, pipelineLayout, headset->getVkRenderPass(), description.subpass,
+                                    description.vertShader, description.fragShader, description.bindingDescriptions,
+                                    description.attributeDescriptions, description.pipelineData);
+  if (!pipeline->isValid())
+  {
+    delete pipeline;
+    return nullptr;
+  }
+
+  if (!compilePipelinesAsync)
+  {
+    if (!pipeline->compile())
+    {
+      delete pipeline;
+      return nullptr;
+    }
+  }
+  else
+  {
+    // [tdbe] a material that shows up mid-session shouldn't stall the frame with any compiling. With graphics pipeline
+    // libraries its pipeline gets linked right away if all of its parts are compiled already, otherwise the default
+    // material's pipeline stands in for it. The missing parts and the optimized pipeline compile on the thread pool,
+    // the linked pipeline gets swapped in as soon as the parts are there, the optimized one once it is ready.
+    const bool linked = pipelineLibraryCache && pipeline->link(*pipelineLibraryCache);
+    if (!linked)
+    {
+      pipeline->setFallback(findFallbackPipeline(description));
+    }
+
+    threadPool->enqueue(
+      [this, pipeline, linked]
+      {
+        if (pipelineLibraryCache && !linked)
+        {
+          const profiler::Zone zone("Link pipeline");
+          if (pipeline->compileLibraries(*pipelineLibraryCache))
+          {
+            pipeline->link(*pipelineLibraryCache);
+          }
         }
-        
+
+        const profiler::Zone zone("Compile pipeline");
+        pipeline->compile();
+      });
+  }
+
+  pipelines.push_back(pipeline);
+  pipelinesByKey.emplace(key, pipeline);
+  return pipeline;
+}
+
+// [tdbe] the pipeline data that actually gets baked into a pipeline. With extended dynamic state the cull mode and
+// depth state (and with VK_EXT_extended_dynamic_state3 the blend equation) are set per draw instead, so they are reset
+// to their defaults here, and materials that only differ in them share a pipeline. Without it nothing is dynamic and
+// every combination gets its own pipeline, like before. The object data source of the renderer is baked in as well.
+PipelineMaterialPayload Renderer::getStaticPipelineData(const PipelineMaterialPayload& pipelineData) const
+{
+  const Context::ExtendedDynamicState& extendedDynamicState = context->getExtendedDynamicState();
+  const PipelineMaterialPayload defaultPipelineData = {};
+  PipelineMaterialPayload staticPipelineData = pipelineData;
+  staticPipelineData.specialization.objectDataFromTable =
+    objectDataSource == ObjectDataSource::ObjectTable ? VK_TRUE : VK_FALSE;
+  if (extendedDynamicState.enabled)
+  {
+    staticPipelineData.cullMode = defaultPipelineData.cullMode;
+    staticPipelineData.depthWriteEnable = defaultPipelineData.depthWriteEnable;
+    staticPipelineData.depthCompareOp = defaultPipelineData.depthCompareOp;
+  }
+
+  if (extendedDynamicState.blendEquationEnabled)
+  {
+    staticPipelineData.srcColorBlendFactor = defaultPipelineData.srcColorBlendFactor;
+    staticPipelineData.dstColorBlendFactor = defaultPipelineData.dstColorBlendFactor;
+    staticPipelineData.colorBlendOp = defaultPipelineData.colorBlendOp;
+    staticPipelineData.srcAlphaBlendFactor = defaultPipelineData.srcAlphaBlendFactor;
+    staticPipelineData.dstAlphaBlendFactor = defaultPipelineData.dstAlphaBlendFactor;
+    staticPipelineData.alphaBlendOp = defaultPipelineData.alphaBlendOp;
+  }
+
+  return staticPipelineData;
+}
+
+// [tdbe] the pipelines a material needs, in this order: its main pipeline, and for opaque materials a depth-only
+// pipeline for the prepass, and a variant of their main pipeline that only tests for equal depth, for when the prepass
+// already wrote it. Transparent materials don't take part in the prepass, they blend over what's behind them.
+// With extended dynamic state the equal depth variant is the main pipeline itself.
+void Renderer::getPipelineDescriptions(const Material* material, std::vector<PipelineDescription>& descriptions) const
+{
+  descriptions.push_back({ material->vertShaderName, material->fragShaderName,
+                           getStaticPipelineData(material->pipelineData), mainSubpass, vertexInputBindingDescriptions,
+                           vertexInputAttributeDescriptions });
+
+  if (material->renderQueue != RenderQueue::Opaque)
+  {
+    return;
+  }
+
+  descriptions.push_back({ depthPrepassVertShaderName, "",
+                           getStaticPipelineData(getDepthPrepassPipelineData(material->pipelineData)),
+                           depthPrepassSubpass, { vertexInputBindingDescriptions.at(0u) },
+                           { vertexInputAttributeDescriptions.at(0u) } });
+
+  descriptions.push_back({ material->vertShaderName, material->fragShaderName,
+                           getStaticPipelineData(getDepthEqualPipelineData(material->pipelineData)), mainSubpass,
+                           vertexInputBindingDescriptions, vertexInputAttributeDescriptions });
+}
+
+// [tdbe] the pipeline of the default material that stands in for a pipeline which is still compiling. It has to match
+// the subpass, and without extended dynamic state also the depth state, or the main pass variant of an opaque material
+// would test for less depth where the prepass already wrote it, and not show up at all.
+const Pipeline* Renderer::findFallbackPipeline(const PipelineDescription& description) const
+{
+  if (description.subpass == depthPrepassSubpass)
+  {
+    return fallbackDepthPrepassPipeline;
+  }
+
+  const PipelineMaterialPayload& pipelineData = description.pipelineData;
+  if (pipelineData.depthCompareOp == VK_COMPARE_OP_EQUAL && !pipelineData.depthWriteEnable)
+  {
+    return fallbackDepthEqualPipeline;
+  }
+
+  return fallbackPipeline;
+}
+
+// [tdbe] points the material to its pipelines, compiling the ones that don't exist yet.
+bool Renderer::assignPipelines(Material* material)
+{
+  std::vector<PipelineDescription> descriptions;
+  getPipelineDescriptions(material, descriptions);
+
+  std::array<Pipeline*, 3u> materialPipelines = { nullptr, nullptr, nullptr };
+  for (size_t descriptionIndex = 0u; descriptionIndex < descriptions.size(); ++descriptionIndex)
+  {
+    materialPipelines.at(descriptionIndex) = findOrCreatePipeline(descriptions.at(descriptionIndex));
+    if (!materialPipelines.at(descriptionIndex))
+    {
+      return false;
     }
   }
-  return -1;
+
+  material->pipeline = materialPipelines.at(0u);
+  material->depthPrepassPipeline = materialPipelines.at(1u);
+  material->depthEqualPipeline = materialPipelines.at(2u);
+  return true;
+}
+
+bool Renderer::addMaterial(Material* material)
+{
+  if (std::find(materials.begin(), materials.end(), material) != materials.end())
+  {
+    return true;
+  }
+
+  if (!assignPipelines(material))
+  {
+    return false;
+  }
+
+  assignMaterialIndex(material);
+  materials.push_back(material);
+  return true;
+}
+
+bool Renderer::removeMaterial(Material* material)
+{
+  // Its entry in the material table must not go to another material while game objects still refer to it
+  const auto usesMaterial = [material](const GameObject* gameObject) { return gameObject->material == material; };
+  if (std::any_of(gameObjects.begin(), gameObjects.end(), usesMaterial))
+  {
+    return false;
+  }
+
+  // The pipeline stays cached, other materials may share it and it may still be in use by a frame in flight
+  materials.erase(std::remove(materials.begin(), materials.end(), material), materials.end());
+
+  // Frees up its entry in the material table for the next material. Each frame in flight uploads that material when
+  // it gets to it, until then the entry keeps the data of this one.
+  if (material->materialIndex < materialTable.size() && materialTable.at(material->materialIndex) == material)
+  {
+    materialTable.at(material->materialIndex) = nullptr;
+  }
+  return true;
 }
 
-void Renderer::render(const glm::mat4& cameraMatrix, size_t swapchainImageIndex, float time)
+// [tdbe] gives the material an entry in the material table, reusing the entry of a removed material if there is one.
+void Renderer::assignMaterialIndex(Material* material)
 {
+  const auto freeEntry = std::find(materialTable.begin(), materialTable.end(), nullptr);
+  material->materialIndex = static_cast<uint32_t>(std::distance(materialTable.begin(), freeEntry));
+  if (freeEntry == materialTable.end())
+  {
+    materialTable.push_back(material);
+  }
+  else
+  {
+    *freeEntry = material;
+  }
+}
+
+uint32_t Renderer::addTexture(const std::string& filename)
+{
+  return insertTexture(new Texture(context, filename));
+}
+
+uint32_t Renderer::addTexture(VkExtent2D size, VkFormat format, const std::vector<std::vector<uint8_t>>& mipLevels)
+{
+  return insertTexture(new Texture(context, size, format, mipLevels));
+}
+
+uint32_t Renderer::insertTexture(Texture* texture)
+{
+  if (!texture->isValid())
+  {
+    delete texture;
+    return 0u;
+  }
+
+  if (textures.size() >= context->getMaxTextureCount())
+  {
+    util::error(Error::FeatureNotSupported, "More textures than the texture array can hold");
+    delete texture;
+    return 0u;
+  }
+
+  // Nothing gets uploaded here, the render thread uploads the mip tail with the next frame it renders
+  textures.push_back(texture);
+  return static_cast<uint32_t>(textures.size() - 1u);
+}
+
+bool Renderer::addGameObject(GameObject* gameObject)
+{
+  if (std::find(gameObjects.begin(), gameObjects.end(), gameObject) != gameObjects.end())
+  {
+    return true;
+  }
+
+  if (!addMaterial(gameObject->material))
+  {
+    return false;
+  }
+
+  // The object buffers of the render processes grow on their next frame, see RenderProcess::reserveObjectData()
+  gameObjects.push_back(gameObject);
+  return true;
+}
+
+void Renderer::removeGameObject(GameObject* gameObject)
+{
+  gameObjects.erase(std::remove(gameObjects.begin(), gameObjects.end(), gameObject), gameObjects.end());
+}
+
+void Renderer::setDepthPrepassEnabled(bool enabled)
+{
+  depthPrepassEnabled = enabled;
+}
+
+bool Renderer::isDepthPrepassEnabled() const
+{
+  return depthPrepassEnabled;
+}
+
+void Renderer::setOcclusionCullingEnabled(bool enabled)
+{
+  // The depth pyramid isn't kept up to date while culling is off
+  if (!enabled && occlusionCuller)
+  {
+    occlusionCuller->invalidateDepthPyramid();
+  }
+
+  occlusionCullingEnabled = enabled;
+}
+
+bool Renderer::isOcclusionCullingEnabled() const
+{
+  return occlusionCullingEnabled;
+}
+
+Renderer::ObjectDataSource Renderer::getObjectDataSource() const
+{
+  return objectDataSource;
+}
+
+// [tdbe] fetch the pipeline for a GO in this pass, i.e. the one of its material. Opaque models that went through the
+// depth prepass use the equal depth test variant.
+const Pipeline* Renderer::getDrawPipeline(const GameObjectSnapshot& gameObject,
+                                          bool depthPrepass,
+                                          PipelineMaterialPayload& pipelineData) const
+{
+  if (depthPrepass)
+  {
+    pipelineData = getDepthPrepassPipelineData(gameObject.pipelineData);
+    return gameObject.depthPrepassPipeline;
+  }
+
+  if (depthPrepassEnabled && gameObject.depthEqualPipeline)
+  {
+    pipelineData = getDepthEqualPipelineData(gameObject.pipelineData);
+    return gameObject.depthEqualPipeline;
+  }
+
+  pipelineData = gameObject.pipelineData;
+  return gameObject.pipeline;
+}
+
+// Records the draws of a render queue, either for the depth prepass or for the main pass. Without an indirect buffer
+// each draw is recorded directly, otherwise the n-th draw of the queue uses the indirect draw command at
+// 'firstIndirectCommand' + n, which the occlusion culling may have zeroed out. Those commands are consecutive, so with
+// multi-draw indirect a run of draws with the same pipeline and pipeline data goes out in one call.
+void Renderer::recordDraws(VkCommandBuffer commandBuffer,
+                           const SceneSnapshot& scene,
+                           const std::vector<QueuedDraw>& queue,
+                           bool depthPrepass,
+                           VkBuffer indirectBuffer,
+                           size_t firstIndirectCommand,
+                           BoundPipelineState& boundPipelineState) const
+{
+  // Push constants change per draw, so those draws can't be merged
+  const size_t maxDrawCount =
+    objectDataSource == ObjectDataSource::ObjectTable ? context->getMaxDrawIndirectCount() : 1u;
+
+  size_t drawCount = 0u;
+  for (size_t queueIndex = 0u; queueIndex < queue.size(); queueIndex += drawCount)
+  {
+    const QueuedDraw& queuedDraw = queue.at(queueIndex);
+    const GameObjectSnapshot& gameObject = scene.gameObjects.at(queuedDraw.goIndex);
+
+    // [tdbe] bind the "pipeline" of this GO's material to the command buffer, unless it's already bound
+    PipelineMaterialPayload pipelineData;
+    const Pipeline* pipeline = getDrawPipeline(gameObject, depthPrepass, pipelineData);
+
+    // Binding a pipeline invalidates the dynamic state, otherwise it only changes between draw groups of materials with
+    // a different cull mode, depth state or blend equation
+    const bool pipelineChanged = pipeline != boundPipelineState.pipeline;
+    if (pipelineChanged)
+    {
+      boundPipelineState.pipeline = pipeline;
+      pipeline->bindPipeline(commandBuffer);
+    }
+
+    if (pipelineChanged || !(pipelineData == boundPipelineState.pipelineData))
+    {
+      boundPipelineState.pipelineData = pipelineData;
+      pipeline->setDynamicState(commandBuffer, pipelineData);
+    }
+
+    // Push the per model/mesh data, this replaces the object table lookup in the vertex shaders
+    if (objectDataSource == ObjectDataSource::PushConstants)
+    {
+      PushConstantData pushConstantData;
+      pushConstantData.worldMatrix = gameObject.worldMatrix;
+      pushConstantData.materialIndex = gameObject.materialIndex;
+      vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0u,
+                         static_cast<uint32_t>(sizeof(PushConstantData)), &pushConstantData);
+    }
+
+    // The object index is passed as the first instance, shaders use it (gl_InstanceIndex) to look up the object table
+    drawCount = 1u;
+    if (indirectBuffer)
+    {
+      // Take along the draws that follow as long as they don't need any other state than what was just set
+      while (drawCount < maxDrawCount && queueIndex + drawCount < queue.size())
+      {
+        PipelineMaterialPayload nextPipelineData;
+        const GameObjectSnapshot& nextGameObject = scene.gameObjects.at(queue.at(queueIndex + drawCount).goIndex);
+        if (getDrawPipeline(nextGameObject, depthPrepass, nextPipelineData) != pipeline ||
+            !(nextPipelineData == pipelineData))
+        {
+          break;
+        }
+        ++drawCount;
+      }
+
+      const VkDeviceSize offset = static_cast<VkDeviceSize>((firstIndirectCommand + queueIndex) *
+                                                            sizeof(VkDrawIndexedIndirectCommand));
+      vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, offset, static_cast<uint32_t>(drawCount),
+                               sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else
+    {
+      vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(gameObject.model->indexCount), 1u,
+                       static_cast<uint32_t>(gameObject.model->firstIndex), 0u,
+                       static_cast<uint32_t>(queuedDraw.goIndex));
+    }
+  }
+}
+
+void Renderer::setTextureBudget(VkDeviceSize budget)
+{
+  textureStreamer->setBudget(budget);
+}
+
+VkDeviceSize Renderer::getTextureBudget() const
+{
+  return textureStreamer->getBudget();
+}
+
+// [tdbe] asks for one texel per pixel where the object of a texture covers the most pixels. That assumes the texture
+// is stretched once over the bounding sphere of the model, which is rough, but the mip level only has to be close.
+// Only uses the render queues, so that hidden objects don't keep their textures resident.
+void Renderer::requestTextureMipLevels(const SceneSnapshot& scene) const
+{
+  // Pixels per unit of size at a distance of one. At the full eye resolution, so that dynamic resolution doesn't make
+  // mip levels stream in and out.
+  const float pixelsPerUnit = std::abs(headset->getEyeProjectionMatrix(0u)[1][1]) * 0.5f *
+                              static_cast<float>(headset->getEyeResolution(0u).height);
+
+  for (const std::vector<QueuedDraw>* queue : { &opaqueQueue, &transparentQueue })
+  {
+    for (const QueuedDraw& queuedDraw : *queue)
+    {
+      const GameObjectSnapshot& gameObject = scene.gameObjects.at(queuedDraw.goIndex);
+      if (gameObject.materialIndex >= scene.materials.size())
+      {
+        continue;
+      }
+
+      const uint32_t textureIndex = scene.materials.at(gameObject.materialIndex).materialData.baseColorTexture;
+      if (textureIndex >= scene.textures.size())
+      {
+        continue;
+      }
+
+      // The bounding sphere in world space, measured from its closest point so that close-ups get the full resolution
+      const glm::mat4& worldMatrix = gameObject.worldMatrix;
+      const float scale = std::max({ glm::length(glm::vec3(worldMatrix[0])), glm::length(glm::vec3(worldMatrix[1])),
+                                     glm::length(glm::vec3(worldMatrix[2])) });
+      const float radius = glm::length(gameObject.model->boundsMax - gameObject.model->boundsMin) * 0.5f * scale;
+      const float distance = std::max(std::sqrt(queuedDraw.distanceSquared) - radius, 0.01f);
+      const float pixels = std::max(2.0f * radius * pixelsPerUnit / distance, 1.0f);
+
+      const VkExtent2D textureSize = scene.textures.at(textureIndex)->getSize();
+      const float texels = static_cast<float>(std::max(textureSize.width, textureSize.height));
+      const float mipLevel = std::max(std::floor(std::log2(texels / pixels)), 0.0f);
+      textureStreamer->requestMipLevel(textureIndex, static_cast<uint32_t>(mipLevel));
+    }
+  }
+}
+
+void Renderer::updateViewProjectionMatrices(RenderProcess* renderProcess) const
+{
+  for (size_t eyeIndex = 0u; eyeIndex < headset->getEyeCount(); ++eyeIndex)
+  {
+    renderProcess->staticVertexUniformData.viewProjectionMatrices.at(eyeIndex) =
+      headset->getEyeProjectionMatrix(eyeIndex) * headset->getEyeViewMatrix(eyeIndex) * cameraMatrix;
+  }
+}
+
+void Renderer::captureScene(SceneSnapshot& scene, const glm::mat4& cameraMatrix, float time) const
+{
+  scene.cameraMatrix = cameraMatrix;
+  scene.time = time;
+
+  // Resizing keeps the capacity, so after the first few frames this doesn't allocate
+  scene.gameObjects.resize(gameObjects.size());
+  for (size_t goIndex = 0u; goIndex < gameObjects.size(); ++goIndex)
+  {
+    const GameObject* gameObject = gameObjects.at(goIndex);
+    const Material* material = gameObject->material;
+    GameObjectSnapshot& snapshot = scene.gameObjects.at(goIndex);
+    snapshot.gameObject = gameObject;
+    snapshot.model = gameObject->model;
+    snapshot.worldMatrix = gameObject->getWorldMatrix();
+    snapshot.version = gameObject->getVersion();
+    snapshot.isVisible = gameObject->isVisible;
+    snapshot.materialIndex = material->materialIndex;
+    snapshot.renderQueue = material->renderQueue;
+    snapshot.pipelineData = material->pipelineData;
+    snapshot.pipeline = material->pipeline;
+    snapshot.depthPrepassPipeline = material->depthPrepassPipeline;
+    snapshot.depthEqualPipeline = material->depthEqualPipeline;
+  }
+
+  // Textures are only ever added, so the pointers are all there is to copy. Their mip levels belong to the render
+  // thread, see TextureStreamer.h.
+  scene.textures.assign(textures.begin(), textures.end());
+
+  scene.materials.resize(materialTable.size());
+  for (size_t materialIndex = 0u; materialIndex < materialTable.size(); ++materialIndex)
+  {
+    const Material* material = materialTable.at(materialIndex);
+    MaterialSnapshot& snapshot = scene.materials.at(materialIndex);
+    snapshot.material = material;
+    if (material)
+    {
+      snapshot.materialData = material->getDynamicUniformData();
+      snapshot.version = material->getVersion();
+    }
+  }
+}
+
+void Renderer::render(const SceneSnapshot& scene, size_t swapchainImageIndex)
+{
+  cameraMatrix = scene.cameraMatrix;
   currentRenderProcessIndex = (currentRenderProcessIndex + 1u) % renderProcesses.size();
 
   RenderProcess* renderProcess = renderProcesses.at(currentRenderProcessIndex);
 
-  const VkFence busyFence = renderProcess->getBusyFence();
-  if (vkResetFences(context->getVkDevice(), 1u, &busyFence) != VK_SUCCESS)
+  // Wait until the GPU is done with the previous frame of this render process before any of its resources get
+  // touched. That frame was submitted a number of frames in flight ago, the more recent ones keep running.
+  {
+    profiler::Zone fenceWaitZone("Renderer::waitForFrameInFlight");
+    const std::chrono::high_resolution_clock::time_point waitStartTime = std::chrono::high_resolution_clock::now();
+    if (!renderProcess->waitUntilIdle())
+    {
+      return;
+    }
+
+    const long long waitNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                        std::chrono::high_resolution_clock::now() - waitStartTime)
+                                        .count();
+    fenceWaitTime = static_cast<float>(waitNanoseconds) / 1e6f;
+  }
+
+  // Images that streaming replaced during the previous frame of this render process, no frame uses them anymore
+  renderProcess->deleteIdleBuffers();
+
+  // Make room for objects and materials that were added since this render process was last used
+  if (!renderProcess->reserveObjectData(scene.gameObjects.size()) ||
+      !renderProcess->reserveMaterialData(scene.materials.size()))
   {
     return;
   }
 
+  // Pick up the GPU time of the previous frame of this render process and the timers of its parts, it is done by now
+  gpuFrameTimeUpdated = renderProcess->readGpuFrameTime(gpuFrameTime);
+  if (gpuFrameTimeUpdated)
+  {
+    gpuProfiler.addSample(GpuTimer::Frame, gpuFrameTime);
+  }
+  renderProcess->readGpuTimers(gpuProfiler);
+
   const VkCommandBuffer commandBuffer = renderProcess->getCommandBuffer();
 
   if (vkResetCommandBuffer(commandBuffer, 0u) != VK_SUCCESS)
@@ -332,23 +1103,100 @@ void Renderer::render(const glm::mat4& cameraMatrix, size_t swapchainImageIndex,
     return;
   }
 
+  renderProcess->writeFrameBeginTimestamp();
+
   // Update the uniform buffer data
   {
-    for (size_t goIndex = 0u; goIndex < gameObjects.size(); ++goIndex)
+    // Only the objects and materials that changed since this render process was last used get copied. The object
+    // table is only read by the vertex shaders or the culling, if neither does it stays as it is until one does again.
+    if (objectDataSource == ObjectDataSource::ObjectTable || occlusionCullingEnabled)
     {
-      renderProcess->dynamicVertexUniformData[goIndex].worldMatrix = gameObjects.at(goIndex)->worldMatrix;
-      renderProcess->dynamicVertexUniformData[goIndex].colorMultiplier = gameObjects.at(goIndex)->material->dynamicUniformData.colorMultiplier;
+      renderProcess->updateObjectData(scene.gameObjects);
     }
+    renderProcess->updateMaterialData(scene.materials);
+
+    updateViewProjectionMatrices(renderProcess);
 
-    for (size_t eyeIndex = 0u; eyeIndex < headset->getEyeCount(); ++eyeIndex)
+    renderProcess->staticFragmentUniformData.time = scene.time;
+
+    renderProcess->updateUniformBufferData();
+  }
+
+  // Sort the visible models into their render queues, measuring distances from the midpoint between the eyes
+  glm::vec3 eyeMidpoint = glm::vec3(0.0f);
+  for (size_t eyeIndex = 0u; eyeIndex < headset->getEyeCount(); ++eyeIndex)
+  {
+    eyeMidpoint += glm::vec3(glm::inverse(headset->getEyeViewMatrix(eyeIndex) * cameraMatrix)[3]);
+  }
+  eyeMidpoint /= static_cast<float>(headset->getEyeCount());
+
+  opaqueQueue.clear();
+  transparentQueue.clear();
+  for (size_t goIndex = 0u; goIndex < scene.gameObjects.size(); ++goIndex)
+  {
+    const GameObjectSnapshot& gameObject = scene.gameObjects.at(goIndex);
+    if(!gameObject.isVisible)
+      continue;
+
+    const glm::vec3 offset = glm::vec3(gameObject.worldMatrix[3]) - eyeMidpoint;
+    QueuedDraw queuedDraw;
+    queuedDraw.goIndex = goIndex;
+    queuedDraw.distanceSquared = glm::dot(offset, offset);
+
+    if (gameObject.renderQueue == RenderQueue::Transparent)
     {
-      renderProcess->staticVertexUniformData.viewProjectionMatrices.at(eyeIndex) =
-        headset->getEyeProjectionMatrix(eyeIndex) * headset->getEyeViewMatrix(eyeIndex) * cameraMatrix;
+      transparentQueue.push_back(queuedDraw);
     }
+    else
+    {
+      opaqueQueue.push_back(queuedDraw);
+    }
+  }
 
-    renderProcess->staticFragmentUniformData.time = time;
+  // Opaque front-to-back, transparent back-to-front, ties keep the game object order
+  std::sort(opaqueQueue.begin(), opaqueQueue.end(), [](const QueuedDraw& a, const QueuedDraw& b) {
+    return a.distanceSquared < b.distanceSquared || (a.distanceSquared == b.distanceSquared && a.goIndex < b.goIndex);
+  });
+  std::sort(transparentQueue.begin(), transparentQueue.end(), [](const QueuedDraw& a, const QueuedDraw& b) {
+    return a.distanceSquared > b.distanceSquared || (a.distanceSquared == b.distanceSquared && a.goIndex < b.goIndex);
+  });
+
+  // Stream in the mip levels the visible textures need, or evict others to make room for them. This swaps the image
+  // views of the textures it touches, so the texture array gets updated afterwards.
+  requestTextureMipLevels(scene);
+  textureStreamer->update(scene.textures, renderProcess);
+  renderProcess->updateTextureDescriptors(scene.textures, textureSampler);
+
+  // The draw list holds the opaque queue followed by the transparent queue, occlusion culling writes an indirect draw
+  // command for each of its entries. The first phase culls against the depth pyramid of the previous frame.
+  const VkDescriptorSet descriptorSet = renderProcess->getDescriptorSet();
+  const VkBuffer indirectBuffer = occlusionCullingEnabled ? renderProcess->getIndirectBuffer() : nullptr;
+  const size_t drawCapacity = renderProcess->getDrawCapacity();
+  const size_t drawCount = opaqueQueue.size() + transparentQueue.size();
+  const VkExtent2D renderResolution = headset->getRenderResolution(0u);
+  if (indirectBuffer)
+  {
+    size_t drawIndex = 0u;
+    for (const std::vector<QueuedDraw>* queue : { &opaqueQueue, &transparentQueue })
+    {
+      for (const QueuedDraw& queuedDraw : *queue)
+      {
+        const Model* model = scene.gameObjects.at(queuedDraw.goIndex).model;
+        RenderProcess::DrawData drawData;
+        drawData.boundsCenter = glm::vec4((model->boundsMin + model->boundsMax) * 0.5f, 0.0f);
+        drawData.boundsExtents = glm::vec4((model->boundsMax - model->boundsMin) * 0.5f, 0.0f);
+        drawData.objectIndex = static_cast<uint32_t>(queuedDraw.goIndex);
+        drawData.firstIndex = static_cast<uint32_t>(model->firstIndex);
+        drawData.indexCount = static_cast<uint32_t>(model->indexCount);
+        drawData.flags = queue == &opaqueQueue ? RenderProcess::drawDataFlagOpaque : 0u;
+        renderProcess->setDrawData(drawIndex++, drawData);
+      }
+    }
 
-    renderProcess->updateUniformBufferData();
+    renderProcess->beginGpuTimer(GpuTimer::OcclusionCulling);
+    occlusionCuller->cull(commandBuffer, descriptorSet, OcclusionCuller::Phase::First, drawCount, drawCapacity,
+                          renderResolution);
+    renderProcess->endGpuTimer(GpuTimer::OcclusionCulling);
   }
 
   const std::array clearValues = { VkClearValue({ 0.01f, 0.01f, 0.01f, 1.0f }), VkClearValue({ 1.0f, 0u }) };
@@ -357,10 +1205,11 @@ void Renderer::render(const glm::mat4& cameraMatrix, size_t swapchainImageIndex,
   renderPassBeginInfo.renderPass = headset->getVkRenderPass();
   renderPassBeginInfo.framebuffer = headset->getRenderTarget(swapchainImageIndex)->getFramebuffer();
   renderPassBeginInfo.renderArea.offset = { 0, 0 };
-  renderPassBeginInfo.renderArea.extent = headset->getEyeResolution(0u);
+  renderPassBeginInfo.renderArea.extent = renderResolution; // Dynamic resolution, only the top left part gets rendered
   renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
   renderPassBeginInfo.pClearValues = clearValues.data();
 
+  renderProcess->beginGpuTimer(GpuTimer::EyeRenderPass);
   vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
   // Set the viewport
@@ -379,46 +1228,88 @@ void Renderer::render(const glm::mat4& cameraMatrix, size_t swapchainImageIndex,
   scissor.extent = renderPassBeginInfo.renderArea.extent;
   vkCmdSetScissor(commandBuffer, 0u, 1u, &scissor);
 
-  // Bind the vertex section of the geometry buffer
-  VkDeviceSize vertexOffset = 0u;
+  // Bind the position and vertex sections of the geometry buffer
   const VkBuffer buffer = vertexIndexBuffer->getBuffer();
-  vkCmdBindVertexBuffers(commandBuffer, 0u, 1u, &buffer, &vertexOffset);
+  const std::array vertexBuffers = { buffer, buffer };
+  const std::array<VkDeviceSize, 2u> vertexOffsets = { 0u, vertexOffset };
+  vkCmdBindVertexBuffers(commandBuffer, 0u, static_cast<uint32_t>(vertexBuffers.size()), vertexBuffers.data(),
+                         vertexOffsets.data());
 
   // Bind the index section of the geometry buffer
   vkCmdBindIndexBuffer(commandBuffer, buffer, indexOffset, VK_INDEX_TYPE_UINT32);
 
-  // Draw each model
-  const VkDescriptorSet descriptorSet = renderProcess->getDescriptorSet();
-  for (size_t goIndex = 0u; goIndex < gameObjects.size(); ++goIndex)
+  // Bind the global uniform data once for the whole frame, all pipelines share the same pipeline layout. Culling binds
+  // to the compute bind point and leaves it alone.
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0u, 1u, &descriptorSet, 0u,
+                          nullptr);
+
+  // Depth prepass, lays down the depth of the opaque models so the main pass shades each pixel only once
+  BoundPipelineState boundPipelineState;
+  if (depthPrepassEnabled)
   {
-    const GameObject* gameObject = gameObjects.at(goIndex);
-    //std::printf("\n[Renderer][log] render() goIndex: {%d}, go.name: {%s}", goIndex, gameObject->name.c_str());
-    if(!gameObject->isVisible)
-      continue;
+    recordDraws(commandBuffer, scene, opaqueQueue, true, indirectBuffer, 0u, boundPipelineState);
+  }
+
+  vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
 
-    // Bind the uniform buffer for per model/mesh dynamic, vertex
-    const uint32_t uniformBufferOffset =
-      static_cast<uint32_t>(util::align(static_cast<VkDeviceSize>(sizeof(RenderProcess::DynamicVertexUniformData)),
-                                        context->getUniformBufferOffsetAlignment()) *
-                            static_cast<VkDeviceSize>(goIndex)); 
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0u, 1u, &descriptorSet, 1u,
-                            &uniformBufferOffset);
+  // Draw each model, opaque queue first. With occlusion culling only the opaque models the first phase let through.
+  recordDraws(commandBuffer, scene, opaqueQueue, false, indirectBuffer, 0u, boundPipelineState);
+  if (!indirectBuffer)
+  {
+    recordDraws(commandBuffer, scene, transparentQueue, false, nullptr, 0u, boundPipelineState);
+  }
 
-    // TODO: bind the DynamicMaterialxUniformData somehow... "per pipeline" uniform data...
+  vkCmdEndRenderPass(commandBuffer);
+  renderProcess->endGpuTimer(GpuTimer::EyeRenderPass);
 
-    // [tdbe] fetch the material for this GO and bind its "pipeline" to the command buffer.
-    gameObject->material->pipeline->bindPipeline(commandBuffer);
-    vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(gameObject->model->indexCount), 1u,
-                     static_cast<uint32_t>(gameObject->model->firstIndex), 0u, 0u);
+  if (!indirectBuffer)
+  {
+    return;
   }
 
+  // Build a new depth pyramid from what was drawn so far, and give the models the first phase culled a second chance
+  // against it. The second phase commands follow the first phase commands in the indirect buffer.
+  renderProcess->beginGpuTimer(GpuTimer::DepthPyramid);
+  occlusionCuller->buildDepthPyramid(commandBuffer, renderResolution);
+  occlusionCuller->cull(commandBuffer, descriptorSet, OcclusionCuller::Phase::Second, drawCount, drawCapacity,
+                        renderResolution);
+  renderProcess->endGpuTimer(GpuTimer::DepthPyramid);
+
+  // Continue rendering to the same framebuffer, without clearing it
+  renderPassBeginInfo.renderPass = headset->getVkContinuationRenderPass();
+  renderPassBeginInfo.clearValueCount = 0u;
+  renderPassBeginInfo.pClearValues = nullptr;
+  renderProcess->beginGpuTimer(GpuTimer::EyeContinuationRenderPass);
+  vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+  boundPipelineState = {};
+  if (depthPrepassEnabled)
+  {
+    recordDraws(commandBuffer, scene, opaqueQueue, true, indirectBuffer, drawCapacity, boundPipelineState);
+  }
+
+  vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+
+  recordDraws(commandBuffer, scene, opaqueQueue, false, indirectBuffer, drawCapacity, boundPipelineState);
+  recordDraws(commandBuffer, scene, transparentQueue, false, indirectBuffer, drawCapacity + opaqueQueue.size(),
+              boundPipelineState);
+
   vkCmdEndRenderPass(commandBuffer);
+  renderProcess->endGpuTimer(GpuTimer::EyeContinuationRenderPass);
+}
+
+void Renderer::updateViewProjection() const
+{
+  RenderProcess* renderProcess = renderProcesses.at(currentRenderProcessIndex);
+  updateViewProjectionMatrices(renderProcess);
+  renderProcess->updateViewProjectionUniformData();
 }
 
 void Renderer::submit(bool useSemaphores) const
 {
-  const RenderProcess* renderProcess = renderProcesses.at(currentRenderProcessIndex);
+  RenderProcess* renderProcess = renderProcesses.at(currentRenderProcessIndex);
   const VkCommandBuffer commandBuffer = renderProcess->getCommandBuffer();
+  renderProcess->writeFrameEndTimestamp();
   if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
   {
     return;
@@ -442,12 +1333,55 @@ void Renderer::submit(bool useSemaphores) const
     submitInfo.pSignalSemaphores = &presentableSemaphore;
   }
 
+  // The fence is only reset right before submitting, so that a frame that failed to record doesn't leave it unsignaled
+  // for the wait in render()
+  if (vkResetFences(context->getVkDevice(), 1u, &busyFence) != VK_SUCCESS)
+  {
+    return;
+  }
+
   if (vkQueueSubmit(context->getVkDrawQueue(), 1u, &submitInfo, busyFence) != VK_SUCCESS)
   {
     return;
   }
 }
 
+bool Renderer::getGpuFrameTime(float& milliseconds) const
+{
+  if (!gpuFrameTimeUpdated)
+  {
+    return false;
+  }
+
+  milliseconds = gpuFrameTime;
+  return true;
+}
+
+float Renderer::getFenceWaitTime() const
+{
+  return fenceWaitTime;
+}
+
+size_t Renderer::getFramesInFlightCount() const
+{
+  return renderProcesses.size();
+}
+
+const GpuProfiler& Renderer::getGpuProfiler() const
+{
+  return gpuProfiler;
+}
+
+void Renderer::beginGpuTimer(GpuTimer timer) const
+{
+  renderProcesses.at(currentRenderProcessIndex)->beginGpuTimer(timer);
+}
+
+void Renderer::endGpuTimer(GpuTimer timer) const
+{
+  renderProcesses.at(currentRenderProcessIndex)->endGpuTimer(timer);
+}
+
 bool Renderer::isValid() const
 {
   return valid;
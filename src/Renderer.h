@@ -4,19 +4,27 @@
 
 #include <vulkan/vulkan.h>
 
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "GameData.h"
+#include "GpuProfiler.h"
 
 
 class Context;
 class DataBuffer;
 class Headset;
 class MeshData;
+class OcclusionCuller;
 struct Model;
 struct Material;
 class Pipeline;
+class PipelineLibraryCache;
 class RenderProcess;
+class Texture;
+class TextureStreamer;
+class ThreadPool;
 
 /*
  * The renderer class facilitates rendering with Vulkan. It is initialized with a constant list of models to render and
@@ -31,12 +39,82 @@ class RenderProcess;
 class Renderer final
 {
 public:
-  Renderer(const Context* context, const Headset* headset, const MeshData* meshData, const std::vector<Material*>& materials, const std::vector<GameObject*>& gameObjects);
+  // [tdbe] where the vertex shaders get the world matrix and material index of each draw from. Push constants are
+  // recorded per draw with vkCmdPushConstants, the object table is a storage buffer that gets uploaded once per frame
+  // and only where objects changed, and nothing gets pushed for it. The source is a specialization constant of every
+  // pipeline, so it's chosen once at construction. Occlusion culling reads the object table either way.
+  enum class ObjectDataSource
+  {
+    PushConstants,
+    ObjectTable
+  };
+
+  // [tdbe] frames in flight is the number of frames the CPU can record while the GPU still works on earlier ones,
+  // clamped to [1, 3]. Each one gets its own render process.
+  Renderer(const Context* context,
+           const Headset* headset,
+           const MeshData* meshData,
+           const std::vector<Material*>& materials,
+           const std::vector<GameObject*>& gameObjects,
+           size_t framesInFlightCount,
+           ObjectDataSource objectDataSource = ObjectDataSource::ObjectTable);
   ~Renderer();
 
-  void render(const glm::mat4& cameraMatrix, size_t swapchainImageIndex, float time);
+  // [tdbe] scene API, materials and game objects can be (un)registered at any time after construction. Materials get
+  // their pipeline on demand, adding a game object also adds its material. Note that models have to be part of the
+  // mesh data the renderer was created with. A material can only be removed once no game object uses it anymore, until
+  // then removeMaterial() returns false.
+  bool addMaterial(Material* material);
+  bool removeMaterial(Material* material);
+  bool addGameObject(GameObject* gameObject);
+  void removeGameObject(GameObject* gameObject);
+  // [tdbe] loads a texture from a KTX2 file (see Texture.h) and adds it to the bindless texture array. Returns its
+  // index for DynamicMaterialUniformData::baseColorTexture, or 0 (plain white) on error. Only the mip tail gets
+  // uploaded by the render thread with the next frame, the detailed levels are read from the file and streamed in once
+  // objects show the texture up close. Textures can be added at any time, from the thread that captures the scene.
+  uint32_t addTexture(const std::string& filename);
+  // [tdbe] same for a generated texture from the pixel data of its mip levels, which can't be larger than 64x64 texels
+  uint32_t addTexture(VkExtent2D size, VkFormat format, const std::vector<std::vector<uint8_t>>& mipLevels);
+
+  // [tdbe] the depth prepass draws opaque models depth-only first, the main pass then only shades the visible pixels.
+  void setDepthPrepassEnabled(bool enabled);
+  bool isDepthPrepassEnabled() const;
+
+  // [tdbe] occlusion culling tests the bounding box of each model against a depth pyramid on the GPU, and skips the
+  // models that are hidden behind others. See OcclusionCuller.h.
+  void setOcclusionCullingEnabled(bool enabled);
+  bool isOcclusionCullingEnabled() const;
+
+  ObjectDataSource getObjectDataSource() const;
+
+  // [tdbe] how much device memory the streamed mip levels of the textures may take up, in bytes. See TextureStreamer.h.
+  void setTextureBudget(VkDeviceSize budget);
+  VkDeviceSize getTextureBudget() const;
+
+  // [tdbe] threading: the scene API and captureScene() belong to the simulation thread, the rest (the toggles above as
+  // well) to the render thread. The render thread only sees the game objects through the scene snapshots.
+  // Copies what is needed to render the game objects into the snapshot, 'cameraMatrix' transforms from world to stage
+  // space.
+  void captureScene(SceneSnapshot& scene, const glm::mat4& cameraMatrix, float time) const;
+  void render(const SceneSnapshot& scene, size_t swapchainImageIndex);
+  // [tdbe] late latching: rewrites only the view projection matrices of the current frame from the current eye poses
+  // of the headset (see Headset::lateLatchEyePoses()), with the camera matrix of the rendered scene. Call it after
+  // render() and before submit(), the command buffer reads the uniform buffer only once it executes.
+  void updateViewProjection() const;
   void submit(bool useSemaphores) const;
 
+  // How long the GPU took for an earlier frame, in milliseconds. Returns false if no new measurement came in during the
+  // last call to render(), measurements arrive a few frames late and not at all without timestamp support.
+  bool getGpuFrameTime(float& milliseconds) const;
+  // How long the last call to render() waited for the GPU to finish the frame in flight it reuses, in milliseconds
+  float getFenceWaitTime() const;
+  size_t getFramesInFlightCount() const;
+  // Rolling averages of the GPU timers of recent frames, see GpuProfiler.h
+  const GpuProfiler& getGpuProfiler() const;
+  // Time work recorded into the current command buffer by others, e.g. the mirror view, outside of render passes
+  void beginGpuTimer(GpuTimer timer) const;
+  void endGpuTimer(GpuTimer timer) const;
+
   bool isValid() const;
   VkCommandBuffer getCurrentCommandBuffer() const;
   VkSemaphore getCurrentDrawableSemaphore() const;
@@ -54,11 +132,84 @@ private:
   std::vector<RenderProcess*> renderProcesses;
   VkPipelineLayout pipelineLayout = nullptr;
   std::vector<Pipeline *> pipelines;
+  std::unordered_map<PipelineKey, Pipeline*, PipelineKey::Hash> pipelinesByKey;
+  ThreadPool* threadPool = nullptr; // Compiles pipelines in parallel, and in the background after startup
+  PipelineLibraryCache* pipelineLibraryCache = nullptr; // Only with VK_EXT_graphics_pipeline_library
+  const Pipeline* fallbackPipeline = nullptr;             // Bound in place of pipelines that are still compiling
+  const Pipeline* fallbackDepthPrepassPipeline = nullptr;
+  const Pipeline* fallbackDepthEqualPipeline = nullptr;   // Main pass after the prepass
+  bool compilePipelinesAsync = false;
+  std::vector<VkVertexInputBindingDescription> vertexInputBindingDescriptions;
+  std::vector<VkVertexInputAttributeDescription> vertexInputAttributeDescriptions;
   DataBuffer* vertexIndexBuffer = nullptr;
   std::vector<Material*> materials;
+  std::vector<const Material*> materialTable; // By material index, null for free entries
+  std::vector<Texture*> textures;             // By texture index
+  VkSampler textureSampler = nullptr;
+  TextureStreamer* textureStreamer = nullptr;
   std::vector<GameObject*> gameObjects;
+  size_t vertexOffset = 0u;
   size_t indexOffset = 0u;
   size_t currentRenderProcessIndex = 0u;
+  glm::mat4 cameraMatrix = glm::mat4(1.0f); // Of the scene last passed to render()
+  bool depthPrepassEnabled = true;
+  OcclusionCuller* occlusionCuller = nullptr;
+  bool occlusionCullingEnabled = true;
+  const ObjectDataSource objectDataSource;
+  float gpuFrameTime = 0.0f;
+  bool gpuFrameTimeUpdated = false;
+  GpuProfiler gpuProfiler;
+  float fenceWaitTime = 0.0f;
+
+  // [tdbe] visible game objects, sorted by their distance to the midpoint between the eyes. Kept around so they don't
+  // get reallocated every frame.
+  struct QueuedDraw
+  {
+    size_t goIndex = 0u;
+    float distanceSquared = 0.0f;
+  };
+  std::vector<QueuedDraw> opaqueQueue, transparentQueue;
+
+  // What recordDraws() last set on the command buffer, so that it only changes what differs between draws
+  struct BoundPipelineState
+  {
+    const Pipeline* pipeline = nullptr;
+    PipelineMaterialPayload pipelineData;
+  };
+
+  // [tdbe] everything a pipeline gets created from. Pipelines with the same shaders and pipeline data are shared.
+  struct PipelineDescription
+  {
+    std::string vertShader, fragShader;
+    PipelineMaterialPayload pipelineData;
+    uint32_t subpass = 0u;
+    std::vector<VkVertexInputBindingDescription> bindingDescriptions;
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+
+    PipelineKey getKey(ShaderLibrary& shaderLibrary) const
+    {
+      return PipelineKey::create(shaderLibrary, vertShader, fragShader, pipelineData);
+    }
+  };
 
-  const int findExistingPipeline(const std::string& vertShader, const std::string& fragShader, const PipelineMaterialPayload& pipelineData) const;
+  Pipeline* findOrCreatePipeline(const PipelineDescription& description);
+  void updateViewProjectionMatrices(RenderProcess* renderProcess) const;
+  PipelineMaterialPayload getStaticPipelineData(const PipelineMaterialPayload& pipelineData) const;
+  void getPipelineDescriptions(const Material* material, std::vector<PipelineDescription>& descriptions) const;
+  const Pipeline* findFallbackPipeline(const PipelineDescription& description) const;
+  bool assignPipelines(Material* material);
+  void assignMaterialIndex(Material* material);
+  void requestTextureMipLevels(const SceneSnapshot& scene) const;
+  // Takes ownership of the texture, returns its index or 0 on error
+  uint32_t insertTexture(Texture* texture);
+  const Pipeline* getDrawPipeline(const GameObjectSnapshot& gameObject,
+                                  bool depthPrepass,
+                                  PipelineMaterialPayload& pipelineData) const;
+  void recordDraws(VkCommandBuffer commandBuffer,
+                   const SceneSnapshot& scene,
+                   const std::vector<QueuedDraw>& queue,
+                   bool depthPrepass,
+                   VkBuffer indirectBuffer,
+                   size_t firstIndirectCommand,
+                   BoundPipelineState& boundPipelineState) const;
 };
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "ShaderLibrary.h"
+
+#include "EmbeddedShaders.h"
+#include "Util.h"
+
+#include <cstdlib>
+#include <sstream>
+
+namespace
+{
+constexpr const char* overrideDirectoryVariable = "SHADER_OVERRIDE_DIR";
+} // namespace
+
+ShaderLibrary::ShaderLibrary(VkDevice device) : device(device)
+{
+  const char* directory = std::getenv(overrideDirectoryVariable);
+  if (directory)
+  {
+    overrideDirectory = directory;
+  }
+}
+
+ShaderLibrary::~ShaderLibrary()
+{
+  for (const auto& [handle, shader] : shaders)
+  {
+    vkDestroyShaderModule(device, shader.shaderModule, nullptr);
+  }
+}
+
+bool ShaderLibrary::acquire(const std::string& filename, Handle& handle)
+{
+  const std::lock_guard<std::mutex> lock(mutex);
+  handle = internFilename(filename);
+
+  const auto it = shaders.find(handle);
+  if (it != shaders.end())
+  {
+    ++it->second.referenceCount;
+    return true;
+  }
+
+  // Loading the shader while holding the lock keeps two threads from loading the same one
+  Shader shader;
+  shader.referenceCount = 1u;
+  if (!loadShader(filename, shader.shaderModule))
+  {
+    std::stringstream s;
+    s << "Shader \"" << filename << "\"";
+    util::error(Error::FileMissing, s.str());
+    return false;
+  }
+
+  shaders.emplace(handle, shader);
+  return true;
+}
+
+void ShaderLibrary::release(Handle handle)
+{
+  const std::lock_guard<std::mutex> lock(mutex);
+  const auto it = shaders.find(handle);
+  if (it == shaders.end())
+  {
+    return;
+  }
+
+  if (--it->second.referenceCount == 0u)
+  {
+    vkDestroyShaderModule(device, it->second.shaderModule, nullptr);
+    shaders.erase(it);
+  }
+}
+
+VkShaderModule ShaderLibrary::getShaderModule(Handle handle) const
+{
+  const std::lock_guard<std::mutex> lock(mutex);
+  const auto it = shaders.find(handle);
+  if (it == shaders.end())
+  {
+    return nullptr;
+  }
+
+  return it->second.shaderModule;
+}
+
+ShaderLibrary::Handle ShaderLibrary::getHandle(const std::string& filename)
+{
+  const std::lock_guard<std::mutex> lock(mutex);
+  return internFilename(filename);
+}
+
+ShaderLibrary::Handle ShaderLibrary::internFilename(const std::string& filename)
+{
+  // The next free handle if the file path is new
+  return handles.emplace(filename, static_cast<Handle>(handles.size())).first->second;
+}
+
+bool ShaderLibrary::loadShader(const std::string& filename, VkShaderModule& shaderModule) const
+{
+  if (!overrideDirectory.empty() && util::loadShaderFromFile(device, overrideDirectory + "/" + filename, shaderModule))
+  {
+    return true;
+  }
+
+  const embeddedShaders::Shader* embeddedShader = embeddedShaders::find(filename);
+  if (embeddedShader)
+  {
+    return util::createShaderModule(device, embeddedShader->code, embeddedShader->codeSize, shaderModule);
+  }
+
+  return util::loadShaderFromFile(device, filename, shaderModule);
+}
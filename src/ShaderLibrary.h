@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/*
+ * The shader library class loads each SPIR-V shader only once and shares its shader module between everything
+ * that uses it, e.g. all pipelines of materials with the same shaders. Shaders are identified by a handle, a small
+ * ID that the library interns for each file path, so two paths never share a handle. Shaders are reference counted: a
+ * shader module lives from the first acquire() until the last matching release(). The library is owned by the
+ * context, and is safe to use from several threads at once, e.g. while pipelines compile in parallel.
+ * Shaders come from the binaries embedded into the executable (see EmbeddedShaders.h), without any file I/O. Shaders
+ * that aren't embedded get loaded from their file instead. Setting the SHADER_OVERRIDE_DIR environment variable makes
+ * the library prefer the files in that directory (under the same relative path), e.g. to try out shader changes
+ * without rebuilding.
+ */
+class ShaderLibrary final
+{
+public:
+  using Handle = uint32_t;
+
+  explicit ShaderLibrary(VkDevice device);
+  ~ShaderLibrary(); // Destroys all shader modules, released or not
+
+  ShaderLibrary(const ShaderLibrary&) = delete;
+  ShaderLibrary& operator=(const ShaderLibrary&) = delete;
+
+  // Loads the shader 'filename' unless it is loaded already, and adds a reference to it. Returns false on error.
+  bool acquire(const std::string& filename, Handle& handle);
+  // Removes a reference, the shader module is destroyed with the last one
+  void release(Handle handle);
+
+  // Returns nullptr for a handle without references
+  VkShaderModule getShaderModule(Handle handle) const;
+
+  // The handle of 'filename', whether it is loaded or not. Handles are handed out in order starting at 0, and stay the
+  // same for as long as the library lives.
+  Handle getHandle(const std::string& filename);
+
+private:
+  struct Shader
+  {
+    VkShaderModule shaderModule = nullptr;
+    size_t referenceCount = 0u;
+  };
+
+  VkDevice device = nullptr;
+  std::string overrideDirectory; // Empty without SHADER_OVERRIDE_DIR
+  std::unordered_map<std::string, Handle> handles; // The interned file paths, never removed
+  std::unordered_map<Handle, Shader> shaders;
+  mutable std::mutex mutex; // Guards the handles and the shaders
+
+  Handle internFilename(const std::string& filename); // The mutex has to be locked
+
+  bool loadShader(const std::string& filename, VkShaderModule& shaderModule) const;
+};
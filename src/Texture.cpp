@@ -0,0 +1,395 @@
+#include "Texture.h"
+
+#include "Context.h"
+#include "ImageBuffer.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+// Staging buffer offsets have to be a multiple of the texel block size, this covers all formats
+constexpr VkDeviceSize mipLevelAlignment = 16u;
+// Mip levels this size and smaller make up the mip tail, which gets uploaded at creation and never evicted
+constexpr uint32_t maxMipTailSize = 64u;
+
+// The fixed size part of a KTX2 file, see the KTX 2.0 specification
+struct Ktx2Header
+{
+  uint8_t identifier[12];
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth, pixelHeight, pixelDepth;
+  uint32_t layerCount, faceCount, levelCount;
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset, dfdByteLength;
+  uint32_t kvdByteOffset, kvdByteLength;
+  uint64_t sgdByteOffset, sgdByteLength;
+};
+static_assert(sizeof(Ktx2Header) == 80u, "KTX2 header layout doesn't match the file");
+
+// Follows the header, one per mip level starting with the full size one
+struct Ktx2Level
+{
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+constexpr std::array<uint8_t, 12u> ktx2Identifier = { 0xABu, 0x4Bu, 0x54u, 0x58u, 0x20u, 0x32u,
+                                                      0x30u, 0xBBu, 0x0Du, 0x0Au, 0x1Au, 0x0Au };
+
+VkExtent2D getMipLevelSize(VkExtent2D size, uint32_t mipLevel)
+{
+  return { std::max(size.width >> mipLevel, 1u), std::max(size.height >> mipLevel, 1u) };
+}
+
+uint32_t getMipLevelCount(VkExtent2D size)
+{
+  uint32_t mipLevelCount = 1u;
+  while ((std::max(size.width, size.height) >> mipLevelCount) > 0u)
+  {
+    ++mipLevelCount;
+  }
+  return mipLevelCount;
+}
+} // namespace
+
+Texture::Texture(const Context* context, const std::string& filename) : context(context), filename(filename)
+{
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.is_open())
+  {
+    util::error(Error::FileMissing, filename);
+    valid = false;
+    return;
+  }
+
+  Ktx2Header header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      memcmp(header.identifier, ktx2Identifier.data(), ktx2Identifier.size()) != 0)
+  {
+    util::error(Error::TextureLoadingFailure, "\"" + filename + "\" is not a KTX2 file");
+    valid = false;
+    return;
+  }
+
+  // A level count of 0 asks for the mip levels to be generated, but streaming needs them in the file
+  size = { header.pixelWidth, header.pixelHeight };
+  format = static_cast<VkFormat>(header.vkFormat);
+  if (format == VK_FORMAT_UNDEFINED || header.supercompressionScheme != 0u || header.pixelWidth == 0u ||
+      header.pixelHeight == 0u || header.pixelDepth != 0u || header.layerCount > 1u || header.faceCount != 1u ||
+      header.levelCount == 0u || header.levelCount > getMipLevelCount(size))
+  {
+    util::error(Error::TextureLoadingFailure,
+                "\"" + filename + "\" is not a 2D texture with mip levels in a format Vulkan samples as is");
+    valid = false;
+    return;
+  }
+
+  std::vector<Ktx2Level> levels(header.levelCount);
+  const std::streamsize levelIndexSize = static_cast<std::streamsize>(levels.size() * sizeof(Ktx2Level));
+  if (!file.read(reinterpret_cast<char*>(levels.data()), levelIndexSize))
+  {
+    util::error(Error::TextureLoadingFailure, filename);
+    valid = false;
+    return;
+  }
+
+  for (const Ktx2Level& level : levels)
+  {
+    mipLevelOffsets.push_back(level.byteOffset);
+    mipLevelSizes.push_back(level.byteLength);
+  }
+
+  initMipTail();
+
+  // The mip tail gets uploaded with the next frame, so it is read right away rather than on the render thread
+  for (uint32_t mipLevel = mipTailLevel; mipLevel < header.levelCount; ++mipLevel)
+  {
+    std::vector<uint8_t>& pixelData = mipTailLevels.emplace_back(mipLevelSizes.at(mipLevel));
+    file.seekg(static_cast<std::streamoff>(mipLevelOffsets.at(mipLevel)));
+    if (!file.read(reinterpret_cast<char*>(pixelData.data()), static_cast<std::streamsize>(pixelData.size())))
+    {
+      util::error(Error::TextureLoadingFailure, filename);
+      valid = false;
+      return;
+    }
+  }
+}
+
+Texture::Texture(const Context* context,
+                 VkExtent2D size,
+                 VkFormat format,
+                 const std::vector<std::vector<uint8_t>>& mipLevels)
+: context(context), size(size), format(format), mipTailLevels(mipLevels)
+{
+  if (mipLevels.empty())
+  {
+    util::error(Error::TextureLoadingFailure, "Texture without pixel data");
+    valid = false;
+    return;
+  }
+
+  for (const std::vector<uint8_t>& pixelData : mipLevels)
+  {
+    mipLevelSizes.push_back(pixelData.size());
+  }
+
+  initMipTail();
+  if (mipTailLevel > 0u)
+  {
+    util::error(Error::TextureLoadingFailure, "Generated textures can't be larger than their mip tail");
+    valid = false;
+    return;
+  }
+}
+
+Texture::~Texture()
+{
+  delete imageBuffer;
+}
+
+bool Texture::isValid() const
+{
+  return valid;
+}
+
+VkImageView Texture::getImageView() const
+{
+  return imageBuffer ? imageBuffer->getImageView() : nullptr;
+}
+
+void Texture::initMipTail()
+{
+  // The mip tail starts at the first small enough level, or at the last level if the mip chain stops before that
+  const uint32_t mipLevelCount = static_cast<uint32_t>(mipLevelSizes.size());
+  mipTailLevel = mipLevelCount - 1u;
+  for (uint32_t mipLevel = 0u; mipLevel < mipLevelCount; ++mipLevel)
+  {
+    const VkExtent2D mipLevelSize = getMipLevelSize(size, mipLevel);
+    if (std::max(mipLevelSize.width, mipLevelSize.height) <= maxMipTailSize)
+    {
+      mipTailLevel = mipLevel;
+      break;
+    }
+  }
+
+  // Nothing is resident yet
+  residentMipLevel = mipLevelCount;
+}
+
+VkExtent2D Texture::getSize() const
+{
+  return size;
+}
+
+uint32_t Texture::getMipTailLevel() const
+{
+  return mipTailLevel;
+}
+
+uint32_t Texture::getResidentMipLevel() const
+{
+  return residentMipLevel;
+}
+
+VkDeviceSize Texture::getMipLevelsSize(uint32_t mipLevel) const
+{
+  VkDeviceSize mipLevelsSize = 0u;
+  for (size_t levelIndex = mipLevel; levelIndex < mipLevelSizes.size(); ++levelIndex)
+  {
+    mipLevelsSize += mipLevelSizes.at(levelIndex);
+  }
+  return mipLevelsSize;
+}
+
+VkDeviceSize Texture::getStagingSize(uint32_t mipLevel) const
+{
+  std::vector<VkBufferImageCopy> uploadRegions;
+  return getUploadRegions(mipLevel, uploadRegions);
+}
+
+void Texture::fillStagingData(uint32_t mipLevel, uint8_t* stagingData) const
+{
+  std::vector<VkBufferImageCopy> uploadRegions;
+  getUploadRegions(mipLevel, uploadRegions);
+
+  // The regions are relative to the first uploaded level
+  mipLevel = std::min(mipLevel, mipTailLevel);
+  std::ifstream file;
+  for (const VkBufferImageCopy& uploadRegion : uploadRegions)
+  {
+    const uint32_t levelIndex = uploadRegion.imageSubresource.mipLevel + mipLevel;
+    uint8_t* levelStagingData = stagingData + uploadRegion.bufferOffset;
+    if (levelIndex >= mipTailLevel)
+    {
+      const std::vector<uint8_t>& pixelData = mipTailLevels.at(levelIndex - mipTailLevel);
+      memcpy(levelStagingData, pixelData.data(), pixelData.size());
+      continue;
+    }
+
+    // Only the streamed levels come from the file, and only get read when they stream in
+    if (!file.is_open())
+    {
+      file.open(filename, std::ios::binary);
+    }
+
+    const VkDeviceSize levelSize = mipLevelSizes.at(levelIndex);
+    file.seekg(static_cast<std::streamoff>(mipLevelOffsets.at(levelIndex)));
+    if (!file.read(reinterpret_cast<char*>(levelStagingData), static_cast<std::streamsize>(levelSize)))
+    {
+      // The level still gets uploaded, black rather than whatever the staging ring held before
+      util::error(Error::TextureLoadingFailure, filename);
+      memset(levelStagingData, 0, static_cast<size_t>(levelSize));
+      file.clear();
+    }
+  }
+}
+
+VkDeviceSize Texture::getUploadRegions(uint32_t mipLevel, std::vector<VkBufferImageCopy>& uploadRegions) const
+{
+  // The new image holds the levels [mipLevel, mipLevelCount), of which [mipLevel, uploadEndLevel) get uploaded and
+  // [uploadEndLevel, mipLevelCount) get copied over from the old image
+  mipLevel = std::min(mipLevel, mipTailLevel);
+  const uint32_t mipLevelCount = static_cast<uint32_t>(mipLevelSizes.size());
+  const uint32_t uploadEndLevel = std::max(mipLevel, std::min(residentMipLevel, mipLevelCount));
+
+  // Lay out the uploaded mip levels one after the other, with a copy region each
+  uploadRegions.resize(uploadEndLevel - mipLevel);
+  VkDeviceSize stagingSize = 0u;
+  for (uint32_t levelIndex = mipLevel; levelIndex < uploadEndLevel; ++levelIndex)
+  {
+    const VkExtent2D mipLevelSize = getMipLevelSize(size, levelIndex);
+    VkBufferImageCopy& uploadRegion = uploadRegions.at(levelIndex - mipLevel);
+    uploadRegion = {};
+    uploadRegion.bufferOffset = stagingSize;
+    uploadRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    uploadRegion.imageSubresource.mipLevel = levelIndex - mipLevel;
+    uploadRegion.imageSubresource.baseArrayLayer = 0u;
+    uploadRegion.imageSubresource.layerCount = 1u;
+    uploadRegion.imageExtent = { mipLevelSize.width, mipLevelSize.height, 1u };
+
+    stagingSize = util::align(stagingSize + mipLevelSizes.at(levelIndex), mipLevelAlignment);
+  }
+  return stagingSize;
+}
+
+bool Texture::setResidentMipLevel(uint32_t mipLevel,
+                                  VkCommandBuffer commandBuffer,
+                                  VkBuffer stagingBuffer,
+                                  VkDeviceSize stagingOffset,
+                                  ImageBuffer*& oldImageBuffer)
+{
+  oldImageBuffer = nullptr;
+
+  mipLevel = std::min(mipLevel, mipTailLevel);
+  if (mipLevel == residentMipLevel)
+  {
+    return true;
+  }
+
+  std::vector<VkBufferImageCopy> copyRegions;
+  getUploadRegions(mipLevel, copyRegions);
+  for (VkBufferImageCopy& copyRegion : copyRegions)
+  {
+    copyRegion.bufferOffset += stagingOffset;
+  }
+
+  // The levels [mipLevel, uploadEndLevel) get uploaded, the rest gets copied over from the old image
+  const uint32_t mipLevelCount = static_cast<uint32_t>(mipLevelSizes.size());
+  const uint32_t uploadEndLevel = mipLevel + static_cast<uint32_t>(copyRegions.size());
+
+  ImageBuffer* newImageBuffer =
+    new ImageBuffer(context, getMipLevelSize(size, mipLevel), format,
+                    VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                    VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_ASPECT_COLOR_BIT, 1u, mipLevelCount - mipLevel);
+  if (!newImageBuffer->isValid())
+  {
+    delete newImageBuffer;
+    return false;
+  }
+
+  // Transition all mip levels of the new image for the copies, and the old image for reading from it. Frames that were
+  // submitted earlier may still sample the old image.
+  std::array<VkImageMemoryBarrier, 2u> imageMemoryBarriers;
+  VkImageMemoryBarrier& newImageBarrier = imageMemoryBarriers.at(0u);
+  newImageBarrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+  newImageBarrier.image = newImageBuffer->getImage();
+  newImageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  newImageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  newImageBarrier.srcAccessMask = 0u;
+  newImageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  newImageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  newImageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  newImageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  newImageBarrier.subresourceRange.baseMipLevel = 0u;
+  newImageBarrier.subresourceRange.levelCount = mipLevelCount - mipLevel;
+  newImageBarrier.subresourceRange.baseArrayLayer = 0u;
+  newImageBarrier.subresourceRange.layerCount = 1u;
+
+  const bool copyFromOldImage = imageBuffer && uploadEndLevel < mipLevelCount;
+  VkImageMemoryBarrier& oldImageBarrier = imageMemoryBarriers.at(1u);
+  oldImageBarrier = newImageBarrier;
+  if (copyFromOldImage)
+  {
+    oldImageBarrier.image = imageBuffer->getImage();
+    oldImageBarrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    oldImageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    oldImageBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    oldImageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    oldImageBarrier.subresourceRange.levelCount = mipLevelCount - residentMipLevel;
+  }
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0u, 0u,
+                       nullptr, 0u, nullptr, copyFromOldImage ? 2u : 1u, imageMemoryBarriers.data());
+
+  if (!copyRegions.empty())
+  {
+    vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, newImageBuffer->getImage(),
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copyRegions.size()),
+                           copyRegions.data());
+  }
+
+  if (copyFromOldImage)
+  {
+    std::vector<VkImageCopy> imageCopies;
+    for (uint32_t levelIndex = uploadEndLevel; levelIndex < mipLevelCount; ++levelIndex)
+    {
+      const VkExtent2D mipLevelSize = getMipLevelSize(size, levelIndex);
+      VkImageCopy imageCopy{};
+      imageCopy.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      imageCopy.srcSubresource.mipLevel = levelIndex - residentMipLevel;
+      imageCopy.srcSubresource.baseArrayLayer = 0u;
+      imageCopy.srcSubresource.layerCount = 1u;
+      imageCopy.dstSubresource = imageCopy.srcSubresource;
+      imageCopy.dstSubresource.mipLevel = levelIndex - mipLevel;
+      imageCopy.extent = { mipLevelSize.width, mipLevelSize.height, 1u };
+      imageCopies.push_back(imageCopy);
+    }
+
+    vkCmdCopyImage(commandBuffer, imageBuffer->getImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   newImageBuffer->getImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   static_cast<uint32_t>(imageCopies.size()), imageCopies.data());
+  }
+
+  newImageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  newImageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  newImageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  newImageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0u, 0u,
+                       nullptr, 0u, nullptr, 1u, &newImageBarrier);
+
+  // Nothing samples the old image after this, the descriptors get pointed to the new one before the next frame that
+  // uses them is recorded
+  oldImageBuffer = imageBuffer;
+  imageBuffer = newImageBuffer;
+  residentMipLevel = mipLevel;
+
+  // The mip tail is never evicted, so its pixel data isn't needed anymore once it is uploaded
+  mipTailLevels.clear();
+  mipTailLevels.shrink_to_fit();
+  return true;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Context;
+class ImageBuffer;
+
+/*
+ * The texture class holds a sampled image in device local memory. Only a range of its mip levels is resident on the
+ * GPU: the mip tail, the small levels of up to 64x64 texels, always is, the more detailed levels get streamed in and
+ * evicted again (see TextureStreamer.h). Textures aren't bound per material, the renderer adds them to the texture
+ * array of its descriptor set and materials refer to them by index (see Renderer::addTexture()).
+ * [tdbe] textures come from KTX2 files, which have an index of where each mip level is. Only the mip tail is read up
+ * front, and its pixel data is dropped once it is uploaded. The detailed levels are read from the file every time they
+ * stream in, so they never take up memory outside of the staging ring.
+ */
+class Texture final
+{
+public:
+  // Reads the level index and the mip tail of the KTX2 file at 'filename'. Only files in a format that Vulkan samples
+  // as is are supported, i.e. with a vkFormat and without supercompression. Nothing is resident yet, the texture
+  // streamer uploads the mip tail on the render thread before the texture is first used.
+  Texture(const Context* context, const std::string& filename);
+  // A generated texture, 'mipLevels' holds the pixel data of each mip level in 'format', starting with the full 'size'
+  // level. There is no file to read them from again, so all of them have to be part of the mip tail.
+  Texture(const Context* context, VkExtent2D size, VkFormat format, const std::vector<std::vector<uint8_t>>& mipLevels);
+  ~Texture();
+
+  bool isValid() const;
+  // Covers the resident mip levels only, so it changes whenever they do. Null until the mip tail is uploaded.
+  VkImageView getImageView() const;
+  VkExtent2D getSize() const;
+
+  // The first level of the mip tail, the most detailed level that never gets evicted
+  uint32_t getMipTailLevel() const;
+  // The most detailed mip level that is resident, the levels from there up to the last one are. The mip level count
+  // until the mip tail is uploaded.
+  uint32_t getResidentMipLevel() const;
+  // How much device memory the mip levels from 'mipLevel' on take up, estimated from their pixel data
+  VkDeviceSize getMipLevelsSize(uint32_t mipLevel) const;
+
+  // How much staging memory setResidentMipLevel('mipLevel') uploads from, 0 if it only copies or drops levels
+  VkDeviceSize getStagingSize(uint32_t mipLevel) const;
+  // Writes the pixel data that setResidentMipLevel('mipLevel') uploads to 'stagingData', getStagingSize() bytes. The
+  // detailed levels are read from the file right here. It only reads what never changes while the texture is in use,
+  // so it can run on another thread, as long as the resident mip level stays the same until setResidentMipLevel().
+  void fillStagingData(uint32_t mipLevel, uint8_t* stagingData) const;
+  // Replaces the image with one that holds the mip levels from 'mipLevel' on (clamped to the mip tail), copying the
+  // levels both have in common from the old image and uploading the rest from 'stagingBuffer' at 'stagingOffset',
+  // which fillStagingData() has to have filled. Records into 'commandBuffer' without submitting it. The old image is
+  // handed back, it can be null, and has to be kept alive until the GPU is done with the recorded commands and all
+  // frames that used it.
+  bool setResidentMipLevel(uint32_t mipLevel,
+                           VkCommandBuffer commandBuffer,
+                           VkBuffer stagingBuffer,
+                           VkDeviceSize stagingOffset,
+                           ImageBuffer*& oldImageBuffer);
+
+private:
+  bool valid = true;
+
+  const Context* context = nullptr;
+  VkExtent2D size = { 0u, 0u };
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  std::string filename;                            // Of the KTX2 file, empty for generated textures
+  std::vector<VkDeviceSize> mipLevelOffsets;       // Into the file, by mip level
+  std::vector<VkDeviceSize> mipLevelSizes;         // In bytes, by mip level
+  std::vector<std::vector<uint8_t>> mipTailLevels; // Pixel data of the mip tail, until it is uploaded
+  uint32_t mipTailLevel = 0u;
+  uint32_t residentMipLevel = 0u;
+  ImageBuffer* imageBuffer = nullptr;
+
+  // Finds the first level of the mip tail from the mip level sizes, nothing is resident after this
+  void initMipTail();
+  // The mip levels that setResidentMipLevel('mipLevel') uploads, with their offsets into the staging data. Returns the
+  // size of the staging data.
+  VkDeviceSize getUploadRegions(uint32_t mipLevel, std::vector<VkBufferImageCopy>& uploadRegions) const;
+};
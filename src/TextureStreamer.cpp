@@ -0,0 +1,392 @@
+#include "TextureStreamer.h"
+
+#include "CpuProfiler.h"
+#include "DataBuffer.h"
+#include "RenderProcess.h"
+#include "Texture.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace
+{
+// Spreads the uploads of big textures over several frames, a single mip level can still go over it
+constexpr VkDeviceSize maxUploadSizePerFrame = 16u * 1024u * 1024u;
+// Enough for the uploads of a few frames to be on their way at once. Mip levels bigger than all of it, e.g. above
+// 4096x4096 texels in RGBA8, never stream in.
+constexpr VkDeviceSize stagingRingSize = 4u * maxUploadSizePerFrame;
+// Mip levels that were needed this recently don't get evicted, so that they don't stream in and out again when an
+// object moves back and forth around the distance where its mip level changes
+constexpr uint64_t minUnneededFrameCount = 90u;
+} // namespace
+
+TextureStreamer::TextureStreamer(const Context* context,
+                                 ThreadPool* threadPool,
+                                 VkDeviceSize budget,
+                                 size_t framesInFlightCount)
+: context(context), budget(budget), framesInFlightCount(framesInFlightCount), threadPool(threadPool)
+{
+  stagingBuffer = new DataBuffer(context, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                 stagingRingSize);
+  stagingData = stagingBuffer->isValid() ? static_cast<uint8_t*>(stagingBuffer->map()) : nullptr;
+  if (!stagingData)
+  {
+    valid = false;
+    return;
+  }
+}
+
+TextureStreamer::~TextureStreamer()
+{
+  if (stagingData)
+  {
+    stagingBuffer->unmap();
+  }
+  delete stagingBuffer;
+}
+
+bool TextureStreamer::isValid() const
+{
+  return valid;
+}
+
+void TextureStreamer::setBudget(VkDeviceSize budget)
+{
+  this->budget = budget;
+}
+
+VkDeviceSize TextureStreamer::getBudget() const
+{
+  return budget;
+}
+
+VkDeviceSize TextureStreamer::getResidentSize() const
+{
+  return residentSize;
+}
+
+void TextureStreamer::requestMipLevel(size_t textureIndex, uint32_t mipLevel)
+{
+  if (textureStates.size() <= textureIndex)
+  {
+    textureStates.resize(textureIndex + 1u);
+  }
+
+  uint32_t& requestedMipLevel = textureStates.at(textureIndex).requestedMipLevel;
+  requestedMipLevel = std::min(requestedMipLevel, mipLevel);
+}
+
+void TextureStreamer::update(const std::vector<Texture*>& textures, RenderProcess* renderProcess)
+{
+  ++frameIndex;
+
+  if (textureStates.size() < textures.size())
+  {
+    textureStates.resize(textures.size());
+  }
+
+  // The frames that copied from the oldest ranges of the staging ring are done once the render process of this frame
+  // is idle, the frames in flight after them are more recent
+  while (!uploadBatches.empty() && uploadBatches.front().recordedFrame > 0u &&
+         uploadBatches.front().recordedFrame + framesInFlightCount <= frameIndex)
+  {
+    uploadBatches.pop_front();
+  }
+
+  recordUploads(renderProcess);
+
+  // New textures get their mip tail before anything else, their descriptors get written right after this
+  uploadMipTails(textures, renderProcess);
+
+  // Recount, textures may have been added since the last frame
+  residentSize = 0u;
+  std::vector<size_t> streamInTextures;
+  for (size_t textureIndex = 0u; textureIndex < textures.size(); ++textureIndex)
+  {
+    const Texture* texture = textures.at(textureIndex);
+    TextureState& textureState = textureStates.at(textureIndex);
+    textureState.requestedMipLevel = std::min(textureState.requestedMipLevel, texture->getMipTailLevel());
+
+    const uint32_t residentMipLevel = texture->getResidentMipLevel();
+    residentSize += texture->getMipLevelsSize(residentMipLevel);
+    if (textureState.requestedMipLevel <= residentMipLevel)
+    {
+      textureState.lastNeededFrame = frameIndex;
+    }
+
+    if (textureState.requestedMipLevel < residentMipLevel && residentMipLevel <= texture->getMipTailLevel() &&
+        !textureState.uploadPending)
+    {
+      streamInTextures.push_back(textureIndex);
+    }
+  }
+
+  // The budget may have shrunk
+  makeRoom(textures, 0u, renderProcess);
+
+  // The blurriest textures first, i.e. the ones missing the most mip levels
+  std::sort(streamInTextures.begin(), streamInTextures.end(), [&](size_t a, size_t b) {
+    const uint32_t missingA = textures.at(a)->getResidentMipLevel() - textureStates.at(a).requestedMipLevel;
+    const uint32_t missingB = textures.at(b)->getResidentMipLevel() - textureStates.at(b).requestedMipLevel;
+    return missingA > missingB || (missingA == missingB && a < b);
+  });
+
+  VkDeviceSize stagingOffset, freeStagingSize;
+  findStagingRange(stagingOffset, freeStagingSize);
+
+  std::vector<Upload> uploads;
+  VkDeviceSize uploadSize = 0u;
+  for (const size_t textureIndex : streamInTextures)
+  {
+    Texture* texture = textures.at(textureIndex);
+    TextureState& textureState = textureStates.at(textureIndex);
+    const uint32_t residentMipLevel = texture->getResidentMipLevel();
+
+    // Go for the requested mip level if the upload allows it this frame, otherwise get as close as it does
+    uint32_t mipLevel = residentMipLevel - 1u;
+    while (mipLevel > textureState.requestedMipLevel &&
+           uploadSize + texture->getStagingSize(mipLevel - 1u) <= maxUploadSizePerFrame)
+    {
+      --mipLevel;
+    }
+
+    const VkDeviceSize stagingSize = texture->getStagingSize(mipLevel);
+    if (uploadSize > 0u && uploadSize + stagingSize > maxUploadSizePerFrame)
+    {
+      break;
+    }
+
+    // Mip levels that are bigger than the whole staging ring never stream in, see stagingRingSize
+    if (stagingSize > stagingRingSize)
+    {
+      continue;
+    }
+
+    // Otherwise the upload waits for the staging ring to free up. Smaller uploads that would still fit don't go ahead
+    // of it, they would keep the ring from ever having enough room.
+    if (uploadSize + stagingSize > freeStagingSize)
+    {
+      break;
+    }
+
+    const VkDeviceSize mipLevelsSize =
+      texture->getMipLevelsSize(mipLevel) - texture->getMipLevelsSize(residentMipLevel);
+    if (!makeRoom(textures, mipLevelsSize, renderProcess))
+    {
+      continue;
+    }
+
+    uploads.push_back({ texture, textureIndex, mipLevel, stagingOffset + uploadSize, mipLevelsSize });
+    textureState.uploadPending = true;
+    pendingSize += mipLevelsSize;
+    uploadSize += stagingSize;
+  }
+
+  if (!uploads.empty())
+  {
+    // Batches only get removed once they are filled, so the job can keep a reference to its own
+    UploadBatch& uploadBatch = uploadBatches.emplace_back();
+    uploadBatch.uploads = std::move(uploads);
+    uploadBatch.stagingOffset = stagingOffset;
+    uploadBatch.stagingSize = uploadSize;
+    threadPool->enqueue(
+      [this, &uploadBatch]
+      {
+        const profiler::Zone zone("Fill texture staging ring");
+        for (const Upload& upload : uploadBatch.uploads)
+        {
+          upload.texture->fillStagingData(upload.mipLevel, stagingData + upload.stagingOffset);
+        }
+        uploadBatch.filled = true;
+      });
+  }
+
+  // Requests are per frame
+  for (TextureState& textureState : textureStates)
+  {
+    textureState.requestedMipLevel = UINT32_MAX;
+  }
+}
+
+void TextureStreamer::uploadMipTails(const std::vector<Texture*>& textures, RenderProcess* renderProcess)
+{
+  // Staging sizes are aligned for any format already, so the mip tails can follow one another
+  std::vector<size_t> newTextures;
+  VkDeviceSize stagingSize = 0u;
+  for (size_t textureIndex = 0u; textureIndex < textures.size(); ++textureIndex)
+  {
+    const Texture* texture = textures.at(textureIndex);
+    if (texture->getResidentMipLevel() > texture->getMipTailLevel() && !textureStates.at(textureIndex).mipTailFailed)
+    {
+      newTextures.push_back(textureIndex);
+      stagingSize += texture->getStagingSize(texture->getMipTailLevel());
+    }
+  }
+
+  if (newTextures.empty())
+  {
+    return;
+  }
+
+  // Mip tails are small, so they are copied right here and don't wait for room in the staging ring. The staging buffer
+  // lives until the render process is done with this frame.
+  DataBuffer* mipTailStagingBuffer =
+    new DataBuffer(context, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingSize);
+  uint8_t* mipTailStagingData =
+    mipTailStagingBuffer->isValid() ? static_cast<uint8_t*>(mipTailStagingBuffer->map()) : nullptr;
+  if (!mipTailStagingData)
+  {
+    // Tried again next frame
+    delete mipTailStagingBuffer;
+    return;
+  }
+
+  VkDeviceSize stagingOffset = 0u;
+  for (const size_t textureIndex : newTextures)
+  {
+    const Texture* texture = textures.at(textureIndex);
+    texture->fillStagingData(texture->getMipTailLevel(), mipTailStagingData + stagingOffset);
+    stagingOffset += texture->getStagingSize(texture->getMipTailLevel());
+  }
+  mipTailStagingBuffer->unmap();
+
+  stagingOffset = 0u;
+  for (const size_t textureIndex : newTextures)
+  {
+    Texture* texture = textures.at(textureIndex);
+    const VkDeviceSize mipTailStagingSize = texture->getStagingSize(texture->getMipTailLevel());
+
+    // Nothing was resident, so there is no old image
+    ImageBuffer* oldImageBuffer = nullptr;
+    if (!texture->setResidentMipLevel(texture->getMipTailLevel(), renderProcess->getCommandBuffer(),
+                                      mipTailStagingBuffer->getBuffer(), stagingOffset, oldImageBuffer))
+    {
+      textureStates.at(textureIndex).mipTailFailed = true;
+    }
+    stagingOffset += mipTailStagingSize;
+  }
+
+  renderProcess->deleteWhenIdle(mipTailStagingBuffer);
+}
+
+void TextureStreamer::recordUploads(RenderProcess* renderProcess)
+{
+  for (UploadBatch& uploadBatch : uploadBatches)
+  {
+    if (uploadBatch.recordedFrame > 0u)
+    {
+      continue;
+    }
+
+    // Later batches wait for this one, so that the staging ring frees up in order
+    if (!uploadBatch.filled)
+    {
+      return;
+    }
+
+    for (const Upload& upload : uploadBatch.uploads)
+    {
+      // A texture that fails to upload keeps its old image, the error is reported already
+      ImageBuffer* oldImageBuffer = nullptr;
+      upload.texture->setResidentMipLevel(upload.mipLevel, renderProcess->getCommandBuffer(),
+                                          stagingBuffer->getBuffer(), upload.stagingOffset, oldImageBuffer);
+
+      // Earlier frames in flight may still sample the old image
+      renderProcess->deleteWhenIdle(oldImageBuffer);
+
+      textureStates.at(upload.textureIndex).uploadPending = false;
+      pendingSize -= upload.mipLevelsSize;
+    }
+    uploadBatch.recordedFrame = frameIndex;
+  }
+}
+
+void TextureStreamer::findStagingRange(VkDeviceSize& offset, VkDeviceSize& size) const
+{
+  if (uploadBatches.empty())
+  {
+    offset = 0u;
+    size = stagingRingSize;
+    return;
+  }
+
+  const UploadBatch& oldestBatch = uploadBatches.front();
+  const UploadBatch& newestBatch = uploadBatches.back();
+  const VkDeviceSize newestBatchEnd = newestBatch.stagingOffset + newestBatch.stagingSize;
+  if (newestBatch.stagingOffset < oldestBatch.stagingOffset)
+  {
+    // The batches wrapped around the end of the ring, what's free is between the newest and the oldest batch
+    offset = newestBatchEnd;
+    size = oldestBatch.stagingOffset - newestBatchEnd;
+    return;
+  }
+
+  // Otherwise it's either after the newest batch or before the oldest one, whichever is larger
+  const VkDeviceSize sizeAtEnd = stagingRingSize - newestBatchEnd;
+  const VkDeviceSize sizeAtStart = oldestBatch.stagingOffset;
+  offset = sizeAtEnd >= sizeAtStart ? newestBatchEnd : 0u;
+  size = std::max(sizeAtEnd, sizeAtStart);
+}
+
+bool TextureStreamer::evictMipLevels(Texture* texture, uint32_t mipLevel, RenderProcess* renderProcess)
+{
+  const VkDeviceSize oldSize = texture->getMipLevelsSize(texture->getResidentMipLevel());
+
+  // Dropping mip levels only copies the remaining ones from the old image, nothing gets uploaded
+  ImageBuffer* oldImageBuffer = nullptr;
+  if (!texture->setResidentMipLevel(mipLevel, renderProcess->getCommandBuffer(), VK_NULL_HANDLE, 0u, oldImageBuffer))
+  {
+    return false;
+  }
+
+  // Earlier frames in flight may still sample the old image
+  renderProcess->deleteWhenIdle(oldImageBuffer);
+
+  residentSize = residentSize - oldSize + texture->getMipLevelsSize(texture->getResidentMipLevel());
+  return true;
+}
+
+bool TextureStreamer::makeRoom(const std::vector<Texture*>& textures, VkDeviceSize size, RenderProcess* renderProcess)
+{
+  if (residentSize + pendingSize + size <= budget)
+  {
+    return true;
+  }
+
+  // Only textures with more mip levels than they currently need, and only when they haven't needed them for a while
+  std::vector<size_t> evictableTextures;
+  for (size_t textureIndex = 0u; textureIndex < textures.size(); ++textureIndex)
+  {
+    const TextureState& textureState = textureStates.at(textureIndex);
+    if (textureState.requestedMipLevel > textures.at(textureIndex)->getResidentMipLevel() &&
+        !textureState.uploadPending && frameIndex - textureState.lastNeededFrame >= minUnneededFrameCount)
+    {
+      evictableTextures.push_back(textureIndex);
+    }
+  }
+
+  std::sort(evictableTextures.begin(), evictableTextures.end(), [&](size_t a, size_t b) {
+    const uint64_t lastNeededFrameA = textureStates.at(a).lastNeededFrame;
+    const uint64_t lastNeededFrameB = textureStates.at(b).lastNeededFrame;
+    return lastNeededFrameA < lastNeededFrameB || (lastNeededFrameA == lastNeededFrameB && a < b);
+  });
+
+  for (const size_t textureIndex : evictableTextures)
+  {
+    // Down to the mip level it needs, which is the mip tail for textures that nothing requested
+    if (!evictMipLevels(textures.at(textureIndex), textureStates.at(textureIndex).requestedMipLevel, renderProcess))
+    {
+      return false;
+    }
+
+    if (residentSize + pendingSize + size <= budget)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
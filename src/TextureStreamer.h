@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+class Context;
+class DataBuffer;
+class RenderProcess;
+class Texture;
+class ThreadPool;
+
+/*
+ * The texture streamer decides which mip levels of the textures are resident in device memory. Textures start out with
+ * only their mip tail, which is cheap to upload and keep around, so the streamer uploads it right away in the first
+ * frame that has the texture. Every frame the renderer requests the mip level each
+ * visible texture needs from the size of its objects on screen, and the streamer uploads the missing levels over the
+ * following frames, a limited amount per frame. Mip levels that were not needed for a while stay resident until the
+ * budget runs out, then the least recently needed ones get evicted first.
+ * Uploads go through a staging ring buffer that stays mapped for as long as the streamer lives. The streamer picks the
+ * mip levels to upload in one frame, the thread pool reads their pixel data from the texture files into the ring, and
+ * the first frame after that finished records the copies into the images, so the render thread never waits for them.
+ * A range of the ring is free again once all frames in flight that could still read it are done.
+ *
+ * [tdbe] the budget only covers the streamed textures, not the render targets or the geometry. It is a soft limit:
+ * mip tails always stay resident, and textures that are needed right now never get evicted to make room for others.
+ */
+class TextureStreamer final
+{
+public:
+  TextureStreamer(const Context* context, ThreadPool* threadPool, VkDeviceSize budget, size_t framesInFlightCount);
+  ~TextureStreamer(); // The thread pool has to be done with the jobs of the streamer by then
+
+  bool isValid() const;
+
+  void setBudget(VkDeviceSize budget);
+  VkDeviceSize getBudget() const;
+  // How much device memory the resident mip levels of all textures take up, as of the last update()
+  VkDeviceSize getResidentSize() const;
+
+  // Asks for 'mipLevel' of the texture at 'textureIndex' or a more detailed one for the current frame. Textures that
+  // nothing asks for are only needed at their mip tail.
+  void requestMipLevel(size_t textureIndex, uint32_t mipLevel);
+
+  // Starts streaming in the mip levels requested since the last call, records the uploads that are ready by now, and
+  // evicts mip levels to stay within the budget. Copies and uploads get recorded into the command buffer of
+  // 'renderProcess', which also keeps the replaced images until they are no longer in use. Call it once per frame,
+  // after waiting for the render process to be idle, outside of any render pass and before the texture descriptors of
+  // the frame are updated. Textures have to outlive the streamer.
+  void update(const std::vector<Texture*>& textures, RenderProcess* renderProcess);
+
+private:
+  bool valid = true;
+
+  const Context* context = nullptr;
+  VkDeviceSize budget = 0u;
+  VkDeviceSize residentSize = 0u;
+  VkDeviceSize pendingSize = 0u; // What the uploads that aren't recorded yet add to the resident size
+  uint64_t frameIndex = 0u;
+  size_t framesInFlightCount = 0u;
+
+  ThreadPool* threadPool = nullptr;
+  DataBuffer* stagingBuffer = nullptr;
+  uint8_t* stagingData = nullptr; // The staging ring, mapped for as long as the streamer lives
+
+  struct TextureState
+  {
+    uint32_t requestedMipLevel = UINT32_MAX; // For the current frame, down to the mip tail if nothing requests it
+    uint64_t lastNeededFrame = 0u;           // The last frame that needed all of its resident mip levels
+    bool uploadPending = false;              // Until its upload is recorded, its mip levels stay as they are
+    bool mipTailFailed = false;              // The texture has no image, the error is reported already
+  };
+  std::vector<TextureState> textureStates; // By texture index
+
+  struct Upload
+  {
+    Texture* texture = nullptr;
+    size_t textureIndex = 0u;
+    uint32_t mipLevel = 0u;
+    VkDeviceSize stagingOffset = 0u;
+    VkDeviceSize mipLevelsSize = 0u; // What it adds to the resident size
+  };
+
+  // The uploads picked in one frame, they share a range of the staging ring
+  struct UploadBatch
+  {
+    std::vector<Upload> uploads;
+    VkDeviceSize stagingOffset = 0u, stagingSize = 0u;
+    std::atomic<bool> filled = false; // Set by the thread pool once the pixel data is in the staging ring
+    uint64_t recordedFrame = 0u;      // The frame that recorded the uploads, 0 until then
+  };
+  std::deque<UploadBatch> uploadBatches; // Oldest first, which is also the order of their ranges in the ring
+
+  // Uploads the mip tail of the textures that have nothing resident yet, through a staging buffer of its own
+  void uploadMipTails(const std::vector<Texture*>& textures, RenderProcess* renderProcess);
+  // Records the uploads of the batches that are filled, in order
+  void recordUploads(RenderProcess* renderProcess);
+  // The largest free range of the staging ring that follows the newest batch, so that the ring stays in order
+  void findStagingRange(VkDeviceSize& offset, VkDeviceSize& size) const;
+  // Drops the mip levels of the texture that are more detailed than 'mipLevel'
+  bool evictMipLevels(Texture* texture, uint32_t mipLevel, RenderProcess* renderProcess);
+  // Evicts mip levels of textures that haven't needed them lately, least recently needed first, until 'size' more
+  // bytes fit into the budget. Returns false if they don't fit.
+  bool makeRoom(const std::vector<Texture*>& textures, VkDeviceSize size, RenderProcess* renderProcess);
+};
@@ -0,0 +1,84 @@
+#include "ThreadPool.h"
+
+#include "CpuProfiler.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+  if (threadCount == 0u)
+  {
+    // hardware_concurrency() may not be able to tell and return 0
+    threadCount = std::max(static_cast<size_t>(std::thread::hardware_concurrency()), static_cast<size_t>(1u));
+  }
+
+  threads.reserve(threadCount);
+  for (size_t threadIndex = 0u; threadIndex < threadCount; ++threadIndex)
+  {
+    threads.emplace_back(&ThreadPool::run, this);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    stopRequested = true;
+  }
+  jobCondition.notify_all();
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+}
+
+void ThreadPool::enqueue(const std::function<void()>& job)
+{
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(job);
+  }
+  jobCondition.notify_one();
+}
+
+void ThreadPool::wait()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  idleCondition.wait(lock, [this] { return jobs.empty() && activeJobCount == 0u; });
+}
+
+size_t ThreadPool::getThreadCount() const
+{
+  return threads.size();
+}
+
+void ThreadPool::run()
+{
+  profiler::setThreadName("Worker");
+
+  while (true)
+  {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      jobCondition.wait(lock, [this] { return !jobs.empty() || stopRequested; });
+      if (jobs.empty())
+      {
+        return; // Stop requested with no jobs left
+      }
+
+      job = std::move(jobs.front());
+      jobs.pop_front();
+      ++activeJobCount;
+    }
+
+    job();
+
+    {
+      const std::lock_guard<std::mutex> lock(mutex);
+      --activeJobCount;
+    }
+    idleCondition.notify_all();
+  }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * The thread pool class runs independent jobs on a fixed number of worker threads, e.g. for compiling pipelines. Jobs
+ * are started in the order they were enqueued, but may finish in any order. A job must not throw, and it must not
+ * enqueue other jobs and wait for them.
+ */
+class ThreadPool final
+{
+public:
+  // A thread count of 0 creates one worker per hardware thread
+  explicit ThreadPool(size_t threadCount = 0u);
+  ~ThreadPool(); // Finishes all enqueued jobs, then joins the workers
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  void enqueue(const std::function<void()>& job);
+  // Waits until all enqueued jobs have finished
+  void wait();
+
+  size_t getThreadCount() const;
+
+private:
+  std::deque<std::function<void()>> jobs;
+  size_t activeJobCount = 0u; // Taken off the queue but not finished yet
+  bool stopRequested = false;
+
+  std::mutex mutex; // Guards all of the above
+  std::condition_variable jobCondition, idleCondition;
+  std::vector<std::thread> threads;
+
+  void run();
+};
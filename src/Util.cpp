@@ -38,6 +38,9 @@ void util::error(Error error, const std::string& details)
   case Error::OutOfMemory:
     s << "Program ran out of memory";
     break;
+  case Error::TextureLoadingFailure:
+    s << "Failed to load texture";
+    break;
   case Error::VulkanNotSupported:
     s << "Vulkan is not supported";
     break;
@@ -104,12 +107,17 @@ bool util::loadShaderFromFile(VkDevice device, const std::string& filename, VkSh
   file.read(code.data(), fileSize);
   file.close();
 
+  return createShaderModule(device, reinterpret_cast<const uint32_t*>(code.data()), code.size(), shaderModule);
+}
+
+bool util::createShaderModule(VkDevice device, const uint32_t* code, size_t codeSize, VkShaderModule& shaderModule)
+{
   VkShaderModuleCreateInfo shaderModuleCreateInfo;
   shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
   shaderModuleCreateInfo.pNext = nullptr;
   shaderModuleCreateInfo.flags = 0u;
-  shaderModuleCreateInfo.codeSize = code.size();
-  shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+  shaderModuleCreateInfo.codeSize = codeSize;
+  shaderModuleCreateInfo.pCode = code;
   if (vkCreateShaderModule(device, &shaderModuleCreateInfo, nullptr, &shaderModule) != VK_SUCCESS)
   {
     return false;
@@ -28,6 +28,7 @@ enum class Error
   HeadsetNotConnected,
   ModelLoadingFailure,
   OutOfMemory,
+  TextureLoadingFailure,
   VulkanNotSupported,
   WindowFailure
 };
@@ -61,6 +62,9 @@ std::vector<const char*> unpackExtensionString(const std::string& string);
 // Loads a Vulkan shader from 'file' into 'shaderModule', returns false on error
 bool loadShaderFromFile(VkDevice device, const std::string& filename, VkShaderModule& shaderModule);
 
+// Creates a Vulkan shader module from 'codeSize' bytes of SPIR-V in 'code', returns false on error
+bool createShaderModule(VkDevice device, const uint32_t* code, size_t codeSize, VkShaderModule& shaderModule);
+
 // Finds a suitable Vulkan memory type index for given requirements and properties, returns false on error
 bool findSuitableMemoryTypeIndex(VkPhysicalDevice physicalDevice,
                                  VkMemoryRequirements requirements,
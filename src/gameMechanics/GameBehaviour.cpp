@@ -8,5 +8,9 @@ void GameBehaviour::Update(const float deltaTime, const float gameTime, const In
                            Inputspace::InputHaptics &inputHaptics){
 }
 
+const char* GameBehaviour::GetName() const{
+    return "GameBehaviour";
+}
+
 GameBehaviour::~GameBehaviour(){
 }
\ No newline at end of file
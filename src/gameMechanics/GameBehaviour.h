@@ -15,6 +15,8 @@ class GameBehaviour
         //Start();
         virtual void Update(const float deltaTime, const float gameTime, const Inputspace::InputData &inputData, 
                             Inputspace::InputHaptics &inputHaptics);
+        // Shows up in the CPU profiler trace, has to be a string literal
+        virtual const char* GetName() const;
 
     private:
 
@@ -46,5 +46,9 @@ void InputTesterBehaviour::Update(const float deltaTime, const float gameTime,
     }
 }
 
+const char* InputTesterBehaviour::GetName() const{
+    return "InputTesterBehaviour";
+}
+
 InputTesterBehaviour::~InputTesterBehaviour(){
 }
\ No newline at end of file
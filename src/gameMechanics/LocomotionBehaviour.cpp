@@ -90,10 +90,10 @@ void LocomotionBehaviour::HandleMovementState(const float deltaTime, const Input
         float moveSpeed = avgGrabInput * movementSpeedScaler * glm::pow(moveStateData.moveInputSpeed, movementAccelerationPow);
         glm::vec3 moveVec = -100.0f * moveStateData.moveDir * moveSpeed * deltaTime;
         //printf("\n[LocomotionBehaviour][log] moveSpeed: {%f}, moveVec: {%f}{%f}{%f}", moveSpeed, moveVec.x, moveVec.y, moveVec.z);
-        playerObject.head->worldMatrix = glm::translate(playerObject.head->worldMatrix, moveVec);
-        playerObject.handLeft->worldMatrix = glm::translate(playerObject.handLeft->worldMatrix, -moveVec);
+        playerObject.head->setWorldMatrix(glm::translate(playerObject.head->getWorldMatrix(), moveVec));
+        playerObject.handLeft->setWorldMatrix(glm::translate(playerObject.handLeft->getWorldMatrix(), -moveVec));
         moveVec.x = -moveVec.x;// because right hand is a flipped left hand model
-        playerObject.handRight->worldMatrix = glm::translate(playerObject.handRight->worldMatrix, -moveVec);
+        playerObject.handRight->setWorldMatrix(glm::translate(playerObject.handRight->getWorldMatrix(), -moveVec));
 
         // [tdbe] rotate player based on line between the hands
         moveStateData.dirLeftRight = moveStateData.posRight - moveStateData.posLeft;
@@ -103,8 +103,8 @@ void LocomotionBehaviour::HandleMovementState(const float deltaTime, const Input
         float radang = util::vectorAngleAroundNormal(moveStateData.dirLeftRight,moveStateData.prevDirLeftRight, norm);
         radang = 100.0f * avgGrabInput * rotationSpeedScaler * radang * deltaTime;
         //printf("\n[LocomotionBehaviour][log] rotation angle rad: %f", radang);
-        glm::vec3 camPos = glm::vec3(playerObject.head->worldMatrix[3]);
-        playerObject.head->worldMatrix = glm::rotate(playerObject.head->worldMatrix, radang, norm);
+        glm::vec3 camPos = glm::vec3(playerObject.head->getWorldMatrix()[3]);
+        playerObject.head->setWorldMatrix(glm::rotate(playerObject.head->getWorldMatrix(), radang, norm));
 
         moveStateData.prevPosLeft = moveStateData.posLeft;
         moveStateData.prevPosRight = moveStateData.posRight;
@@ -203,6 +203,10 @@ void LocomotionBehaviour::Update(const float deltaTime, const float gameTime,
     }
 }   
 
+const char* LocomotionBehaviour::GetName() const{
+    return "LocomotionBehaviour";
+}
+
 LocomotionBehaviour::~LocomotionBehaviour(){
     
 }
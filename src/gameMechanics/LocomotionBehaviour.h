@@ -16,6 +16,7 @@ class LocomotionBehaviour : public GameBehaviour
         //Start();
         virtual void Update(const float deltaTime, const float gameTime, const Inputspace::InputData &inputData, 
                             Inputspace::InputHaptics &inputHaptics);
+        virtual const char* GetName() const;
 
     private:
         enum class VisualsState{
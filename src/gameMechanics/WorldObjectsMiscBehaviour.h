@@ -13,6 +13,7 @@ class WorldObjectsMiscBehaviour : public GameBehaviour
         //Start();
         virtual void Update(const float deltaTime, const float gameTime, const Inputspace::InputData &inputData, 
                             Inputspace::InputHaptics &inputHaptics);
+        virtual const char* GetName() const;
 
     private:
         GameObject& bikeObject;
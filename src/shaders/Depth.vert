@@ -0,0 +1,49 @@
+#extension GL_EXT_multiview : enable
+
+struct ObjectData
+{
+    mat4 worldMatrix;
+    uint materialIndex;
+};
+
+layout(std430, binding = 0) readonly buffer ObjectTable
+{
+    ObjectData objects[];
+} objectTable;
+
+// Per-draw object data, pushed by the renderer with Renderer::ObjectDataSource::PushConstants, see PushConstantData
+layout(push_constant) uniform PushConstants
+{
+    mat4 worldMatrix;
+    uint materialIndex;
+} pushConstants;
+
+// Set by the renderer for its object data source, the other one compiles away
+layout(constant_id = 3) const bool objectDataFromTable = true;
+
+ObjectData getObjectData()
+{
+  if (objectDataFromTable)
+  {
+    return objectTable.objects[gl_InstanceIndex];
+  }
+
+  return ObjectData(pushConstants.worldMatrix, pushConstants.materialIndex);
+}
+
+layout(binding = 1) uniform ViewProjection
+{
+    mat4 matrices[2];
+} viewProjection;
+
+layout(location = 0) in vec3 inPosition;
+
+// The main pass tests for equal depth against this, so every vertex shader has to compute the position the same way
+invariant gl_Position;
+
+void main()
+{
+  const ObjectData objectData = getObjectData();
+
+  gl_Position = viewProjection.matrices[gl_ViewIndex] * objectData.worldMatrix * vec4(inPosition, 1.0);
+}
\ No newline at end of file
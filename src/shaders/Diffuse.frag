@@ -1,14 +1,33 @@
+#extension GL_EXT_nonuniform_qualifier : enable
+
 layout(location = 0) in vec3 normal;
-layout(location = 1) in vec3 color;
+layout(location = 1) in vec4 color;
+layout(location = 2) in vec2 texCoord;
+layout(location = 3) flat in uint baseColorTexture;
+
+// All textures, see Renderer::addTexture(). The elements past the added textures are left unbound.
+layout(binding = 6) uniform sampler2D textures[];
 
 layout(location = 0) out vec4 outColor;
 
+// Material variant, see MaterialSpecialization in Pipeline.h. The driver compiles the unused paths away.
+layout(constant_id = 1) const bool lightingEnabled = true; // Unlit materials output their color as is
+
 void main()
 {
+  // Texture 0 is plain white, so untextured materials don't need a branch
+  const vec4 baseColor = color * texture(textures[nonuniformEXT(baseColorTexture)], texCoord);
+
+  if (!lightingEnabled)
+  {
+    outColor = baseColor;
+    return;
+  }
+
   const vec3 lightDir = vec3(1.0, -1.0, -1.0);
   const float diffuse = clamp(dot(normal, -lightDir), 0.0, 1.0);
 
   const vec3 ambient = vec3(0.07, 0.05, 0.1);
 
-  outColor = vec4(ambient + color * diffuse, 1.0);
+  outColor = vec4(ambient + baseColor.xyz * diffuse, baseColor.w);
 }
\ No newline at end of file
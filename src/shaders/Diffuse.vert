@@ -1,10 +1,47 @@
 #extension GL_EXT_multiview : enable
 
-layout(binding = 0) uniform DynBufData
+struct ObjectData
 {
     mat4 worldMatrix;
+    uint materialIndex;
+};
+
+layout(std430, binding = 0) readonly buffer ObjectTable
+{
+    ObjectData objects[];
+} objectTable;
+
+// Per-draw object data, pushed by the renderer with Renderer::ObjectDataSource::PushConstants, see PushConstantData
+layout(push_constant) uniform PushConstants
+{
+    mat4 worldMatrix;
+    uint materialIndex;
+} pushConstants;
+
+// Set by the renderer for its object data source, the other one compiles away
+layout(constant_id = 3) const bool objectDataFromTable = true;
+
+ObjectData getObjectData()
+{
+  if (objectDataFromTable)
+  {
+    return objectTable.objects[gl_InstanceIndex];
+  }
+
+  return ObjectData(pushConstants.worldMatrix, pushConstants.materialIndex);
+}
+
+// Material properties, shared by all objects of a material, see RenderProcess::MaterialData
+struct MaterialData
+{
     vec4 colorMultiplier;
-} dynBufData;
+    uint baseColorTexture; // Into the texture array
+};
+
+layout(std430, binding = 5) readonly buffer MaterialTable
+{
+    MaterialData materials[];
+} materialTable;
 
 layout(binding = 1) uniform ViewProjection
 {
@@ -14,16 +51,31 @@ layout(binding = 1) uniform ViewProjection
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec3 inColor;
-//layout(location = 3) in vec3 colorMultiplier;
+layout(location = 3) in vec2 inTexCoord;
 
 layout(location = 0) out vec3 normal; // In world space
-layout(location = 1) out vec3 color;
+layout(location = 1) out vec4 color;
+layout(location = 2) out vec2 texCoord;
+layout(location = 3) flat out uint baseColorTexture;
+
+// Material variant, see MaterialSpecialization in Pipeline.h. The driver compiles the unused paths away.
+layout(constant_id = 0) const bool alphaOutput = false;  // Alpha from the color multiplier, for blending
+layout(constant_id = 2) const int vertexColorSource = 0; // 0: vertex color, 1: none (white)
+
+// Has to match the depth prepass (Depth.vert)
+invariant gl_Position;
 
 void main()
 {
-  gl_Position = viewProjection.matrices[gl_ViewIndex] * dynBufData.worldMatrix * vec4(inPosition, 1.0);
+  const ObjectData objectData = getObjectData();
+  const MaterialData materialData = materialTable.materials[objectData.materialIndex];
+
+  gl_Position = viewProjection.matrices[gl_ViewIndex] * objectData.worldMatrix * vec4(inPosition, 1.0);
 
-  normal = normalize(vec3(dynBufData.worldMatrix * vec4(inNormal, 0.0)));
-  color = inColor
-          * dynBufData.colorMultiplier.xyz;
+  normal = normalize(vec3(objectData.worldMatrix * vec4(inNormal, 0.0)));
+  const vec3 baseColor = (vertexColorSource == 0) ? inColor : vec3(1.0);
+  color.xyz = baseColor * materialData.colorMultiplier.xyz;
+  color.w = alphaOutput ? materialData.colorMultiplier.w : 1.0;
+  texCoord = inTexCoord;
+  baseColorTexture = materialData.baseColorTexture;
 }
\ No newline at end of file
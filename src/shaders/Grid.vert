@@ -1,10 +1,47 @@
 #extension GL_EXT_multiview : enable
 
-layout(binding = 0) uniform DynBufData
+struct ObjectData
 {
     mat4 worldMatrix;
+    uint materialIndex;
+};
+
+layout(std430, binding = 0) readonly buffer ObjectTable
+{
+    ObjectData objects[];
+} objectTable;
+
+// Per-draw object data, pushed by the renderer with Renderer::ObjectDataSource::PushConstants, see PushConstantData
+layout(push_constant) uniform PushConstants
+{
+    mat4 worldMatrix;
+    uint materialIndex;
+} pushConstants;
+
+// Set by the renderer for its object data source, the other one compiles away
+layout(constant_id = 3) const bool objectDataFromTable = true;
+
+ObjectData getObjectData()
+{
+  if (objectDataFromTable)
+  {
+    return objectTable.objects[gl_InstanceIndex];
+  }
+
+  return ObjectData(pushConstants.worldMatrix, pushConstants.materialIndex);
+}
+
+// Material properties, shared by all objects of a material, see RenderProcess::MaterialData
+struct MaterialData
+{
     vec4 colorMultiplier;
-} dynBufData;
+    uint baseColorTexture;
+};
+
+layout(std430, binding = 5) readonly buffer MaterialTable
+{
+    MaterialData materials[];
+} materialTable;
 
 layout(binding = 1) uniform ViewProjection
 {
@@ -18,12 +55,17 @@ layout(location = 2) in vec3 inColor;
 layout(location = 0) out vec3 position; // In world space
 layout(location = 1) out vec3 color;
 
+// Has to match the depth prepass (Depth.vert)
+invariant gl_Position;
+
 void main()
 {
-  vec4 pos = dynBufData.worldMatrix * vec4(inPosition, 1.0);
-  gl_Position = viewProjection.matrices[gl_ViewIndex] * pos;
-  position = pos.xyz;
+  const ObjectData objectData = getObjectData();
+  const MaterialData materialData = materialTable.materials[objectData.materialIndex];
+
+  gl_Position = viewProjection.matrices[gl_ViewIndex] * objectData.worldMatrix * vec4(inPosition, 1.0);
+  position = vec3(objectData.worldMatrix * vec4(inPosition, 1.0));
 
   color = inColor
-          *dynBufData.colorMultiplier.xyz;
+          *materialData.colorMultiplier.xyz;
 }
\ No newline at end of file
@@ -1,9 +1,35 @@
 #extension GL_EXT_multiview : enable
 
-layout(binding = 0) uniform World
+struct ObjectData
 {
-    mat4 matrix;
-} world;
+    mat4 worldMatrix;
+    uint materialIndex;
+};
+
+layout(std430, binding = 0) readonly buffer ObjectTable
+{
+    ObjectData objects[];
+} objectTable;
+
+// Per-draw object data, pushed by the renderer with Renderer::ObjectDataSource::PushConstants, see PushConstantData
+layout(push_constant) uniform PushConstants
+{
+    mat4 worldMatrix;
+    uint materialIndex;
+} pushConstants;
+
+// Set by the renderer for its object data source, the other one compiles away
+layout(constant_id = 3) const bool objectDataFromTable = true;
+
+ObjectData getObjectData()
+{
+  if (objectDataFromTable)
+  {
+    return objectTable.objects[gl_InstanceIndex];
+  }
+
+  return ObjectData(pushConstants.worldMatrix, pushConstants.materialIndex);
+}
 
 layout(binding = 1) uniform ViewProjection
 {
@@ -18,11 +44,16 @@ layout(location = 2) in vec3 inColor;
 layout(location = 0) out vec3 normal; // In world space
 layout(location = 1) out vec3 color;
 
+// Has to match the depth prepass (Depth.vert)
+invariant gl_Position;
+
 void main()
 {
-  gl_Position = viewProjection.matrices[gl_ViewIndex] * world.matrix * vec4(inPosition, 1.0);
+  const ObjectData objectData = getObjectData();
+
+  gl_Position = viewProjection.matrices[gl_ViewIndex] * objectData.worldMatrix * vec4(inPosition, 1.0);
 
-  normal = normalize(vec3(world.matrix * vec4(inNormal, 0.0)));
+  normal = normalize(vec3(objectData.worldMatrix * vec4(inNormal, 0.0)));
   color = inColor
           ;//*colorMultiplier;
 }
\ No newline at end of file